@@ -7,9 +7,23 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
 
 #include <db.h>
 #include "dbrace.h"
+#include "bench.h"
+#include "worker.h"
+#include "workload.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
+#include "sink.h"
+#include "delete.h"
+#include "secondary.h"
+#include "crash.h"
+#include "stage.h"
 #include "bdb.h"
 
 #define BDB_OK        0
@@ -18,6 +32,36 @@
 static int bdb_env_flags = 0;
 static DB_ENV *dbenv;
 static DB *db;
+static DB *sdb;                     /* -i, the secondary index */
+
+/*
+ * Durability, -E. Commits either sync the log (the default), only write
+ * it to the OS, leave it in the log buffer or never leave memory at all.
+ */
+enum bdb_durability {
+    BDB_SYNC,
+    BDB_WRITE_NOSYNC,
+    BDB_NOSYNC,
+    BDB_INMEM
+};
+
+static const char *bdb_durability_names[] = {
+    "sync", "write-nosync", "nosync", "inmem", NULL
+};
+
+static enum bdb_durability bdb_durability = BDB_SYNC;
+static unsigned long bdb_logbuf = 0;        /* bytes, 0 is the BDB default */
+static unsigned long bdb_logfile = 0;       /* bytes, 0 is the BDB default */
+static int bdb_nowait = 0;
+static int bdb_snapshot = 0;        /* DB_MULTIVERSION, reads in DB_TXN_SNAPSHOT */
+static int bdb_register = 0;        /* DB_REGISTER, recover after a dead process */
+
+/* Commit and log counters at open, bdb_print_stats() reports the difference */
+struct bdb_counts {
+    unsigned long commits, writes, syncs, wbytes;
+};
+
+static struct bdb_counts bdb_open_counts;
 
 static void bdb_error(int rc, const char *format, ...)
 {
@@ -29,24 +73,348 @@ static void bdb_error(int rc, const char *format, ...)
     exit(2);
 }
 
+/*
+ * Records are read into buffers the caller keeps across calls
+ * (DB_DBT_USERMEM) rather than ones BerkeleyDB reallocates for every
+ * record. A value that doesn't fit grows the buffer and is read again.
+ */
+#define BDB_RECORD_BUFFER 4096
+
+static void bdb_usermem(DBT *dbt, size_t size)
+{
+    if ((dbt->data = realloc(dbt->data, size)) == NULL)
+        bdb_error(ENOMEM, "Couldn't allocate %lu byte record buffer", (unsigned long)size);
+    dbt->ulen = size;
+    dbt->flags = DB_DBT_USERMEM;
+}
+
+static int bdb_db_get(DB_TXN *tid, DBT *key, DBT *data)
+{
+    int rc;
+
+    while ((rc = db->get(db, tid, key, data, 0)) == DB_BUFFER_SMALL)
+        bdb_usermem(data, data->size);
+    return rc;
+}
+
+/* The cursor stays where it was when the buffer was too small */
+static int bdb_c_get(DBC *cur, DBT *key, DBT *data, u_int32_t flags)
+{
+    int rc;
+
+    while ((rc = cur->c_get(cur, key, data, flags)) == DB_BUFFER_SMALL)
+        bdb_usermem(data, data->size);
+    return rc;
+}
+
+int bdb_parse_opts(char *spec)
+{
+    char *const tokens[] = { "durability", "logbuf", "logfile", "nowait", "snapshot", "register", NULL };
+    char *value;
+    int i;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            if (value == NULL)
+                return -1;
+            for (i = 0; bdb_durability_names[i]; i++)
+                if (strcmp(value, bdb_durability_names[i]) == 0)
+                    break;
+            if (bdb_durability_names[i] == NULL)
+                return -1;
+            bdb_durability = i;
+            break;
+        case 1:
+            if (value == NULL || (bdb_logbuf = strtoul(value, NULL, 0) * 1024) == 0)
+                return -1;
+            break;
+        case 2:
+            if (value == NULL || (bdb_logfile = strtoul(value, NULL, 0) * 1024 * 1024) == 0)
+                return -1;
+            break;
+        case 3:
+            bdb_nowait = 1;
+            break;
+        case 4:
+            bdb_snapshot = 1;
+            break;
+        case 5:
+            bdb_register = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void bdb_print_opts(void)
+{
+    printf("Durability: %s", bdb_durability_names[bdb_durability]);
+    if (bdb_logbuf)
+        printf(", log buffer %lu KB", bdb_logbuf / 1024);
+    if (bdb_logfile)
+        printf(", log file %lu MB", bdb_logfile / (1024 * 1024));
+    if (bdb_nowait)
+        printf(", no lock waits");
+    printf(", %s reads", bdb_snapshot ? "snapshot" : "locking");
+    if (bdb_register)
+        printf(", registered processes");
+    printf("\n");
+    results_option("bdb_durability", "%s", bdb_durability_names[bdb_durability]);
+    results_option("bdb_logbuf_kb", "%lu", bdb_logbuf / 1024);
+    results_option("bdb_logfile_mb", "%lu", bdb_logfile / (1024 * 1024));
+    results_option("bdb_nowait", "%d", bdb_nowait);
+    results_option("bdb_snapshot", "%d", bdb_snapshot);
+    results_option("bdb_register", "%d", bdb_register);
+}
+
+static void bdb_counts(struct bdb_counts *c)
+{
+    DB_TXN_STAT *txn_stat;
+    DB_LOG_STAT *log_stat;
+    int rc;
+
+    rc = dbenv->txn_stat(dbenv, &txn_stat, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't get transaction statistics");
+    rc = dbenv->log_stat(dbenv, &log_stat, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't get log statistics");
+
+    c->commits = txn_stat->st_ncommits;
+    c->writes = log_stat->st_wcount;
+    c->syncs = log_stat->st_scount;
+    c->wbytes = (unsigned long)log_stat->st_w_mbytes * 1024 * 1024 + log_stat->st_w_bytes;
+
+    free(txn_stat);
+    free(log_stat);
+}
+
+/* Cache, log and lock counters of the environment for every phase */
+static void bdb_sample(struct counters *c, int begin)
+{
+    DB_MPOOL_STAT *mp;
+    DB_LOG_STAT *lg;
+    DB_LOCK_STAT *lk;
+    int rc;
+
+    (void)begin;
+    if ((rc = dbenv->memp_stat(dbenv, &mp, NULL, 0)) != BDB_OK)
+        bdb_error(rc, "Couldn't get cache statistics");
+    if ((rc = dbenv->log_stat(dbenv, &lg, 0)) != BDB_OK)
+        bdb_error(rc, "Couldn't get log statistics");
+    if ((rc = dbenv->lock_stat(dbenv, &lk, 0)) != BDB_OK)
+        bdb_error(rc, "Couldn't get lock statistics");
+
+    counters_add(c, "cache_hit", mp->st_cache_hit, 0);
+    counters_add(c, "cache_miss", mp->st_cache_miss, 0);
+    counters_add(c, "evictions", mp->st_ro_evict + mp->st_rw_evict, 0);
+    counters_add(c, "pages_read", mp->st_page_in, 0);
+    counters_add(c, "pages_written", mp->st_page_out, 0);
+    counters_add(c, "log_flushes", lg->st_scount, 0);
+    counters_add(c, "log_bytes", (uint64_t)lg->st_w_mbytes * 1024 * 1024 + lg->st_w_bytes, 0);
+    counters_add(c, "lock_requests", lk->st_nrequests, 0);
+    counters_add(c, "lock_waits", lk->st_lock_wait, 0);
+    counters_add(c, "deadlocks", lk->st_ndeadlocks, 0);
+
+    free(mp);
+    free(lg);
+    free(lk);
+}
+
+/*
+ * Commits and log I/O since bdb_open(). Several commits sharing one log
+ * flush is group commit at work, with nosync or inmem there are none.
+ */
+void bdb_print_stats(void)
+{
+    struct bdb_counts c;
+
+    bdb_counts(&c);
+    c.commits -= bdb_open_counts.commits;
+    c.writes -= bdb_open_counts.writes;
+    c.syncs -= bdb_open_counts.syncs;
+    c.wbytes -= bdb_open_counts.wbytes;
+
+    printf("Commits: %lu, log writes: %lu, log flushes: %lu", c.commits, c.writes, c.syncs);
+    if (c.syncs)
+        printf(" (%.1f commits per flush)", (double)c.commits / c.syncs);
+    printf(", log bytes: %lu\n", c.wbytes);
+
+    results_metric("bdb_commits", "%lu", c.commits);
+    results_metric("bdb_log_writes", "%lu", c.writes);
+    results_metric("bdb_log_flushes", "%lu", c.syncs);
+    results_metric("bdb_log_bytes", "%lu", c.wbytes);
+}
+
+/* Bytes of the log files in the environment */
+static unsigned long long bdb_log_bytes(void)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat sb;
+    char path[PATH_MAX];
+    unsigned long long bytes = 0;
+
+    if ((d = opendir(BDB_ENV_DIRECTORY)) == NULL)
+        return 0;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, "log.", 4) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", BDB_ENV_DIRECTORY, de->d_name);
+        if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+            bytes += sb.st_size;
+    }
+    closedir(d);
+    return bytes;
+}
+
+/*
+ * What the btree costs on disk: the file against the bytes its leaf and
+ * overflow pages hold, how full the leaves are and how many pages sit on
+ * the free list. DB->stat walks the whole tree for this.
+ */
+void bdb_print_space(void)
+{
+    DB_BTREE_STAT *st;
+    struct stat sb;
+    unsigned long long file = 0, index = 0, used, leaf, logs;
+    double mb = 1024.0 * 1024.0, fill;
+    int rc;
+
+    if ((rc = db->stat(db, NULL, &st, 0)) != BDB_OK)
+        bdb_error(rc, "Couldn't get btree statistics");
+    if (stat(BDB_ENV_DIRECTORY "/" BDB_DB_FILENAME, &sb) == 0)
+        file = sb.st_size;
+    if (sdb && stat(BDB_ENV_DIRECTORY "/" BDB_INDEX_FILENAME, &sb) == 0)
+        index = sb.st_size;
+    logs = bdb_log_bytes();
+
+    leaf = (unsigned long long)st->bt_leaf_pg * st->bt_pagesize;
+    used = leaf - st->bt_leaf_pgfree +
+           (unsigned long long)st->bt_over_pg * st->bt_pagesize - st->bt_over_pgfree;
+    fill = leaf ? (double)(leaf - st->bt_leaf_pgfree) / leaf : 0.0;
+
+    printf("Space: %.1f MB file, %lu pages, %lu free, leaf fill %.1f%%, %.1f MB in use",
+           file / mb, (unsigned long)st->bt_pagecnt, (unsigned long)st->bt_free,
+           100.0 * fill, used / mb);
+    if (used)
+        printf(" (space amplification %.2f)", (double)file / used);
+    if (sdb)
+        printf(", %.1f MB index", index / mb);
+    printf(", %.1f MB of log\n", logs / mb);
+
+    results_metric("bdb_file_bytes", "%llu", file);
+    if (sdb)
+        results_metric("bdb_index_bytes", "%llu", index);
+    results_metric("bdb_log_bytes_on_disk", "%llu", logs);
+    results_metric("bdb_pages", "%lu", (unsigned long)st->bt_pagecnt);
+    results_metric("bdb_free_pages", "%lu", (unsigned long)st->bt_free);
+    results_metric("bdb_leaf_fill", "%.3f", fill);
+    results_metric("bdb_used_bytes", "%llu", used);
+    if (used)
+        results_metric("bdb_space_amp", "%.3f", (double)file / used);
+
+    free(st);
+}
+
+/*
+ * Bulk scan: every c_get fills a DB_MULTIPLE_KEY buffer with as many
+ * key/data pairs as fit, which are then walked in place.
+ */
+static void bdb_dump_bulk(unsigned long bulk)
+{
+    int rc;
+    DBC *cur;
+    DBT key = { 0 }, data = { 0 };
+    struct phase ph;
+    uint64_t t0;
+    void *p, *retkey, *retdata;
+    u_int32_t retklen, retdlen;
+    struct sink *out = print ? sink_new() : NULL;
+
+    bdb_usermem(&key, KEY_MAX);
+    data.ulen = bulk;
+    data.flags = DB_DBT_USERMEM;
+    if ((data.data = malloc(data.ulen)) == NULL)
+        bdb_error(ENOMEM, "Couldn't allocate %lu byte bulk buffer", bulk);
+
+    rc = db->cursor(db, NULL, &cur, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't create cursor");
+
+    phase_begin(&ph, "bulk dump");
+
+    t0 = bench_now();
+    while ((rc = cur->c_get(cur, &key, &data, DB_MULTIPLE_KEY | DB_NEXT)) == BDB_OK) {
+        DB_MULTIPLE_INIT(p, &data);
+        for (;;) {
+            DB_MULTIPLE_KEY_NEXT(p, &data, retkey, retklen, retdata, retdlen);
+            if (p == NULL)
+                break;
+            phase_op(&ph, t0);
+            if (out)
+                sink_record(out, retkey, retklen, retdata, retdlen);
+            t0 = bench_now();
+        }
+    }
+
+    sink_free(out);
+    phase_end(&ph);
+
+    if (rc == DB_BUFFER_SMALL)
+        bdb_error(rc, "A record doesn't fit into the %lu byte bulk buffer", bulk);
+    if (rc != DB_NOTFOUND)
+        bdb_error(rc, "Error iterating over btree");
+
+    rc = cur->c_close(cur);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't close cursor");
+
+    free(key.data);
+    free(data.data);
+}
 
-void bdb_dump(void)
+void bdb_dump(unsigned long bulk)
 {
     int rc;
     DBC *cur;
     DBT key = { 0 }, data = { 0 };
+    struct phase ph;
+    uint64_t t0;
+    struct sink *out = print ? sink_new() : NULL;
+
+    if (bulk) {
+        sink_free(out);
+        bdb_dump_bulk(bulk);
+        return;
+    }
+
+    bdb_usermem(&key, KEY_MAX);
+    bdb_usermem(&data, BDB_RECORD_BUFFER);
 
     rc = db->cursor(db, NULL, &cur, 0);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't create cursor");
 
-    cur->c_get(cur, &key, &data, DB_FIRST);
+    phase_begin(&ph, "dump");
+
+    t0 = bench_now();
+    rc = bdb_c_get(cur, &key, &data, DB_FIRST);
     while (rc == BDB_OK) {
-	if (print)
-	    printf("key: %lu, data: %s\n", *(unsigned long *)key.data, (char *) data.data);
-        rc = cur->c_get(cur, &key, &data, DB_NEXT);
+        phase_op(&ph, t0);
+        if (out)
+            sink_record(out, key.data, key.size, data.data, data.size);
+        t0 = bench_now();
+        rc = bdb_c_get(cur, &key, &data, DB_NEXT);
     }
 
+    sink_free(out);
+    phase_end(&ph);
+
     if (rc != DB_NOTFOUND) {
         bdb_error(rc, "Error iterating over btree");
     }
@@ -54,67 +422,217 @@ void bdb_dump(void)
     rc = cur->c_close(cur);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't close cursor");
+
+    free(key.data);
+    free(data.data);
 }
 
 
-void bdb_get(unsigned long n)
+struct bdb_args {
+    unsigned long txnsize;
+    unsigned long bulk;
+    int (*write)(DB_TXN *tid, unsigned long n, uint64_t *rng);
+    unsigned long (*key)(unsigned long i);
+};
+
+/* Fetch the odd keys of the slice, then the even ones */
+static void bdb_get_worker(struct worker *w)
 {
-    int rc;
+    int rc, pass;
     unsigned long i;
     DBT key = { 0 }, data = { 0 };
+    unsigned char kbuf[KEY_MAX];
+    uint64_t t0;
 
-    key.data = &i;
-    key.size = sizeof(i);
+    key.data = kbuf;
+    bdb_usermem(&data, BDB_RECORD_BUFFER);
 
-    for (i = 1; i < n; i+=2) {
-        rc = db->get(db, NULL, &key, &data, 0);
-        if (rc != BDB_OK)
-            bdb_error(rc, "Error fetching key %lu", i);
-        else
-	    if (print)
-		printf("key: %lu, data: %s\n", *(unsigned long *)key.data, (char *) data.data);
+    worker_begin(w);
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = w->first + ((w->first + pass + 1) & 1); i < w->last; i+=2) {
+            t0 = bench_now();
+            key.size = key_encode(i, kbuf);
+            rc = bdb_db_get(NULL, &key, &data);
+            phase_op(&w->ph, t0);
+            if (rc != BDB_OK)
+                bdb_error(rc, "Error fetching key %lu", i);
+            else
+                if (w->out)
+                    sink_record(w->out, key.data, key.size, data.data, data.size);
+        }
     }
 
-    for (i = 2; i < n; i+=2) {
-        rc = db->get(db, NULL, &key, &data, 0);
+    worker_end(w);
+
+    free(data.data);
+}
+
+/* Gather every record's indexed field, in key order, for the lookups */
+static void bdb_collect(void)
+{
+    int rc;
+    DBC *cur;
+    DBT key = { 0 }, data = { 0 };
+    struct phase ph;
+
+    bdb_usermem(&key, KEY_MAX);
+    bdb_usermem(&data, BDB_RECORD_BUFFER);
+    secondary_reset();
+
+    rc = db->cursor(db, NULL, &cur, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't create cursor");
+
+    phase_begin(&ph, "collect");
+    while ((rc = bdb_c_get(cur, &key, &data, DB_NEXT)) == BDB_OK)
+        secondary_add(data.data, data.size);
+    phase_end(&ph);
+
+    if (rc != DB_NOTFOUND)
+        bdb_error(rc, "Error iterating over btree");
+
+    rc = cur->c_close(cur);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't close cursor");
+
+    free(key.data);
+    free(data.data);
+}
+
+/* Look the record up through the index, which hands back its key too */
+static int bdb_index_get(DBT *skey, DBT *pkey, DBT *data)
+{
+    int rc;
+
+    while ((rc = sdb->pget(sdb, NULL, skey, pkey, data, 0)) == DB_BUFFER_SMALL)
+        if (data->size > data->ulen)
+            bdb_usermem(data, data->size);
+    return rc;
+}
+
+static void bdb_index_get_worker(struct worker *w)
+{
+    int rc;
+    unsigned long i;
+    DBT skey = { 0 }, pkey = { 0 }, data = { 0 };
+    size_t len;
+    uint64_t t0;
+
+    bdb_usermem(&pkey, KEY_MAX);
+    bdb_usermem(&data, BDB_RECORD_BUFFER);
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        skey.data = (void *)secondary_key(i, &len);
+        skey.size = len;
+        rc = bdb_index_get(&skey, &pkey, &data);
+        phase_op(&w->ph, t0);
         if (rc != BDB_OK)
-            bdb_error(rc, "Error fetching key %lu", i);
+            bdb_error(rc, "Error fetching record %lu through the index", i);
         else
-	    if (print)
-		printf("key: %lu, data: %s\n", *(unsigned long *)key.data, (char *) data.data);
+            if (w->out)
+                sink_record(w->out, pkey.data, pkey.size, data.data, data.size);
+    }
+
+    worker_end(w);
+
+    free(pkey.data);
+    free(data.data);
+}
+
+static const struct kv_ops bdb_kv_ops;
+
+void bdb_get(unsigned long n)
+{
+    workload_warmup(NULL, n, &bdb_kv_ops);
+    if (sdb) {
+        bdb_collect();
+        workers_run("index get", 0, secondary_count(), bdb_index_get_worker, NULL);
+        return;
     }
+    workers_run("get", 1, n, bdb_get_worker, NULL);
 }
 
-static int bdb_insert(DB_TXN *tid, unsigned long n, int random)
+/* Write key n with a value from the arena, straight from where it lies */
+static int bdb_insert(DB_TXN *tid, unsigned long n, uint64_t *rng)
 {
-    char databuf[256];
     DBT key = { 0 }, data = { 0 };
-    int i, rc;
+    unsigned char kbuf[KEY_MAX];
+    size_t len;
+    int rc;
 
-    key.data = &n;
-    key.size = sizeof(n);
-    data.data = databuf;
-    if (random)
-        data.size = rand() % (255 - 1) + 1; /* 1 to 255 byte data */
-    else
-        data.size = 14;
+    STAGE_START();
+    key.data = kbuf;
+    key.size = key_encode(n, kbuf);
+    data.data = (void *)value_next(rng, &len);
+    data.size = len;
+    STAGE_END(STAGE_GENERATE);
 
-    for (i = 0; i < data.size - 1; i++)
-        databuf[i] = (n + i) % (128 - 32) + 32;
-    databuf[i] = 0;
     rc = db->put(db, tid, &key, &data, 0);
-
+    STAGE_END(STAGE_PUT);
     return rc;
 }
 
-
-void bdb_populate(unsigned long n, unsigned long txnsize, int random)
+/* Delete key n, one that is already gone is no error */
+static int bdb_delete_key(DB_TXN *tid, unsigned long n, uint64_t *rng)
 {
+    DBT key = { 0 };
+    unsigned char kbuf[KEY_MAX];
     int rc;
+
+    (void)rng;
+    key.data = kbuf;
+    key.size = key_encode(n, kbuf);
+    rc = db->del(db, tid, &key, 0);
+
+    return rc == DB_NOTFOUND ? BDB_OK : rc;
+}
+
+/*
+ * Latencies of the records of a unit of work that hasn't committed yet.
+ * They go to the phase when it commits; a deadlock drops them along with
+ * the work they timed, and the records redone are timed again.
+ */
+struct bdb_pending {
+    uint64_t *ns;
+    unsigned long count, size;
+};
+
+static void bdb_pending_add(struct bdb_pending *pd, uint64_t ns)
+{
+    if (pd->count == pd->size) {
+        pd->size = pd->size ? 2 * pd->size : 1024;
+        if ((pd->ns = realloc(pd->ns, pd->size * sizeof(*pd->ns))) == NULL)
+            bdb_error(ENOMEM, "Couldn't allocate %lu latencies", pd->size);
+    }
+    pd->ns[pd->count++] = ns;
+}
+
+/* The unit of work committed at now */
+static void bdb_pending_commit(struct bdb_pending *pd, struct phase *ph, uint64_t now)
+{
     unsigned long i;
+
+    for (i = 0; i < pd->count; i++)
+        phase_add(ph, pd->ns[i], now);
+    pd->count = 0;
+}
+
+/* Insert or delete args->key(i) of the slice, txnsize of them per transaction */
+static void bdb_txn_worker(struct worker *w)
+{
+    struct bdb_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    struct bdb_pending pending = { NULL, 0, 0 };
+    int rc = BDB_OK;
+    unsigned long i, batch;
     DB_TXN *tid = NULL;
+    uint64_t t0, now;
 
-    printf("a\n");
+    worker_begin(w);
 
     if (txnsize > 1) {
         rc = dbenv->txn_begin(dbenv, NULL, &tid, 0);
@@ -122,24 +640,552 @@ void bdb_populate(unsigned long n, unsigned long txnsize, int random)
             bdb_error(rc, "Couldn't begin transaction");
     }
 
-    for (i = 1; i < n; i++) {
-        rc = bdb_insert(tid, i, random);
+    batch = w->first;
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        rc = args->write(tid, args->key(i), &w->rng);
+        if (rc == DB_LOCK_DEADLOCK) {
+            /* Lost against another writer: redo the whole transaction */
+            w->retries++;
+            w->retry_wait += bench_now() - t0;
+            if (tid) {
+                rc = tid->abort(tid);
+                if (rc != BDB_OK)
+                    bdb_error(rc, "Couldn't abort transaction");
+                rc = dbenv->txn_begin(dbenv, NULL, &tid, 0);
+                if (rc != BDB_OK)
+                    bdb_error(rc, "Couldn't begin transaction");
+            }
+            pending.count = 0;
+            i = batch - 1;
+            continue;
+        }
         if (rc != BDB_OK)
-            bdb_error(rc, "Couldn't insert key %d", i);
-        if (txnsize > 1 && i % txnsize == 0) {
+            bdb_error(rc, "Couldn't %s key %lu", w->ph.name, args->key(i));
+        if (txnsize > 1 && (i + 1 - w->first) % txnsize == 0) {
+            STAGE_START();
             rc = tid->commit(tid, 0);
             if (rc != BDB_OK)
                 bdb_error(rc, "Couldn't commit btree");
             rc = dbenv->txn_begin(dbenv, NULL, &tid, 0);
             if (rc != BDB_OK)
                 bdb_error(rc, "Couldn't begin transaction");
+            STAGE_END(STAGE_COMMIT);
+        }
+        now = bench_now();
+        bdb_pending_add(&pending, now - t0);
+        if (tid == NULL || (i + 1 - w->first) % txnsize == 0) {
+            batch = i + 1;
+            crash_committed(i + 1 - w->first);
+            bdb_pending_commit(&pending, &w->ph, now);
         }
-
     }
     if (tid)
         rc = tid->commit(tid, 0);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't commit btree");
+    crash_committed(w->last - w->first);
+    bdb_pending_commit(&pending, &w->ph, bench_now());
+
+    worker_end(w);
+
+    free(pending.ns);
+}
+
+/*
+ * Bulk load: records are packed into a DB_MULTIPLE_KEY buffer and the
+ * full buffer goes to the btree with a single put. With -t a transaction
+ * is committed on the first buffer boundary after txnsize records. On a
+ * deadlock the unit of work that was lost, the transaction or the single
+ * autocommitted buffer, is rebuilt from its first record.
+ */
+static void bdb_populate_bulk_worker(struct worker *w)
+{
+    struct bdb_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    struct bdb_pending pending = { NULL, 0, 0 };
+    unsigned long i, batch, buffered;
+    DBT bulk = { 0 }, unused = { 0 };
+    DB_TXN *tid = NULL;
+    unsigned char kbuf[KEY_MAX];
+    const char *value;
+    size_t size, klen;
+    void *p;
+    uint64_t t0;
+    int rc;
+
+    bulk.ulen = args->bulk;
+    bulk.flags = DB_DBT_USERMEM | DB_DBT_BULK;
+    if ((bulk.data = malloc(bulk.ulen)) == NULL)
+        bdb_error(ENOMEM, "Couldn't allocate %lu byte bulk buffer", args->bulk);
+
+    worker_begin(w);
+
+    i = w->first;
+restart:
+    if (txnsize > 1) {
+        rc = dbenv->txn_begin(dbenv, NULL, &tid, 0);
+        if (rc != BDB_OK)
+            bdb_error(rc, "Couldn't begin transaction");
+    }
+    batch = i;
+    buffered = 0;
+    DB_MULTIPLE_WRITE_INIT(p, &bulk);
+
+    for (; i < w->last; i++) {
+        t0 = bench_now();
+        klen = key_encode(key_order(i), kbuf);
+        value = value_next(&w->rng, &size);
+        DB_MULTIPLE_KEY_WRITE_NEXT(p, &bulk, kbuf, klen, value, size);
+        if (p == NULL) {
+            /* Buffer full: write it out and start over with this record */
+            rc = db->put(db, tid, &bulk, &unused, DB_MULTIPLE_KEY);
+            if (rc == DB_LOCK_DEADLOCK)
+                goto deadlock;
+            if (rc != BDB_OK)
+                bdb_error(rc, "Couldn't bulk insert keys %lu-%lu", i - buffered, i - 1);
+            if (tid == NULL) {
+                batch = i;
+                bdb_pending_commit(&pending, &w->ph, bench_now());
+            } else if (i - batch >= txnsize) {
+                rc = tid->commit(tid, 0);
+                if (rc != BDB_OK)
+                    bdb_error(rc, "Couldn't commit btree");
+                rc = dbenv->txn_begin(dbenv, NULL, &tid, 0);
+                if (rc != BDB_OK)
+                    bdb_error(rc, "Couldn't begin transaction");
+                batch = i;
+                bdb_pending_commit(&pending, &w->ph, bench_now());
+            }
+            buffered = 0;
+            DB_MULTIPLE_WRITE_INIT(p, &bulk);
+            DB_MULTIPLE_KEY_WRITE_NEXT(p, &bulk, kbuf, klen, value, size);
+            if (p == NULL)
+                bdb_error(DB_BUFFER_SMALL, "The %lu byte value of key %lu doesn't fit into the bulk buffer",
+                          (unsigned long)size, key_order(i));
+        }
+        buffered++;
+        bdb_pending_add(&pending, bench_now() - t0);
+    }
+
+    if (buffered) {
+        rc = db->put(db, tid, &bulk, &unused, DB_MULTIPLE_KEY);
+        if (rc == DB_LOCK_DEADLOCK)
+            goto deadlock;
+        if (rc != BDB_OK)
+            bdb_error(rc, "Couldn't bulk insert keys %lu-%lu", i - buffered, i - 1);
+    }
+    if (tid) {
+        rc = tid->commit(tid, 0);
+        if (rc != BDB_OK)
+            bdb_error(rc, "Couldn't commit btree");
+    }
+    bdb_pending_commit(&pending, &w->ph, bench_now());
+
+    worker_end(w);
+
+    free(pending.ns);
+    free(bulk.data);
+    return;
+
+deadlock:
+    w->retries++;
+    if (tid) {
+        rc = tid->abort(tid);
+        if (rc != BDB_OK)
+            bdb_error(rc, "Couldn't abort transaction");
+        tid = NULL;
+    }
+    pending.count = 0;
+    i = batch;
+    goto restart;
+}
+
+void bdb_populate(unsigned long n, unsigned long txnsize, unsigned long bulk)
+{
+    struct bdb_args args;
+
+    args.txnsize = txnsize;
+    args.bulk = bulk;
+    args.write = bdb_insert;
+    args.key = key_order;
+    if (bulk)
+        workers_run("bulk populate", 1, n, bdb_populate_bulk_worker, &args);
+    else
+        workers_run("populate", 1, n, bdb_txn_worker, &args);
+}
+
+void bdb_delete(unsigned long txnsize)
+{
+    struct bdb_args args;
+
+    args.txnsize = txnsize;
+    args.bulk = 0;
+    args.write = bdb_delete_key;
+    args.key = delete_key;
+    workers_run("delete", 0, delete_count(), bdb_txn_worker, &args);
+}
+
+/*
+ * DB->compact merges sparse pages and with DB_FREE_SPACE hands the
+ * pages that end up free at the end of the file back to the filesystem.
+ */
+void bdb_compact(void)
+{
+    DB_COMPACT c_data;
+    struct phase ph;
+    uint64_t t0;
+    int rc;
+
+    memset(&c_data, 0, sizeof(c_data));
+
+    phase_begin(&ph, "compact");
+    t0 = bench_now();
+    rc = db->compact(db, NULL, NULL, NULL, &c_data, DB_FREE_SPACE, NULL);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't compact %s", BDB_DB_FILENAME);
+    phase_op(&ph, t0);
+    phase_end(&ph);
+
+    printf("Compaction: %lu pages examined, %lu freed, %lu returned to the filesystem, "
+           "%lu levels removed, %lu deadlocks\n",
+           (unsigned long)c_data.compact_pages_examine, (unsigned long)c_data.compact_pages_free,
+           (unsigned long)c_data.compact_pages_truncated, (unsigned long)c_data.compact_levels,
+           (unsigned long)c_data.compact_deadlock);
+    results_metric("bdb_compact_pages_examined", "%lu", (unsigned long)c_data.compact_pages_examine);
+    results_metric("bdb_compact_pages_freed", "%lu", (unsigned long)c_data.compact_pages_free);
+    results_metric("bdb_compact_pages_truncated", "%lu", (unsigned long)c_data.compact_pages_truncated);
+    results_metric("bdb_compact_levels", "%lu", (unsigned long)c_data.compact_levels);
+}
+
+/* Workload primitives, all autocommit */
+static unsigned long bdb_scan_bulk;     /* -B for scans, 0: one record per c_get */
+
+struct bdb_ctx {
+    struct worker *w;
+    DBT key, data;
+    DBT bulk;                   /* DB_MULTIPLE_KEY buffer for scans */
+};
+
+static void *bdb_kv_open(struct worker *w)
+{
+    struct bdb_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL)
+        bdb_error(ENOMEM, "Couldn't allocate workload context");
+    ctx->w = w;
+    bdb_usermem(&ctx->key, KEY_MAX);
+    bdb_usermem(&ctx->data, BDB_RECORD_BUFFER);
+    if (bdb_scan_bulk) {
+        ctx->bulk.ulen = bdb_scan_bulk;
+        ctx->bulk.flags = DB_DBT_USERMEM;
+        if ((ctx->bulk.data = malloc(ctx->bulk.ulen)) == NULL)
+            bdb_error(ENOMEM, "Couldn't allocate %lu byte bulk buffer", bdb_scan_bulk);
+    }
+    return ctx;
+}
+
+static void bdb_kv_close(void *arg)
+{
+    struct bdb_ctx *ctx = arg;
+
+    free(ctx->key.data);
+    free(ctx->data.data);
+    free(ctx->bulk.data);
+    free(ctx);
+}
+
+/*
+ * With -E snapshot reads run in DB_TXN_SNAPSHOT transactions, which read
+ * the committed page versions DB_MULTIVERSION keeps instead of waiting
+ * for the read locks writers hold. Otherwise they are plain locking reads.
+ */
+static DB_TXN *bdb_read_begin(void)
+{
+    DB_TXN *tid;
+    int rc;
+
+    if (!bdb_snapshot)
+        return NULL;
+    rc = dbenv->txn_begin(dbenv, NULL, &tid, DB_TXN_SNAPSHOT);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't begin snapshot transaction");
+    return tid;
+}
+
+static void bdb_read_end(DB_TXN *tid, int rc)
+{
+    if (tid == NULL)
+        return;
+    rc = rc == DB_LOCK_DEADLOCK ? tid->abort(tid) : tid->commit(tid, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't end snapshot transaction");
+}
+
+/* A read that lost against a writer is redone, the time it took is retry wait */
+static int bdb_kv_read(void *arg, unsigned long k)
+{
+    struct bdb_ctx *ctx = arg;
+    DBT key = { 0 };
+    DB_TXN *tid;
+    unsigned char kbuf[KEY_MAX];
+    uint64_t t0;
+    int rc;
+
+    key.data = kbuf;
+    key.size = key_encode(k, kbuf);
+    for (;;) {
+        t0 = bench_now();
+        tid = bdb_read_begin();
+        rc = bdb_db_get(tid, &key, &ctx->data);
+        bdb_read_end(tid, rc);
+        if (rc != DB_LOCK_DEADLOCK)
+            break;
+        ctx->w->retries++;
+        ctx->w->retry_wait += bench_now() - t0;
+    }
+    if (rc == DB_NOTFOUND)
+        return 1;
+    if (rc != BDB_OK)
+        bdb_error(rc, "Error fetching key %lu", k);
+    if (ctx->w->out)
+        sink_record(ctx->w->out, key.data, key.size, ctx->data.data, ctx->data.size);
+    return 0;
+}
+
+static int bdb_kv_write(void *arg, unsigned long k)
+{
+    struct bdb_ctx *ctx = arg;
+    uint64_t t0;
+    int rc;
+
+    for (;;) {
+        t0 = bench_now();
+        if ((rc = bdb_insert(NULL, k, &ctx->w->rng)) != DB_LOCK_DEADLOCK)
+            break;
+        ctx->w->retries++;
+        ctx->w->retry_wait += bench_now() - t0;
+    }
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't write key %lu", k);
+    return 0;
+}
+
+/* Walk len records from the cursor position in bulk buffers */
+static unsigned long bdb_kv_scan_bulk(struct bdb_ctx *ctx, DBC *cur, unsigned long len, int *rcp)
+{
+    unsigned long i = 0;
+    void *p, *retkey, *retdata;
+    u_int32_t retklen, retdlen;
+    int rc;
+
+    rc = cur->c_get(cur, &ctx->key, &ctx->bulk, DB_SET_RANGE | DB_MULTIPLE_KEY);
+    while (rc == BDB_OK) {
+        DB_MULTIPLE_INIT(p, &ctx->bulk);
+        for (;;) {
+            DB_MULTIPLE_KEY_NEXT(p, &ctx->bulk, retkey, retklen, retdata, retdlen);
+            if (p == NULL)
+                break;
+            if (ctx->w->out)
+                sink_record(ctx->w->out, retkey, retklen, retdata, retdlen);
+            if (++i == len)
+                goto done;
+        }
+        rc = cur->c_get(cur, &ctx->key, &ctx->bulk, DB_NEXT | DB_MULTIPLE_KEY);
+    }
+done:
+    *rcp = rc;
+    return i;
+}
+
+/* DB_SET_RANGE to the first key >= k, then DB_NEXT, or the same in bulk with -B */
+static unsigned long bdb_kv_scan_once(struct bdb_ctx *ctx, DB_TXN *tid, unsigned long k,
+                                      unsigned long len, int *rcp)
+{
+    DBC *cur;
+    unsigned long i;
+    int rc;
+
+    rc = db->cursor(db, tid, &cur, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't create cursor");
+
+    /* DB_SET_RANGE overwrites the key, which has room for any */
+    ctx->key.size = key_encode(k, ctx->key.data);
+
+    if (bdb_scan_bulk) {
+        i = bdb_kv_scan_bulk(ctx, cur, len, &rc);
+        goto done;
+    }
+
+    rc = bdb_c_get(cur, &ctx->key, &ctx->data, DB_SET_RANGE);
+    for (i = 0; rc == BDB_OK; ) {
+        if (ctx->w->out)
+            sink_record(ctx->w->out, ctx->key.data, ctx->key.size, ctx->data.data, ctx->data.size);
+        if (++i == len)
+            break;
+        rc = bdb_c_get(cur, &ctx->key, &ctx->data, DB_NEXT);
+    }
+done:
+    if (rc == DB_BUFFER_SMALL)
+        bdb_error(rc, "A record doesn't fit into the %lu byte bulk buffer", bdb_scan_bulk);
+    if (rc != BDB_OK && rc != DB_NOTFOUND && rc != DB_LOCK_DEADLOCK)
+        bdb_error(rc, "Error scanning from key %lu", k);
+    *rcp = rc;
+
+    rc = cur->c_close(cur);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't close cursor");
+
+    return i;
+}
+
+/* A scan that lost against a writer starts over */
+static unsigned long bdb_kv_scan(void *arg, unsigned long k, unsigned long len)
+{
+    struct bdb_ctx *ctx = arg;
+    DB_TXN *tid;
+    unsigned long i;
+    uint64_t t0;
+    int rc;
+
+    for (;;) {
+        t0 = bench_now();
+        tid = bdb_read_begin();
+        i = bdb_kv_scan_once(ctx, tid, k, len, &rc);
+        bdb_read_end(tid, rc);
+        if (rc != DB_LOCK_DEADLOCK)
+            break;
+        ctx->w->retries++;
+        ctx->w->retry_wait += bench_now() - t0;
+    }
+    return i;
+}
+
+static const struct kv_ops bdb_kv_ops = {
+    bdb_kv_open,
+    bdb_kv_close,
+    bdb_kv_read,
+    bdb_kv_write,
+    bdb_kv_write,
+    bdb_kv_scan
+};
+
+void bdb_workload(struct workload *wl, unsigned long n, unsigned long bulk)
+{
+    bdb_scan_bulk = bulk;
+    workload_run(wl, n, &bdb_kv_ops);
+}
+
+/*
+ * -C, before opening. Unless it is private the BDB cache lives on in the
+ * environment regions between runs, so cold removes those along with
+ * evicting the files. Warm reads the files in.
+ */
+void bdb_cache_files(void)
+{
+    struct phase ph;
+    DB_ENV *env;
+    int rc;
+
+    if (cache_state() == CACHE_ASIS)
+        return;
+
+    phase_begin(&ph, cache_state() == CACHE_COLD ? "evict" : "preread");
+    if (cache_state() == CACHE_COLD) {
+        if ((rc = db_env_create(&env, 0)) != BDB_OK)
+            bdb_error(rc, "Couldn't create environment handle");
+        rc = env->remove(env, BDB_ENV_DIRECTORY, 0);
+        if (rc != BDB_OK && rc != ENOENT)
+            fprintf(stderr, "%s: couldn't remove the regions of %s: %s\n",
+                    progname, BDB_ENV_DIRECTORY, db_strerror(rc));
+    }
+    cache_dir(BDB_ENV_DIRECTORY);
+    phase_end(&ph);
+    cache_report();
+}
+
+/* -C warm, after opening: pull every record through the BDB cache */
+void bdb_preload(void)
+{
+    int rc;
+    DBC *cur;
+    DBT key = { 0 }, data = { 0 };
+    struct phase ph;
+    uint64_t t0;
+
+    if (cache_state() != CACHE_WARM)
+        return;
+
+    bdb_usermem(&key, KEY_MAX);
+    bdb_usermem(&data, BDB_RECORD_BUFFER);
+
+    rc = db->cursor(db, NULL, &cur, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't create cursor");
+
+    phase_begin(&ph, "preload");
+    t0 = bench_now();
+    while ((rc = bdb_c_get(cur, &key, &data, DB_NEXT)) == BDB_OK) {
+        phase_op(&ph, t0);
+        t0 = bench_now();
+    }
+    phase_end(&ph);
+
+    if (rc != DB_NOTFOUND)
+        bdb_error(rc, "Error iterating over btree");
+
+    rc = cur->c_close(cur);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't close cursor");
+
+    free(key.data);
+    free(data.data);
+}
+
+/* The secondary key is the value's prefix, pointing into the record itself */
+static int bdb_value_prefix(DB *secondary, const DBT *key, const DBT *data, DBT *result)
+{
+    (void)secondary;
+    (void)key;
+    memset(result, 0, sizeof(*result));
+    result->data = data->data;
+    result->size = secondary_field(data->size);
+    return 0;
+}
+
+/*
+ * Open the index and associate it with the primary, which from then on
+ * updates it within the same transaction as every put and del. Values
+ * need not be unique, nor their prefixes. An empty index is built from
+ * the primary right here.
+ */
+static void bdb_open_secondary(int pageSize)
+{
+    int rc;
+
+    rc = db_create(&sdb, dbenv, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't create bdb handle");
+
+    rc = sdb->set_pagesize(sdb, pageSize);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't set pageSize to %d bytes", pageSize);
+
+    rc = sdb->set_flags(sdb, DB_DUP | DB_DUPSORT);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't allow duplicates in %s", BDB_INDEX_FILENAME);
+
+    rc = sdb->open(sdb, NULL, BDB_INDEX_FILENAME, NULL, DB_BTREE,
+                   DB_CREATE | DB_AUTO_COMMIT | (nthreads > 1 ? DB_THREAD : 0) |
+                   (bdb_snapshot ? DB_MULTIVERSION : 0),
+                   0666);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't open %s", BDB_INDEX_FILENAME);
+
+    rc = db->associate(db, NULL, sdb, bdb_value_prefix, DB_CREATE);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't associate %s with %s", BDB_INDEX_FILENAME, BDB_DB_FILENAME);
 }
 
 void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txnsize)
@@ -149,6 +1195,12 @@ void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txns
 
     if (private)
         bdb_env_flags |= DB_PRIVATE;
+    /* -y checkpoint= shares the environment with a checkpoint thread */
+    if (nthreads > 1 || crash_checkpoint_secs() > 0)
+        bdb_env_flags |= DB_THREAD;
+    /* Recovery runs only if a process died holding the environment */
+    if (bdb_register)
+        bdb_env_flags |= DB_REGISTER | DB_RECOVER;
     
     /*
      * If the directory exists, we're done. We do not further check
@@ -165,21 +1217,48 @@ void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txns
     /* Create the environment handle. */
     if ((rc = db_env_create(&dbenv, 0)) != 0)
         bdb_error(rc, "db_env_create: ");
+    results_version("berkeleydb", "%s", db_version(NULL, NULL, NULL));
 
     /* Set up error handling. */
     dbenv->set_errpfx(dbenv, progname);
     dbenv->set_errfile(dbenv, stderr);
 
-    if (cache < 0) {
-        dbenv->set_flags(dbenv, DB_TXN_WRITE_NOSYNC, 1);
-        cache = -cache;
+    switch (bdb_durability) {
+    case BDB_WRITE_NOSYNC:
+        rc = dbenv->set_flags(dbenv, DB_TXN_WRITE_NOSYNC, 1);
+        break;
+    case BDB_NOSYNC:
+        rc = dbenv->set_flags(dbenv, DB_TXN_NOSYNC, 1);
+        break;
+    case BDB_INMEM:
+        rc = dbenv->log_set_config(dbenv, DB_LOG_IN_MEMORY, 1);
+        break;
+    default:
+        break;
     }
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't set durability %s", bdb_durability_names[bdb_durability]);
+
+    /* An in-memory log must hold every active transaction, size it with logbuf= */
+    if (bdb_logbuf && (rc = dbenv->set_lg_bsize(dbenv, bdb_logbuf)) != BDB_OK)
+        bdb_error(rc, "Couldn't set log buffer to %lu KB", bdb_logbuf / 1024);
+    if (bdb_logfile && (rc = dbenv->set_lg_max(dbenv, bdb_logfile)) != BDB_OK)
+        bdb_error(rc, "Couldn't set log file size to %lu MB", bdb_logfile / (1024 * 1024));
+
+    /* Lock conflicts fail at once as DB_LOCK_DEADLOCK and are retried */
+    if (bdb_nowait && (rc = dbenv->set_flags(dbenv, DB_TXN_NOWAIT, 1)) != BDB_OK)
+        bdb_error(rc, "Couldn't set DB_TXN_NOWAIT");
 
     /* Set the cache */
     rc = dbenv->set_cachesize(dbenv, 0, cache, 1);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't set cache to %d MB", cache/(1024*1024));
 
+    /* Concurrent writers can deadlock on btree pages, break those up */
+    rc = dbenv->set_lk_detect(dbenv, DB_LOCK_DEFAULT);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't set deadlock detection");
+
     /*
      * Open a transactional environment:
      * create if it doesn't exist
@@ -195,8 +1274,6 @@ void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txns
         bdb_error(rc, "dbenv->open: %s", BDB_ENV_DIRECTORY);
     }
 
-    printf("done.\n");
-
     rc = db_create(&db, dbenv, 0);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't create bdb handle");
@@ -205,21 +1282,83 @@ void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txns
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't set pageSize to %d bytes", pageSize);
 
-    printf("txnsize: %lu\n", txnsize);
-
     rc = db->open(db, NULL, BDB_DB_FILENAME, NULL, DB_BTREE,
-                  DB_CREATE | DB_AUTO_COMMIT,
+                  DB_CREATE | DB_AUTO_COMMIT | (nthreads > 1 ? DB_THREAD : 0) |
+                  (bdb_snapshot ? DB_MULTIVERSION : 0),
                   0666);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't open %s", BDB_DB_FILENAME);
 
+    if (secondary_prefix())
+        bdb_open_secondary(pageSize);
+
+    bdb_counts(&bdb_open_counts);
+    bench_counters(bdb_sample);
 }
 
 void bdb_close(void)
 {
     int rc;
 
+    bench_counters(NULL);
+
+    /* The secondary goes first, it still refers to the primary */
+    if (sdb) {
+        rc = sdb->close(sdb, 0);
+        if (rc != BDB_OK)
+            bdb_error(rc, "Couldn't close Btree file %s", BDB_INDEX_FILENAME);
+        sdb = NULL;
+    }
+
     rc = db->close(db, 0);
     if (rc != BDB_OK)
         bdb_error(rc, "Couldn't close Btree file %s", BDB_DB_FILENAME);
+
+    rc = dbenv->close(dbenv, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't close environment %s", BDB_ENV_DIRECTORY);
+}
+
+/*
+ * -y: open the environment a killed process left behind. Normal recovery
+ * replays the log from the last checkpoint, or from the start without
+ * one, and rolls back the transactions that never committed.
+ */
+void bdb_recover(unsigned long cache, int private, int pageSize, unsigned long txnsize)
+{
+    bdb_env_flags |= DB_RECOVER;
+    bdb_open(cache, private, pageSize, txnsize);
+    if (!bdb_register)
+        bdb_env_flags &= ~DB_RECOVER;
+}
+
+/* -y checkpoint=, from the checkpoint thread */
+void bdb_checkpoint(void)
+{
+    int rc;
+
+    rc = dbenv->txn_checkpoint(dbenv, 0, 0, 0);
+    if (rc != BDB_OK)
+        bdb_error(rc, "Couldn't checkpoint");
+}
+
+/* -y: the value of key n, if it is there, in a buffer kept across calls */
+int bdb_fetch(unsigned long n, const void **data, size_t *len)
+{
+    static DBT key, value;
+    static unsigned char kbuf[KEY_MAX];
+    int rc;
+
+    if (value.data == NULL)
+        bdb_usermem(&value, BDB_RECORD_BUFFER);
+    key.data = kbuf;
+    key.size = key_encode(n, kbuf);
+    rc = bdb_db_get(NULL, &key, &value);
+    if (rc == DB_NOTFOUND)
+        return 0;
+    if (rc != BDB_OK)
+        bdb_error(rc, "Error fetching key %lu", n);
+    *data = value.data;
+    *len = value.size;
+    return 1;
 }
@@ -3,13 +3,28 @@
 
 #include <db.h>
 
+#include "workload.h"
+
 #define BDB_ENV_DIRECTORY "bdb"
 #define BDB_DB_FILENAME "bdb.db"
+#define BDB_INDEX_FILENAME "bdb_value.db"   /* -i */
 
 extern void bdb_open(unsigned long cache, int private, int pageSize, unsigned long txnsize);
 extern void bdb_close(void);
-extern void bdb_dump(void);
+extern void bdb_recover(unsigned long cache, int private, int pageSize, unsigned long txnsize);
+extern void bdb_checkpoint(void);
+extern int bdb_fetch(unsigned long n, const void **data, size_t *len);
+extern void bdb_cache_files(void);
+extern void bdb_preload(void);
+extern void bdb_dump(unsigned long bulk);
 extern void bdb_get(unsigned long n);
-extern void bdb_populate(unsigned long n, unsigned long txnsize, int random);
+extern void bdb_populate(unsigned long n, unsigned long txnsize, unsigned long bulk);
+extern void bdb_delete(unsigned long txnsize);
+extern void bdb_compact(void);
+extern void bdb_workload(struct workload *wl, unsigned long n, unsigned long bulk);
+extern int bdb_parse_opts(char *spec);
+extern void bdb_print_opts(void);
+extern void bdb_print_stats(void);
+extern void bdb_print_space(void);
 
 #endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "dbrace.h"
+#include "bench.h"
+
+static struct phase_result results[BENCH_MAX_RESULTS];
+static int nresults;
+static struct hist *result_lat;         /* -N children: latencies of every result */
+static void (*counters_fn)(struct counters *, int);
+
+static void phase_record(const struct phase *ph)
+{
+    struct phase_result *r;
+    const struct hist *h = &ph->lat;
+
+    if (nresults == BENCH_MAX_RESULTS)
+        return;
+    r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", ph->name);
+    r->ops = ph->ops;
+    r->start = ph->start;
+    r->secs = ph->elapsed / 1e9;
+    if (result_lat)
+        result_lat[nresults - 1] = *h;
+    r->sampled = ph->sampled;
+    if (ph->sampled) {
+        r->res = ph->res;
+        r->cnt = ph->cnt;
+    } else {
+        memset(&r->res, 0, sizeof(r->res));
+        r->cnt.count = 0;
+    }
+    if (ph->ops == 0 || h->count == 0) {
+        r->avg = r->p50 = r->p90 = r->p99 = r->p999 = r->max = 0;
+        return;
+    }
+    r->avg = hist_mean(h) / 1e3;
+    r->p50 = hist_percentile(h, 50.0) / 1e3;
+    r->p90 = hist_percentile(h, 90.0) / 1e3;
+    r->p99 = hist_percentile(h, 99.0) / 1e3;
+    r->p999 = hist_percentile(h, 99.9) / 1e3;
+    r->max = h->max / 1e3;
+}
+
+const struct phase_result *bench_results(int *count)
+{
+    *count = nresults;
+    return results;
+}
+
+void bench_results_reset(void)
+{
+    nresults = 0;
+}
+
+/* Keep the histogram of every result too, for a parent process to merge */
+void bench_keep_latency(void)
+{
+    if (result_lat == NULL && (result_lat = calloc(BENCH_MAX_RESULTS, sizeof(*result_lat))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+}
+
+const struct hist *bench_result_latency(int i)
+{
+    return result_lat && i < nresults ? &result_lat[i] : NULL;
+}
+
+/* Drop the results reported after bench_results() returned count */
+void bench_results_rewind(int count)
+{
+    if (count < nresults)
+        nresults = count;
+}
+
+/* Register the engine counter sampler of the open backend, NULL for none */
+void bench_counters(void (*fn)(struct counters *c, int begin))
+{
+    counters_fn = fn;
+}
+
+void counters_add(struct counters *c, const char *name, uint64_t value, int gauge)
+{
+    if (c->count == BENCH_MAX_COUNTERS)
+        return;
+    c->names[c->count] = name;
+    c->values[c->count] = value;
+    c->gauge[c->count] = gauge;
+    c->count++;
+}
+
+static void resources_sample(struct resources *r)
+{
+    struct rusage ru;
+    char line[128];
+    FILE *f;
+
+    memset(r, 0, sizeof(*r));
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        r->utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        r->stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        r->minflt = ru.ru_minflt;
+        r->majflt = ru.ru_majflt;
+        r->nvcsw = ru.ru_nvcsw;
+        r->nivcsw = ru.ru_nivcsw;
+    }
+
+    /* Bytes that actually went to or came from storage, not the page cache */
+    if ((f = fopen("/proc/self/io", "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "read_bytes: %llu", &r->rbytes) == 1)
+            continue;
+        sscanf(line, "write_bytes: %llu", &r->wbytes);
+    }
+    fclose(f);
+}
+
+static void counters_sample(struct counters *c, int begin)
+{
+    c->count = 0;
+    if (counters_fn)
+        counters_fn(c, begin);
+}
+
+/* Start the clock, without sampling anything */
+void phase_start(struct phase *ph, const char *name)
+{
+    ph->name = name;
+    ph->ops = 0;
+    ph->elapsed = 0;
+    ph->sampled = 0;
+    ph->iv_owner = 0;
+    hist_reset(&ph->lat);
+    interval_join(ph);
+    ph->start = bench_now();
+}
+
+void phase_begin(struct phase *ph, const char *name)
+{
+    int owner;
+
+    resources_sample(&ph->res);
+    counters_sample(&ph->cnt, 1);
+    owner = interval_open(name);
+    phase_start(ph, name);
+    ph->sampled = 1;
+    ph->iv_owner = owner;
+}
+
+void phase_stop(struct phase *ph)
+{
+    struct resources r;
+    struct counters c;
+    int i;
+
+    ph->elapsed = bench_now() - ph->start;
+    interval_leave(ph);
+    if (!ph->sampled)
+        return;
+
+    resources_sample(&r);
+    ph->res.utime = r.utime - ph->res.utime;
+    ph->res.stime = r.stime - ph->res.stime;
+    ph->res.minflt = r.minflt - ph->res.minflt;
+    ph->res.majflt = r.majflt - ph->res.majflt;
+    ph->res.nvcsw = r.nvcsw - ph->res.nvcsw;
+    ph->res.nivcsw = r.nivcsw - ph->res.nivcsw;
+    ph->res.rbytes = r.rbytes - ph->res.rbytes;
+    ph->res.wbytes = r.wbytes - ph->res.wbytes;
+
+    /* The backend may have come or gone during the phase, open and close */
+    counters_sample(&c, 0);
+    if (c.count != ph->cnt.count) {
+        ph->cnt.count = 0;
+        return;
+    }
+    for (i = 0; i < c.count; i++)
+        if (!c.gauge[i])
+            c.values[i] -= ph->cnt.values[i];
+    ph->cnt = c;
+}
+
+/* Stop the clock and print the phase summary */
+void phase_end(struct phase *ph)
+{
+    phase_stop(ph);
+    phase_report(ph);
+}
+
+static void phase_report_usage(const struct phase *ph)
+{
+    const struct resources *r = &ph->res;
+    const struct counters *c = &ph->cnt;
+    int i;
+
+    printf("%s resources: cpu %.3f s user %.3f s sys, faults %ld minor %ld major, "
+           "%ld voluntary %ld involuntary switches, storage %llu KB read %llu KB written\n",
+           ph->name, r->utime, r->stime, r->minflt, r->majflt, r->nvcsw, r->nivcsw,
+           r->rbytes / 1024, r->wbytes / 1024);
+    if (c->count == 0)
+        return;
+    printf("%s engine:", ph->name);
+    for (i = 0; i < c->count; i++)
+        printf(" %s %llu", c->names[i], (unsigned long long)c->values[i]);
+    printf("\n");
+}
+
+void phase_report(const struct phase *ph)
+{
+    double secs = ph->elapsed / 1e9;
+
+    phase_record(ph);
+
+    if (ph->ops == 0) {
+        printf("%s: %.6f s\n", ph->name, secs);
+    } else {
+        printf("%s: %lu ops in %.6f s, %.1f ops/sec\n",
+               ph->name, ph->ops, secs, secs > 0 ? ph->ops / secs : 0.0);
+        hist_report(ph->name, &ph->lat);
+    }
+    if (ph->sampled)
+        phase_report_usage(ph);
+}
+
+void hist_report(const char *name, const struct hist *h)
+{
+    printf("%s latency (usec): min %.2f avg %.2f p50 %.2f p90 %.2f "
+           "p99 %.2f p99.9 %.2f max %.2f\n",
+           name,
+           h->min / 1e3, hist_mean(h) / 1e3,
+           hist_percentile(h, 50.0) / 1e3,
+           hist_percentile(h, 90.0) / 1e3,
+           hist_percentile(h, 99.0) / 1e3,
+           hist_percentile(h, 99.9) / 1e3,
+           h->max / 1e3);
+}
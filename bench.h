@@ -0,0 +1,144 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "hist.h"
+
+/* Process resource usage over a phase */
+struct resources {
+    double utime, stime;                /* s */
+    long minflt, majflt;
+    long nvcsw, nivcsw;
+    unsigned long long rbytes, wbytes;  /* storage I/O, Linux only */
+};
+
+/*
+ * Engine counters over a phase, filled in by the sampler the open
+ * backend registers with bench_counters(). Counters are reported as the
+ * difference between the start and the end of a phase, gauges such as
+ * a memory high-water mark as their value at the end.
+ */
+#define BENCH_MAX_COUNTERS 16
+
+struct counters {
+    int count;
+    const char *names[BENCH_MAX_COUNTERS];
+    uint64_t values[BENCH_MAX_COUNTERS];
+    unsigned char gauge[BENCH_MAX_COUNTERS];
+};
+
+/*
+ * A phase is one timed section of a run: opening the environment, the
+ * measured put/get/cursor loop, closing. Setup and teardown phases only
+ * carry their wall time, the measured loop also records every operation
+ * into a latency histogram. phase_begin() also samples the resource
+ * usage of the process and the engine counters, which costs a few system
+ * calls and queries; per-thread phases use phase_start(), which only
+ * starts the clock.
+ */
+struct phase {
+    const char *name;
+    uint64_t start;             /* ns, CLOCK_MONOTONIC */
+    uint64_t elapsed;           /* ns */
+    unsigned long ops;
+    struct hist lat;
+    int sampled;                /* res and cnt are valid */
+    struct resources res;
+    struct counters cnt;
+
+    /* -I: operations of the current interval, see interval.c */
+    uint64_t iv_next;           /* ns, end of the interval, 0: not reporting */
+    int iv_owner;               /* opened the series */
+    struct hist iv;
+};
+
+/*
+ * Summary of every reported phase, kept so that runs can be collected
+ * by a sweep or written out as results. Latencies are in usec.
+ */
+#define BENCH_MAX_RESULTS 64
+
+struct phase_result {
+    char name[32];
+    uint64_t start;             /* ns, CLOCK_MONOTONIC */
+    unsigned long ops;
+    double secs;
+    double avg, p50, p90, p99, p999, max;
+    int sampled;
+    struct resources res;
+    struct counters cnt;
+};
+
+/*
+ * Interval time series (-I): ops/sec, p99 and max latency of every
+ * interval of a phase, and engine events such as checkpoints on the same
+ * timeline. Printed live on stderr and kept for the results.
+ */
+struct interval_result {
+    char phase[32];
+    double t;                   /* s since the start of the phase */
+    double secs;                /* length, the last one may be short */
+    unsigned long ops;
+    double p99, max;            /* usec */
+};
+
+struct interval_event {
+    char phase[32];
+    double t;
+    char what[96];
+};
+
+static inline uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+extern void phase_begin(struct phase *ph, const char *name);
+extern void phase_start(struct phase *ph, const char *name);
+extern void phase_stop(struct phase *ph);
+extern void phase_end(struct phase *ph);
+extern void phase_report(const struct phase *ph);
+extern void hist_report(const char *name, const struct hist *h);
+extern const struct phase_result *bench_results(int *count);
+extern void bench_results_reset(void);
+extern void bench_results_rewind(int count);
+extern void bench_keep_latency(void);
+extern const struct hist *bench_result_latency(int i);
+extern void bench_counters(void (*fn)(struct counters *c, int begin));
+extern void counters_add(struct counters *c, const char *name, uint64_t value, int gauge);
+
+extern void interval_set(double secs);
+extern double interval_secs(void);
+extern int interval_open(const char *name);
+extern void interval_close(void);
+extern void interval_join(struct phase *ph);
+extern void interval_add(struct phase *ph, uint64_t ns, uint64_t now);
+extern void interval_leave(struct phase *ph);
+extern void interval_note(const char *fmt, ...);
+extern void interval_rewind(int intervals, int events);
+extern const struct interval_result *bench_intervals(int *count);
+extern const struct interval_event *bench_events(int *count);
+
+/* Account one operation that took ns and ended at now */
+static inline void phase_add(struct phase *ph, uint64_t ns, uint64_t now)
+{
+    hist_add(&ph->lat, ns);
+    ph->ops++;
+    if (ph->iv_next)
+        interval_add(ph, ns, now);
+}
+
+/* Account one operation that was started at t0 */
+static inline void phase_op(struct phase *ph, uint64_t t0)
+{
+    uint64_t now = bench_now();
+
+    phase_add(ph, now - t0, now);
+}
+
+#endif
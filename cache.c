@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dbrace.h"
+#include "results.h"
+#include "cache.h"
+
+#define CACHE_READ_CHUNK (1024 * 1024)
+
+static const char *cache_state_names[] = {
+    "asis", "cold", "warm"
+};
+
+static enum cache_state state = CACHE_ASIS;
+static double warmup = 0;               /* s */
+
+/* Files and bytes handled by cache_file() */
+static unsigned long cache_nfiles;
+static unsigned long long cache_bytes;
+
+int cache_parse(char *spec)
+{
+    char *const tokens[] = {
+        "asis", "cold", "warm", "warmup", NULL
+    };
+    char *value;
+    int tok;
+
+    while (*spec) {
+        tok = getsubopt(&spec, tokens, &value);
+        if (tok >= CACHE_ASIS && tok <= CACHE_WARM) {
+            state = tok;
+            continue;
+        }
+        switch (tok) {
+        case 3:
+            if (value == NULL || (warmup = strtod(value, NULL)) < 0)
+                return -1;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown cache option '%s'\n", progname, value);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+enum cache_state cache_state(void)
+{
+    return state;
+}
+
+double cache_warmup(void)
+{
+    return warmup;
+}
+
+void cache_print(void)
+{
+    printf("Cache: %s", cache_state_names[state]);
+    if (warmup > 0)
+        printf(", %.1f s warm-up", warmup);
+    printf("\n");
+
+    results_option("cache_state", "%s", cache_state_names[state]);
+    results_option("warmup_secs", "%.1f", warmup);
+}
+
+/*
+ * Written pages can't be dropped, so sync the file before telling the
+ * kernel its pages won't be needed.
+ */
+static void cache_evict(const char *path, int fd)
+{
+    if (fsync(fd) != 0)
+        perror(path);
+#ifdef POSIX_FADV_DONTNEED
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+        fprintf(stderr, "%s: couldn't evict %s from the page cache\n", progname, path);
+#else
+    fprintf(stderr, "%s: can't evict %s, no posix_fadvise() here\n", progname, path);
+#endif
+}
+
+static void cache_preread(const char *path, int fd)
+{
+    static char *buf;
+    ssize_t len;
+
+    if (buf == NULL && (buf = malloc(CACHE_READ_CHUNK)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+#ifdef POSIX_FADV_WILLNEED
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    while ((len = read(fd, buf, CACHE_READ_CHUNK)) > 0)
+        ;
+    if (len < 0)
+        perror(path);
+}
+
+/* Evict path from the page cache or read it in, missing files are skipped */
+void cache_file(const char *path)
+{
+    struct stat st;
+    int fd;
+
+    if (state == CACHE_ASIS)
+        return;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (state == CACHE_COLD)
+            cache_evict(path, fd);
+        else
+            cache_preread(path, fd);
+        cache_nfiles++;
+        cache_bytes += st.st_size;
+    }
+    close(fd);
+}
+
+/* cache_file() on every file of dir */
+void cache_dir(const char *dir)
+{
+    struct dirent *de;
+    char path[PATH_MAX];
+    DIR *d;
+
+    if (state == CACHE_ASIS)
+        return;
+    if ((d = opendir(dir)) == NULL) {
+        perror(dir);
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        cache_file(path);
+    }
+    closedir(d);
+}
+
+/* Files handled since the last report */
+void cache_report(void)
+{
+    if (state == CACHE_ASIS)
+        return;
+    printf("Cache %s: %lu files, %.1f MB\n", state == CACHE_COLD ? "evicted" : "read in",
+           cache_nfiles, cache_bytes / (1024.0 * 1024));
+    cache_nfiles = 0;
+    cache_bytes = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/*
+ * Cache state of the reading actions (-C). Cold drops the database and
+ * log files from the OS page cache and starts the engine with an empty
+ * cache of its own, warm reads the files in and preloads the engine
+ * cache. As is leaves both to whatever ran before. A warm-up period runs
+ * the action for some seconds before the measured run and is left out
+ * of the results.
+ */
+enum cache_state {
+    CACHE_ASIS,
+    CACHE_COLD,
+    CACHE_WARM
+};
+
+extern int cache_parse(char *spec);
+extern void cache_print(void);
+extern enum cache_state cache_state(void);
+extern double cache_warmup(void);
+extern void cache_file(const char *path);
+extern void cache_dir(const char *dir);
+extern void cache_report(void);
+
+#endif
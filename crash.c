@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "rng.h"
+#include "key.h"
+#include "value.h"
+#include "results.h"
+#include "crash.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define CRASH_POLL_NS 100000            /* parent checks the child this often */
+
+/* What the child leaves for the parent, in memory they share */
+struct crash_state {
+    volatile unsigned long committed;   /* records */
+    volatile int done;                  /* populated all of them */
+    uint64_t last;                      /* ns, last commit */
+    struct hist txn;                    /* commit to commit */
+    struct hist ckp;                    /* checkpoint durations */
+};
+
+static unsigned long crash_records = 0;     /* records=, 0: half of -n */
+static double crash_secs = 0;               /* secs=, instead of records */
+static double crash_ckp_secs = 0;           /* checkpoint=, 0: the engine's own */
+static struct crash_state *state;
+static int in_child = 0;
+static int failed = 0;
+static void (*ckp_fn)(void);
+
+/* -y records=<n>|secs=<s>,checkpoint=<secs> */
+int crash_parse(char *spec)
+{
+    char *const tokens[] = { "records", "secs", "checkpoint", NULL };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            if (value == NULL || (crash_records = strtoul(value, NULL, 0)) == 0)
+                return -1;
+            crash_secs = 0;
+            break;
+        case 1:
+            if (value == NULL || (crash_secs = strtod(value, NULL)) <= 0)
+                return -1;
+            crash_records = 0;
+            break;
+        case 2:
+            if (value == NULL || (crash_ckp_secs = strtod(value, NULL)) <= 0)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void crash_print(void)
+{
+    if (crash_secs > 0)
+        printf("Crash: after %g s", crash_secs);
+    else if (crash_records)
+        printf("Crash: after %lu committed records", crash_records);
+    else
+        printf("Crash: after half of the records are committed");
+    if (crash_ckp_secs > 0)
+        printf(", checkpoint every %g s\n", crash_ckp_secs);
+    else
+        printf(", engine checkpoints\n");
+    results_option("crash_records", "%lu", crash_records);
+    results_option("crash_secs", "%g", crash_secs);
+    results_option("crash_checkpoint_secs", "%g", crash_ckp_secs);
+}
+
+int crash_child(void)
+{
+    return in_child;
+}
+
+double crash_checkpoint_secs(void)
+{
+    return crash_ckp_secs;
+}
+
+static void *crash_checkpointer(void *arg)
+{
+    struct timespec ts;
+    uint64_t t0, now;
+
+    (void)arg;
+    ts.tv_sec = (time_t)crash_ckp_secs;
+    ts.tv_nsec = (long)((crash_ckp_secs - ts.tv_sec) * 1e9);
+    for (;;) {
+        while (nanosleep(&ts, NULL) != 0 && errno == EINTR)
+            ;
+        t0 = bench_now();
+        ckp_fn();
+        now = bench_now();
+        hist_add(&state->ckp, now - t0);
+        interval_note("checkpoint in %.1f ms", (now - t0) / 1e6);
+    }
+    return NULL;
+}
+
+/* From the child once the database is open: with checkpoint=, checkpoint until killed */
+void crash_checkpoints(void (*checkpoint)(void))
+{
+    pthread_t thread;
+
+    if (!in_child)
+        return;
+    /* Opening the database is no transaction */
+    state->last = bench_now();
+    if (crash_ckp_secs <= 0)
+        return;
+    ckp_fn = checkpoint;
+    if (pthread_create(&thread, NULL, crash_checkpointer, NULL) != 0) {
+        fprintf(stderr, "%s: couldn't start the checkpoint thread\n", progname);
+        exit(1);
+    }
+}
+
+/* From the populate worker right after a commit, records in all so far */
+void crash_committed(unsigned long records)
+{
+    uint64_t now;
+
+    if (!in_child)
+        return;
+    now = bench_now();
+    hist_add(&state->txn, now - state->last);
+    state->last = now;
+    state->committed = records;
+}
+
+/*
+ * Fork the child, stdout silenced, let it run body populating n records
+ * and kill it when it got far enough. body normally doesn't get to return: if it does, all
+ * records were committed and the child waits to be killed all the same.
+ */
+void crash_run(unsigned long n, void (*body)(void))
+{
+    struct phase ph;
+    uint64_t start, deadline, end;
+    struct timespec poll = { 0, CRASH_POLL_NS };
+    unsigned long target;
+    pid_t pid;
+    int status;
+
+    state = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(state, 0, sizeof(*state));
+    hist_reset(&state->txn);
+    hist_reset(&state->ckp);
+
+    fflush(stdout);
+    start = bench_now();
+    state->last = start;
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        in_child = 1;
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(1);
+        body();
+        state->done = 1;
+        for (;;)
+            pause();
+    }
+
+    /* Records are keys [1, n) */
+    target = crash_records ? crash_records : (n > 1 ? n - 1 : 0) / 2;
+    deadline = start + (uint64_t)(crash_secs * 1e9);
+    for (;;) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "%s: the populating process failed before the crash\n", progname);
+            exit(1);
+        }
+        if (state->done)
+            break;
+        if (crash_secs > 0 ? bench_now() >= deadline : state->committed >= target)
+            break;
+        nanosleep(&poll, NULL);
+    }
+    kill(pid, SIGKILL);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    end = bench_now();
+
+    /* The child's clock stopped when it was killed, not at its last commit */
+    memset(&ph, 0, sizeof(ph));
+    ph.name = "load";
+    ph.start = start;
+    ph.elapsed = end - start;
+    ph.lat = state->txn;
+    ph.ops = ph.lat.count;
+    phase_report(&ph);
+
+    if (crash_ckp_secs > 0) {
+        ph.name = "checkpoint";
+        ph.lat = state->ckp;
+        ph.ops = ph.lat.count;
+        phase_report(&ph);
+    }
+
+    printf("Crash: killed after %lu committed records%s\n", state->committed,
+           state->done ? ", all of them" : "");
+    results_metric("crash_committed", "%lu", state->committed);
+}
+
+/*
+ * Read the records back in populate order. The single populate worker
+ * drew their values from the stream rng_seed(random_seed), which replays
+ * them here. Past the first missing record, a transaction's worth must be
+ * missing too.
+ */
+void crash_verify(unsigned long n, unsigned long txnsize,
+                  int (*fetch)(unsigned long key, const void **data, size_t *len))
+{
+    struct phase ph;
+    uint64_t rng = rng_seed(random_seed), t0;
+    unsigned long i, kept, last, stray = 0, unit = txnsize > 1 ? txnsize : 1;
+    unsigned long committed = state->committed;
+    const char *expect;
+    const void *data;
+    size_t elen, len;
+    int found, corrupt = 0;
+
+    phase_begin(&ph, "verify");
+    for (i = 1; i < n; i++) {
+        expect = value_next(&rng, &elen);
+        t0 = bench_now();
+        found = fetch(key_order(i), &data, &len);
+        phase_op(&ph, t0);
+        if (!found)
+            break;
+        if (len != elen || memcmp(data, expect, len) != 0) {
+            corrupt = 1;
+            break;
+        }
+    }
+    kept = i - 1;
+    for (last = i + unit; !corrupt && ++i < n && i < last; ) {
+        t0 = bench_now();
+        found = fetch(key_order(i), &data, &len);
+        phase_op(&ph, t0);
+        if (found)
+            stray++;
+    }
+    phase_end(&ph);
+
+    if (corrupt) {
+        fprintf(stderr, "%s: record %lu (key %lu) has the wrong value after recovery\n",
+                progname, kept + 1, key_order(kept + 1));
+        failed = 1;
+    }
+    if (kept < committed) {
+        fprintf(stderr, "%s: %lu committed records lost, the first one is key %lu\n",
+                progname, committed - kept, key_order(kept + 1));
+        failed = 1;
+    }
+    if ((kept % unit && kept != n - 1) || stray) {
+        fprintf(stderr, "%s: %lu records of a transaction that never committed survived\n",
+                progname, (kept % unit) + stray);
+        failed = 1;
+    }
+
+    printf("Recovery: %lu records, %lu committed before the crash, %s\n",
+           kept, committed, failed ? "FAILED" : "intact");
+    results_metric("crash_recovered", "%lu", kept);
+    results_metric("crash_intact", "%d", !failed);
+}
+
+int crash_failed(void)
+{
+    return failed;
+}
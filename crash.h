@@ -0,0 +1,34 @@
+#ifndef CRASH_H
+#define CRASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Crash recovery (-y): a forked child populates the database on a single
+ * thread and is killed with SIGKILL, usually in the middle of a
+ * transaction, once it has committed records= records or after secs=
+ * seconds. The parent then times reopening the database, which replays
+ * or rolls back what the child left behind (BerkeleyDB DB_RECOVER, a
+ * SQLite hot journal or WAL), and reads the records back in the order
+ * they were written: every committed one must be there with the value it
+ * was written with, and nothing of the transaction that was cut off.
+ *
+ * The child reports every commit through shared memory; the "load" phase
+ * counts its transactions and their commit to commit latency. With
+ * checkpoint=<secs> a thread of the child checkpoints at that interval
+ * instead of the engine, and a "checkpoint" phase reports how many it
+ * took over the load and how long each one ran.
+ */
+extern int crash_parse(char *spec);
+extern void crash_print(void);
+extern int crash_child(void);
+extern double crash_checkpoint_secs(void);
+extern void crash_checkpoints(void (*checkpoint)(void));
+extern void crash_committed(unsigned long records);
+extern void crash_run(unsigned long n, void (*body)(void));
+extern void crash_verify(unsigned long n, unsigned long txnsize,
+                         int (*fetch)(unsigned long key, const void **data, size_t *len));
+extern int crash_failed(void);
+
+#endif
@@ -8,9 +8,23 @@
 #include <limits.h>
 #include <fcntl.h>
 
+#include "bench.h"
+#include "workload.h"
+#include "sweep.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
 #include "sqlite.h"
 #include "bdb.h"
 #include "mysql.h"
+#include "lmdb.h"
+#include "lsm.h"
+#include "procs.h"
+#include "sink.h"
+#include "delete.h"
+#include "secondary.h"
+#include "crash.h"
 
 /*
  * Global variables
@@ -18,81 +32,742 @@
 const char *progname;
 unsigned long cache = 0;
 int print = 0;
+int nthreads = 1;
+int pin_cpus = 0;
+unsigned long random_seed = 1;
+
+/*
+ * Command line options
+ */
+static int dump = 0, get = 0, populate = 0, mixed = 0, scan = 0, del = 0, compact = 0, crash = 0;
+static int sqlite = 0, bdb = 0, mysql = 0, lmdb = 0, lsm = 0;
+static struct workload wl;
+static int pageSize = 4096;
+static unsigned long n = 1000, txnsize = 0, bulk = 0;
+static int bdb_private = 0;
+static int reps = 1;
+static char *output = NULL;         /* O */
+static double compare = -1;         /* K */
+static char *mysql_host = NULL;    /* H */
+static char *mysql_user = NULL;    /* U */
+static char *mysql_pw = NULL;      /* P */
+static char *mysql_db = NULL;      /* D */
 
 static void usage()
 {
     fprintf(stderr, "usage: \n"
-            "%s {-b [-x] [-c <cache in MB>] [-p <page_size>] | -s [-c <cache in pages>] | -m}"
-                "[-o] [-r] [-t <trn_size>] [-n <nentries>] -w|-d|-g\n\n"
+            "%s {-b [-x] [-c <cache in MB>] [-p <page_size>] [-B <bulk KB>] [-E <options>] | -s [-c <cache in pages>] [-S <profile>] | -m [-M <options>] | -l [-Y <options>] | -e [-c <cache in MB>] [-G <options>]}"
+                "[-o [-F <output>]] [-r | -V <values>] [-k <keys>] [-z <seed>] [-t <trn_size>] [-n <nentries>] [-j <threads> [-A]]\n"
+                "[-C <cache>] [-I <secs>] [-N <procs>] [-i <bytes>] [-X <param>=<values> ... [-R <reps>]] [-O <results>]\n"
+                "-w|-d|-g|-W <workload>|-L <scan>|-q <delete>|-Z|-y <crash>\n"
+            "       %s -K <threshold %%> <base results> <results>\n\n"
             "Options:\n"
-            "-b chooses BerkeleyDB, -s chooses SQLite implementation, -m choose MySQL implementation.\n"
+            "-b chooses BerkeleyDB, -s chooses SQLite implementation, -m choose MySQL implementation,\n"
+            "-l chooses LMDB, -e chooses LevelDB.\n"
             "-o write data to screen\n"
+            "-F output of -o, comma separated:\n"
+            "   text|binary             one line per record (default), or the length\n"
+            "                           prefixed key and value bytes, which needs file=\n"
+            "   file=<path>             write to a file instead of the screen\n"
+            "   buffer=<KB>             output buffer per thread (default: 1024)\n"
             "-r means data size varies from 1-255 bytes (default fixed 14 bytes).\n"
+            "-V value sizes, comma separated, sizes take a k, m or g suffix:\n"
+            "   fixed|uniform|normal|lognormal|bimodal\n"
+            "                           distribution (default: fixed)\n"
+            "   size=<n>                fixed size, normal mean, lognormal median or\n"
+            "                           bimodal small size (default: 14)\n"
+            "   min=<n>,max=<n>         bounds (default: 1 and 255 for uniform, 8 x size\n"
+            "                           otherwise)\n"
+            "   stddev=<n>              normal standard deviation (default: size / 4)\n"
+            "   sigma=<s>               lognormal shape (default: 1.0)\n"
+            "   large=<n>,frac=<f>      bimodal: frac of the values are large bytes\n"
+            "                           (default frac: 0.1)\n"
+            "   arena=<n>               pre-generated value bytes (default: 16m, at\n"
+            "                           least 4 x max)\n"
+            "-k key encoding and insertion order, comma separated; -d, -g and -W need\n"
+            "   the encoding the database was populated with:\n"
+            "   native|be|string|varstr|uuid\n"
+            "                           host order unsigned long (default), 8 byte\n"
+            "                           big-endian, zero padded decimal string, decimal\n"
+            "                           string without padding, or a 16 byte UUID hashed\n"
+            "                           from the key number\n"
+            "   width=<n>               digits of string keys (default: 16)\n"
+            "   seq|shuffle             -w inserts the keys in order (default) or in a\n"
+            "                           random permutation seeded with -z\n"
+            "-z seed of the per-thread random number generators (default: 1)\n"
             "-t <trn_size> is the number of writes in a single transaction (default is auto).\n"
             "-n how many entries to store in the database (default: 100000)\n"
-            "-c cache size (default: 4 MB / 10000 pages)\n"
+            "-c cache size (default: 4 MB / 10000 pages, LevelDB block cache: 8 MB)\n"
             "-x set DB_PRIVATE for DB_ENV->open\n"
-            "-p BerkeleyDB database pagesite in bytes (default: 4096)\n\n"
+            "-p BerkeleyDB database pagesite in bytes (default: 4096)\n"
+            "-B BerkeleyDB -w and -d move records through DB_MULTIPLE_KEY bulk buffers\n"
+            "   of this many KB (at least one page)\n"
+            "-E BerkeleyDB environment options, comma separated:\n"
+            "   durability=sync|write-nosync|nosync|inmem\n"
+            "                           commits fsync the log (default), write it without\n"
+            "                           fsync, leave it in the log buffer, or keep the whole\n"
+            "                           log in memory\n"
+            "   logbuf=<KB>             log buffer size\n"
+            "   logfile=<MB>            maximum log file size\n"
+            "   nowait                  lock conflicts fail at once and are retried instead\n"
+            "                           of waiting (DB_TXN_NOWAIT)\n"
+            "   snapshot                reads use snapshot isolation instead of read locks\n"
+            "                           (DB_MULTIVERSION, DB_TXN_SNAPSHOT)\n"
+            "   register                processes register with the environment, which is\n"
+            "                           recovered if one of them died (DB_REGISTER)\n"
+            "-S SQLite tuning applied on every open, comma separated list of a profile\n"
+            "   (default, wal, safe, fast, mmap) and/or pragmas: journal_mode=,\n"
+            "   synchronous=, mmap_size=, page_size=, cache_size=<pages>|<n>k,\n"
+            "   locking_mode=, temp_store=, auto_vacuum=\n"
+            "-M MySQL options, comma separated:\n"
+            "   prepared                -w, -g and range scans use server-side prepared\n"
+            "                           statements with binary parameters\n"
+            "   rows=<n>                rows per multi-row INSERT statement (default: 1)\n"
+            "   pipeline=<n>            -g keeps n lookups in flight per connection, sent as\n"
+            "                           text multi-statements (default: 1)\n"
+            "-C cache state for -d, -g, -W and -L, comma separated:\n"
+            "   asis|cold|warm          leave the caches alone (default), sync and evict\n"
+            "                           the files from the OS page cache and start with\n"
+            "                           an empty engine cache, or read the files in and\n"
+            "                           preload the engine cache. MySQL runs cold only\n"
+            "                           after a server restart\n"
+            "   warmup=<s>              run -g or the workload this many seconds before\n"
+            "                           the measured run, left out of the results\n"
+            "-I print ops/sec, p99 and max latency of every interval of this many\n"
+            "   seconds on stderr while an action runs, along with engine events such as\n"
+            "   SQLite WAL checkpoints; -O keeps the time series\n"
+            "-Y LMDB options, comma separated:\n"
+            "   mapsize=<MB>            size of the memory map, the most the database can\n"
+            "                           grow to (default: 1024)\n"
+            "   nosync|nometasync       commits don't fsync, or don't fsync the meta page\n"
+            "                           (MDB_NOSYNC, MDB_NOMETASYNC)\n"
+            "   writemap                write through a writable map (MDB_WRITEMAP)\n"
+            "   append                  -w appends in key order (MDB_APPEND), needs -j 1,\n"
+            "                           sequential keys and the native, be or string encoding\n"
+            "   copy                    reads copy the value out of the map like the other\n"
+            "                           engines instead of using it in place\n"
+            "-G LevelDB options, comma separated; -t puts that many records in a\n"
+            "   WriteBatch:\n"
+            "   wbuf=<MB>               write buffer (memtable) size (default: 4)\n"
+            "   nocompress              don't compress blocks with snappy\n"
+            "   sync                    every write fsyncs the log\n"
+            "   bloom=<bits>            bloom filter with this many bits per key\n"
+            "-N <procs>[,partitioned|shared]\n"
+            "   fork this many processes that open the database each and run the action\n"
+            "   at the same time, on a slice of the keys each (default) or all of them;\n"
+            "   the phases of all processes are merged into one report\n"
+            "-i <bytes> keeps a secondary index on the first <bytes> value bytes\n"
+            "   (BerkeleyDB, SQLite and MySQL); every write maintains it and -g looks\n"
+            "   records up through it, by the field a first untimed pass collects\n"
+            "-j number of worker threads for -w, -g and -W (default: 1)\n"
+            "-A pin worker threads to CPUs\n"
+            "-X sweep a parameter: cache, page, txn, records, threads or index, given as a\n"
+            "   comma separated list of values and <lo>:<hi>[:[+|*]<step>] ranges, e.g.\n"
+            "   -X page=512:65536:*2 -X cache=4,16,64. Every combination runs in its own\n"
+            "   process on a freshly populated database and one table is printed;\n"
+            "   index=0,<bytes> compares a run without the -i index to one with it\n"
+            "-R repetitions of every sweep combination (default: 1)\n"
+            "-O write options, library versions, host and per-phase results to a file,\n"
+            "   as CSV if the name ends in .csv and JSON otherwise (- for stdout)\n"
+            "-K compare two results files and flag every phase whose ops/sec dropped or\n"
+            "   whose p99 latency rose by more than the threshold; exits with 2 if any did\n\n"
             "Possible actions:\n"
             "-w populates the database\n"
             "-d dumps db scanning from the first record to last\n"
-            "-g dumps db by directly fetching each key\n", progname);
+            "-g dumps db by directly fetching each key\n"
+            "-W runs a mixed workload against a populated db, <workload> is a comma\n"
+            "   separated list of:\n"
+            "   a|b|c|d|e|f             YCSB core workload preset (default: a)\n"
+            "   read=, update=, insert=, scan=, rmw=\n"
+            "                           relative weight of each operation\n"
+            "   dist=uniform|zipfian|latest|hotspot\n"
+            "                           key distribution (default: zipfian)\n"
+            "   theta=<t>               zipfian constant (default: 0.99)\n"
+            "   hotset=<f>,hotops=<f>   hotspot: fraction of ops on fraction of keys\n"
+            "                           (default: 0.8 of ops on 0.2 of keys)\n"
+            "   ops=<n>                 number of operations (default: -n)\n"
+            "   scanlen=<n>[:<max>]     records per scan, uniform up to max if given\n"
+            "                           (default: 100)\n"
+            "   readers=<n>,writers=<n> contention: instead of -j threads running the\n"
+            "                           mix, writers share the ops running its writes\n"
+            "                           while readers run its reads and scans; reader\n"
+            "                           latency and writer throughput are reported apart\n"
+            "-L runs range scans against a populated db: every scan reads scanlen\n"
+            "   consecutive records from a start key drawn from dist; <scan> takes the\n"
+            "   -W options except the operation weights. BerkeleyDB scans in bulk with -B\n"
+            "-q deletes records from a populated db, committing every -t, comma separated:\n"
+            "   random|range            keys picked at random from all records (default),\n"
+            "                           or consecutive ones\n"
+            "   count=<n>               records to delete (default: half of -n)\n"
+            "   from=<key>              first key of the range (default: 1)\n"
+            "-Z compacts a populated db: BerkeleyDB DB->compact, SQLite VACUUM, or\n"
+            "   incremental_vacuum with -S auto_vacuum=incremental, LevelDB a manual\n"
+            "   compaction of all keys. BerkeleyDB and SQLite report their space after\n"
+            "   every action\n"
+            "-y populates on one thread in a process that is killed mid-transaction,\n"
+            "   then times recovery and checks that every committed record survived and\n"
+            "   nothing else did (BerkeleyDB and SQLite), comma separated:\n"
+            "   records=<n>             kill once this many are committed (default: half\n"
+            "                           of -n)\n"
+            "   secs=<s>                kill after this long instead\n"
+            "   checkpoint=<secs>       checkpoint at this interval instead of the engine\n"
+            "                           (BerkeleyDB txn_checkpoint, SQLite WAL checkpoint)\n"
+            "                           and report the checkpoints as a phase\n",
+            progname, progname);
     exit(1);
 }
 
 
+static const char *action_name(void)
+{
+    if (populate)
+        return "populate";
+    if (get)
+        return "get";
+    if (scan)
+        return "scan";
+    if (mixed)
+        return "workload";
+    if (del)
+        return "delete";
+    if (compact)
+        return "compact";
+    if (crash)
+        return "crash";
+    return "dump";
+}
+
+/* The banner of every backend */
+static void print_action(const char *backend)
+{
+    static const char *const actions[][2] = {
+        { "populate", "creating database" },
+        { "get", "reading database, fetching records one by one" },
+        { "scan", "running range scans" },
+        { "workload", "running mixed workload" },
+        { "delete", "deleting records" },
+        { "compact", "compacting database" },
+        { "crash", "crashing and recovering database" },
+        { "dump", "dumping database" }
+    };
+    const char *action = action_name();
+    size_t i;
+
+    for (i = 0; i < sizeof(actions) / sizeof(actions[0]) - 1; i++)
+        if (strcmp(actions[i][0], action) == 0)
+            break;
+    printf("Running %s benchmark: %s.\n", backend, actions[i][1]);
+}
+
+/* Options common to all backends, for -O */
+static void record_options(const char *backend)
+{
+    results_option("backend", "%s", backend);
+    results_option("action", "%s", action_name());
+    results_option("records", "%lu", n);
+    results_option("txnsize", "%lu", txnsize);
+    results_option("threads", "%d", nthreads);
+    results_option("pin_cpus", "%d", pin_cpus);
+    results_option("interval_secs", "%g", interval_secs());
+    procs_print();
+    if (print)
+        sink_print();
+    key_print();
+    if (populate || mixed || crash)
+        value_print();
+    if (del)
+        delete_print();
+    if (crash)
+        crash_print();
+    secondary_print();
+    if (!populate && !crash)
+        cache_print();
+}
+
+static void run_sqlite_action(void)
+{
+    if (populate)
+        sqlite_populate(n, txnsize);
+    else if (dump)
+        sqlite_dump();
+    else if (get)
+        sqlite_get(n);
+    else if (mixed)
+        sqlite_workload(&wl, n);
+    else if (del)
+        sqlite_delete(txnsize);
+    else if (compact)
+        sqlite_compact();
+}
+
+/* -y: the process that gets killed, on the table the parent created */
+static void run_sqlite_crash(void)
+{
+    crash_checkpoints(sqlite_checkpoint);
+    sqlite_populate(n, txnsize);
+}
+
+static void run_sqlite(void)
+{
+    struct phase ph;
+
+    if ( !cache )
+        cache = 10000;
+
+    print_action("SQLite");
+    printf("Number of records: %lu\n", n);
+    printf("Transaction size: %lu\n", txnsize);
+    printf("Number of cache pages: %lu\n", cache);
+    printf("Threads: %d\n", nthreads);
+    if (mixed)
+        workload_print(&wl);
+    record_options("sqlite");
+    results_option("cache_pages", "%lu", cache);
+
+    if (!populate && !crash)
+        sqlite_cache_files();
+
+    if (crash) {
+        phase_begin(&ph, "create");
+        sqlite_create();
+        phase_end(&ph);
+        crash_run(n, run_sqlite_crash);
+        phase_begin(&ph, "recover");
+        sqlite_recover();
+        phase_end(&ph);
+        crash_verify(n, txnsize, sqlite_fetch);
+        sqlite_recover_close();
+    } else if (procs_active()) {
+        /* The processes populate the table the parent created */
+        if (populate) {
+            phase_begin(&ph, "create");
+            sqlite_create();
+            phase_end(&ph);
+        }
+        procs_run(run_sqlite_action);
+    } else {
+        run_sqlite_action();
+    }
+    sqlite_print_space();
+}
+
+static unsigned long bdb_cachebytes(void)
+{
+    return (cache ? cache : 4) * 1024 * 1024;
+}
+
+static void run_bdb_action(void)
+{
+    struct phase ph;
+
+    phase_begin(&ph, "open");
+    bdb_open(bdb_cachebytes(), bdb_private, pageSize, txnsize);
+    phase_end(&ph);
+
+    if (!populate)
+        bdb_preload();
+
+    if (dump) {
+        bdb_dump(bulk);
+    } else if (get) {
+        bdb_get(n);
+    } else if (mixed) {
+        bdb_workload(&wl, n, bulk);
+    } else if (del) {
+        bdb_delete(txnsize);
+    } else if (compact) {
+        bdb_compact();
+    } else {
+        bdb_populate(n, txnsize, bulk);
+    }
+    bdb_print_stats();
+    /* With -N the parent reports the space once all processes are done */
+    if (!procs_child())
+        bdb_print_space();
+
+    phase_begin(&ph, "close");
+    bdb_close();
+    phase_end(&ph);
+}
+
+/* -y: the process that gets killed */
+static void run_bdb_crash(void)
+{
+    bdb_open(bdb_cachebytes(), bdb_private, pageSize, txnsize);
+    crash_checkpoints(bdb_checkpoint);
+    bdb_populate(n, txnsize, 0);
+}
+
+static void run_bdb(void)
+{
+    unsigned long cachebytes = bdb_cachebytes();
+    struct phase ph;
+
+    print_action("BerkeleyDB");
+    printf("Number of records: %lu\n", n);
+    printf("Transaction size: %lu\n", txnsize);
+    printf("Page size: %u\n", pageSize);
+    if (bulk)
+        printf("Bulk buffer: %lu KB\n", bulk / 1024);
+    printf("Cache size: %lu MB\n", cachebytes/(1024*1024));
+    printf("Threads: %d\n", nthreads);
+    bdb_print_opts();
+    if (mixed)
+        workload_print(&wl);
+    record_options("berkeleydb");
+    results_option("page_size", "%d", pageSize);
+    results_option("cache_mb", "%lu", cachebytes/(1024*1024));
+    results_option("bulk_kb", "%lu", bulk / 1024);
+    results_option("private", "%d", bdb_private);
+    
+    if (populate || crash)
+        system("rm -rf " BDB_ENV_DIRECTORY);
+    else
+        bdb_cache_files();
+
+    if (crash) {
+        crash_run(n, run_bdb_crash);
+        phase_begin(&ph, "recover");
+        bdb_recover(cachebytes, bdb_private, pageSize, txnsize);
+        phase_end(&ph);
+        crash_verify(n, txnsize, bdb_fetch);
+        bdb_print_space();
+        phase_begin(&ph, "close");
+        bdb_close();
+        phase_end(&ph);
+    } else if (procs_active()) {
+        /* Create the environment regions and the database the processes join */
+        phase_begin(&ph, "create");
+        bdb_open(cachebytes, bdb_private, pageSize, txnsize);
+        bdb_close();
+        phase_end(&ph);
+        procs_run(run_bdb_action);
+        bdb_open(cachebytes, bdb_private, pageSize, txnsize);
+        bdb_print_space();
+        bdb_close();
+    } else {
+        run_bdb_action();
+    }
+}
+
+static void run_lmdb_action(void)
+{
+    struct phase ph;
+
+    phase_begin(&ph, "open");
+    lmdb_open();
+    phase_end(&ph);
+
+    if (dump) {
+        lmdb_dump();
+    } else if (get) {
+        lmdb_get(n);
+    } else if (mixed) {
+        lmdb_workload(&wl, n);
+    } else if (del) {
+        lmdb_delete(txnsize);
+    } else {
+        lmdb_populate(n, txnsize);
+    }
+    lmdb_print_stats();
+
+    phase_begin(&ph, "close");
+    lmdb_close();
+    phase_end(&ph);
+}
+
+static void run_lmdb(void)
+{
+    struct phase ph;
+
+    print_action("LMDB");
+    printf("Number of records: %lu\n", n);
+    printf("Transaction size: %lu\n", txnsize);
+    printf("Threads: %d\n", nthreads);
+    lmdb_print_opts();
+    if (mixed)
+        workload_print(&wl);
+    record_options("lmdb");
+
+    if (populate)
+        system("rm -rf " LMDB_ENV_DIRECTORY);
+    else
+        lmdb_cache_files();
+
+    if (procs_active()) {
+        /* Create the environment and its lock file the processes join */
+        phase_begin(&ph, "create");
+        lmdb_open();
+        lmdb_close();
+        phase_end(&ph);
+        procs_run(run_lmdb_action);
+    } else {
+        run_lmdb_action();
+    }
+}
+
+static void run_lsm(void)
+{
+    unsigned long cachebytes = (cache ? cache : LSM_CACHE_MB) * 1024 * 1024;
+    struct phase ph;
+
+    print_action("LevelDB");
+    printf("Number of records: %lu\n", n);
+    printf("Batch size: %lu\n", txnsize);
+    printf("Block cache size: %lu MB\n", cachebytes/(1024*1024));
+    printf("Threads: %d\n", nthreads);
+    lsm_print_opts();
+    if (mixed)
+        workload_print(&wl);
+    record_options("leveldb");
+    results_option("cache_mb", "%lu", cachebytes/(1024*1024));
+
+    if (populate)
+        system("rm -rf " LSM_DIRECTORY);
+    else
+        lsm_cache_files();
+
+    phase_begin(&ph, "open");
+    lsm_open(cachebytes);
+    phase_end(&ph);
+
+    if (!populate)
+        lsm_preload();
+
+    if (dump) {
+        lsm_dump();
+    } else if (get) {
+        lsm_get(n);
+    } else if (mixed) {
+        lsm_workload(&wl, n);
+    } else if (del) {
+        lsm_delete(txnsize);
+    } else if (compact) {
+        lsm_compact();
+    } else {
+        lsm_populate(n, txnsize);
+    }
+    lsm_print_stats();
+
+    phase_begin(&ph, "close");
+    lsm_close();
+    phase_end(&ph);
+}
+
+static void run_mysql(void)
+{
+    print_action("MySQL");
+    printf("Number of records: %lu\n", n);
+    printf("Transaction size: %lu\n", txnsize);
+    printf("Threads: %d\n", nthreads);
+    if (populate || get || mixed)
+        mysql_print_opts();
+    if (mixed)
+        workload_print(&wl);
+    record_options("mysql");
+
+    if (dump) {
+        mysql_dump(mysql_host, mysql_user, mysql_pw, mysql_db);
+    } else if (get) {
+        mysql_get(mysql_host, mysql_user, mysql_pw, mysql_db, n);
+    } else if (mixed) {
+        mysql_workload(mysql_host, mysql_user, mysql_pw, mysql_db, &wl, n);
+    } else {
+        mysql_populate(mysql_host, mysql_user, mysql_pw, mysql_db,
+                       n, txnsize);
+    }
+}
+
+static void run(void)
+{
+    if (populate || mixed || crash)
+        value_init();
+    if (populate || crash)
+        key_init(1, n);
+    if (del)
+        delete_init(n);
+    if (sqlite)
+        run_sqlite();
+    if (bdb)
+        run_bdb();
+    if (mysql)
+        run_mysql();
+    if (lmdb)
+        run_lmdb();
+    if (lsm)
+        run_lsm();
+}
+
+static void sweep_set(enum sweep_param param, unsigned long value)
+{
+    switch (param) {
+    case SWEEP_CACHE:
+        cache = value;
+        break;
+    case SWEEP_PAGE:
+        pageSize = value;
+        break;
+    case SWEEP_TXN:
+        txnsize = value;
+        break;
+    case SWEEP_RECORDS:
+        n = value;
+        break;
+    case SWEEP_THREADS:
+        nthreads = value;
+        break;
+    case SWEEP_INDEX:
+        secondary_set(value);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * One sweep run. Reading actions first get a fresh database built with
+ * the parameters of this combination; only the action itself is kept.
+ */
+static void sweep_bench(void)
+{
+    int action[6] = { dump, get, populate, mixed, del, compact };
+
+    if (!populate && !crash) {
+        dump = get = mixed = del = compact = 0;
+        populate = 1;
+        run();
+        bench_results_reset();
+        dump = action[0];
+        get = action[1];
+        populate = action[2];
+        mixed = action[3];
+        del = action[4];
+        compact = action[5];
+    }
+    run();
+}
+
 int main(int argc, char **argv)
 {
-    int dump = 0, get = 0, populate = 0, sqlite = 0, bdb = 0, mysql = 0, random = 0;
-    int c, pageSize = 4096;
-    unsigned long n = 1000, txnsize = 0;
-    int bdb_private;
-    int rc;
-    char *mysql_host = NULL;    /* H */
-    char *mysql_user = NULL;    /* U */
-    char *mysql_pw = NULL;      /* P */
-    char *mysql_db = NULL;      /* D */
+    char randspec[32];
+    int c;
 
     progname = argv[0];
 
-    while ((c = getopt(argc, argv, "bc:dD:gH:mn:op:P:rst:U:wx")) != EOF)
+    while ((c = getopt(argc, argv, "AbB:c:C:deD:E:F:gG:H:i:I:j:k:K:lL:mM:n:N:oO:p:P:q:rR:sS:t:U:V:wW:xX:y:Y:z:Z")) != EOF)
         switch (c) {
+        case 'A':
+            pin_cpus = 1;
+            break;
         case 'b':
             bdb = 1;
             break;
+        case 'B':
+            bulk = strtoul(optarg, 0, 0) * 1024;
+            break;
         case 'c':
             cache = strtoul(optarg, 0, 0);
             break;
+        case 'C':
+            if (cache_parse(optarg) != 0)
+                usage();
+            break;
         case 'd':
             dump = 1;
             break;
         case 'D':
             mysql_db = strdup(optarg);
             break;
+        case 'E':
+            if (bdb_parse_opts(optarg) != 0)
+                usage();
+            break;
+        case 'F':
+            if (sink_parse(optarg) != 0)
+                usage();
+            print = 1;
+            break;
         case 'g':
             get = 1;
             break;
         case 'H':
             mysql_host = strdup(optarg);
             break;
+        case 'I':
+            interval_set(strtod(optarg, 0));
+            break;
+        case 'j':
+            nthreads = strtoul(optarg, 0, 0);
+            break;
+        case 'k':
+            if (key_parse(optarg) != 0)
+                usage();
+            break;
+        case 'e':
+            lsm = 1;
+            break;
+        case 'G':
+            if (lsm_parse_opts(optarg) != 0)
+                usage();
+            break;
+        case 'i':
+            if (secondary_parse(optarg) != 0)
+                usage();
+            break;
+        case 'l':
+            lmdb = 1;
+            break;
+        case 'L':
+            results_option("scan", "%s", optarg);
+            if (workload_parse_scan(&wl, optarg) != 0)
+                usage();
+            mixed = scan = 1;
+            break;
+        case 'K':
+            compare = strtod(optarg, 0);
+            break;
         case 'm':
             mysql = 1;
             break;
+        case 'M':
+            if (mysql_parse_opts(optarg) != 0)
+                usage();
+            break;
         case 'n':
             n = strtoul(optarg, 0, 0);
             break;
+        case 'N':
+            if (procs_parse(optarg) != 0)
+                usage();
+            break;
         case 'o':
             print = 1;
             break;
+        case 'O':
+            output = strdup(optarg);
+            break;
         case 'P':
             mysql_pw = strdup(optarg);
             break;
+        case 'q':
+            if (delete_parse(optarg) != 0)
+                usage();
+            del = 1;
+            break;
         case 'r':
-            random = 1;
+            if (value_parse(strcpy(randspec, "uniform,min=1,max=255")) != 0)
+                usage();
+            break;
+        case 'R':
+            reps = strtoul(optarg, 0, 0);
             break;
         case 's':
             sqlite = 1;
             break;
+        case 'S':
+            if (sqlite_parse_profile(optarg) != 0)
+                usage();
+            break;
         case 't':
             txnsize = strtoul(optarg, 0, 0);
             break;
@@ -102,96 +777,105 @@ int main(int argc, char **argv)
         case 'U':
             mysql_user = strdup(optarg);
             break;
+        case 'V':
+            if (value_parse(optarg) != 0)
+                usage();
+            break;
         case 'w':
             populate = 1;
             break;
+        case 'W':
+            results_option("workload", "%s", optarg);
+            if (workload_parse(&wl, optarg) != 0)
+                usage();
+            mixed = 1;
+            break;
         case 'x':
             bdb_private = 1;
             break;
+        case 'X':
+            if (sweep_parse(optarg) != 0)
+                usage();
+            break;
+        case 'y':
+            if (crash_parse(optarg) != 0)
+                usage();
+            crash = 1;
+            break;
+        case 'Y':
+            if (lmdb_parse_opts(optarg) != 0)
+                usage();
+            break;
+        case 'z':
+            random_seed = strtoul(optarg, 0, 0);
+            break;
+        case 'Z':
+            compact = 1;
+            break;
         case '?':
             usage();
         }
 
-    if (argc - optind != 0 || (populate + get + dump) != 1)
-        usage();
+    if (compare >= 0) {
+        if (argc - optind != 2)
+            usage();
+        exit(results_compare(argv[optind], argv[optind + 1], compare) ? 2 : 0);
+    }
 
-    if (sqlite) {
-        if ( !cache )
-            cache = 10000;
-
-        printf("Running SQLite benchmark: ");
-        if (populate)
-            printf("creating database.\n");
-        else if (get)
-            printf("reading database, fetching records one by one.\n");
-        else /* dump */
-            printf("dumping database.\n");            
-        printf("Number of records: %lu\n", n);
-        printf("Transaction size: %lu\n", txnsize);
-        printf("Number of cache pages: %lu\n", cache);
-
-        if (populate)
-            sqlite_populate(n, random, txnsize);
-        else if (dump)
-            sqlite_dump();
-        else if (get)
-            sqlite_get(n);
+    /* A contention run has a thread per reader and writer */
+    if (mixed && (wl.readers || wl.writers))
+        nthreads = wl.readers + wl.writers;
+    if (argc - optind != 0 || (populate + get + dump + mixed + del + compact + crash) != 1 || nthreads < 1)
+        usage();
+    if ((del && mysql) || (compact && (mysql || lmdb))) {
+        fprintf(stderr, "%s: -q runs against BerkeleyDB, SQLite, LMDB and LevelDB, "
+                "-Z against BerkeleyDB, SQLite and LevelDB\n", progname);
+        usage();
+    }
+    if (crash && (mysql || lmdb || lsm || nthreads != 1 || bulk || procs_active())) {
+        fprintf(stderr, "%s: -y runs against BerkeleyDB and SQLite on one thread, "
+                "without -B and -N\n", progname);
+        usage();
+    }
+    if (secondary_prefix() && (lmdb || lsm)) {
+        fprintf(stderr, "%s: -i runs against BerkeleyDB, SQLite and MySQL\n", progname);
+        usage();
+    }
+    if (secondary_prefix() && bulk && populate) {
+        fprintf(stderr, "%s: -B populates without the -i index, which bulk puts don't maintain\n",
+                progname);
+        usage();
+    }
+    if (bulk && bulk < pageSize) {
+        fprintf(stderr, "%s: the bulk buffer must hold at least one page\n", progname);
+        usage();
     }
-    
-    if (bdb ) {
-        if ( !cache )
-            cache = 4;
-        cache *= 1024 * 1024;
-
-        printf("Running BerkeleyDB benchmark: ");
-        if (populate)
-            printf("creating database.\n");
-        else if (get)
-            printf("reading database, fetching records one by one.\n");
-        else /* dump */
-            printf("dumping database.\n");            
-        printf("Number of records: %lu\n", n);
-        printf("Transaction size: %lu\n", txnsize);
-        printf("Page size: %u\n", pageSize);
-        printf("Cache size: %lu MB\n", cache/(1024*1024));
-        
-        if (populate)
-            system("rm -rf " BDB_ENV_DIRECTORY);
- 
-        bdb_open(cache, bdb_private, pageSize, txnsize);
-
-        if (dump) {
-            bdb_dump();
-        } else if (get) {
-            bdb_get(n);
-        } else {
-            bdb_populate(n, txnsize, random);
-        }
 
-        bdb_close();
+    if (procs_active() && (mysql || lsm || bdb_private || sweep_active())) {
+        fprintf(stderr, "%s: -N runs BerkeleyDB without -x, SQLite and LMDB, and not with -X\n",
+                progname);
+        usage();
+    }
 
+    if (output && sweep_active()) {
+        fprintf(stderr, "%s: -O can't be combined with -X\n", progname);
+        usage();
     }
 
-    if (mysql) {
-        printf("Running MySQL benchmark: ");
-        if (populate)
-            printf("creating database.\n");
-        else if (get)
-            printf("reading database, fetching records one by one.\n");
-        else /* dump */
-            printf("dumping database.\n");            
-        printf("Number of records: %lu\n", n);
-
-        if (dump) {
-            mysql_dump(mysql_host, mysql_user, mysql_pw, mysql_db);
-        } else if (get) {
-            mysql_get(mysql_host, mysql_user, mysql_pw, mysql_db, n);
-        } else {
-            mysql_populate(mysql_host, mysql_user, mysql_pw, mysql_db,
-                           n, txnsize, random);
-        }
+    /* Before -N forks, all processes share the file */
+    if (print)
+        sink_open();
+
+    if (sweep_active()) {
+        sweep_run(reps, sweep_set, sweep_bench);
+    } else {
+        run();
+        if (output)
+            results_write(output);
     }
 
-    return 0;
-}
+    if (print)
+        sink_close();
 
+    return crash_failed() ? 1 : 0;
+}
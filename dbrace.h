@@ -4,5 +4,8 @@
 extern const char *progname;
 extern unsigned long cache;
 extern int print;
+extern int nthreads;
+extern int pin_cpus;
+extern unsigned long random_seed;
 
 #endif
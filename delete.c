@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "rng.h"
+#include "results.h"
+#include "delete.h"
+
+static int delete_random = 1;
+static unsigned long delete_from = 1;       /* range */
+static unsigned long delete_n = 0;          /* count=, 0: half the records */
+
+/* Random deletes: the keys in the order they go */
+static unsigned long *order;
+static unsigned long order_len;
+
+/* -q random|range,count=<n>,from=<key> */
+int delete_parse(char *spec)
+{
+    char *const tokens[] = { "random", "range", "count", "from", NULL };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            delete_random = 1;
+            break;
+        case 1:
+            delete_random = 0;
+            break;
+        case 2:
+            if (value == NULL || (delete_n = strtoul(value, NULL, 0)) == 0)
+                return -1;
+            break;
+        case 3:
+            if (value == NULL || (delete_from = strtoul(value, NULL, 0)) == 0)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Records are keys [1, n) */
+void delete_init(unsigned long n)
+{
+    struct phase ph;
+    uint64_t rng;
+    unsigned long i, j, t, keys = n > 1 ? n - 1 : 0;
+
+    if (delete_n == 0)
+        delete_n = keys / 2;
+    if (!delete_random) {
+        if (delete_from >= n)
+            delete_n = 0;
+        else if (delete_n > n - delete_from)
+            delete_n = n - delete_from;
+        return;
+    }
+    if (delete_n > keys)
+        delete_n = keys;
+    if (order && order_len == keys)
+        return;
+
+    free(order);
+    order_len = keys;
+    if ((order = malloc((keys ? keys : 1) * sizeof(*order))) == NULL) {
+        fprintf(stderr, "%s: couldn't allocate the delete order\n", progname);
+        exit(1);
+    }
+
+    /* A different stream than -k shuffle, which laid out the inserts */
+    phase_begin(&ph, "shuffle");
+    rng = rng_seed(~random_seed);
+    for (i = 0; i < keys; i++)
+        order[i] = 1 + i;
+    for (i = keys; i > 1; i--) {
+        j = rng_below(&rng, i);
+        t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+    phase_end(&ph);
+}
+
+void delete_print(void)
+{
+    if (delete_random)
+        printf("Deletes: %lu records at random\n", delete_n);
+    else
+        printf("Deletes: %lu records from key %lu\n", delete_n, delete_from);
+    results_option("delete_order", "%s", delete_random ? "random" : "range");
+    results_option("delete_count", "%lu", delete_n);
+    results_option("delete_from", "%lu", delete_random ? 0 : delete_from);
+}
+
+unsigned long delete_count(void)
+{
+    return delete_n;
+}
+
+unsigned long delete_key(unsigned long i)
+{
+    return delete_random ? order[i] : delete_from + i;
+}
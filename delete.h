@@ -0,0 +1,17 @@
+#ifndef DELETE_H
+#define DELETE_H
+
+/*
+ * Delete action (-q): removes count of the populated records, either
+ * picked at random from all of them or a range of consecutive keys from
+ * a start key. Backends delete delete_key(i) for i in [0, count) on the
+ * worker pool, committing every -t deletes the way populate does, and
+ * a key that is already gone still counts as an operation.
+ */
+extern int delete_parse(char *spec);
+extern void delete_print(void);
+extern void delete_init(unsigned long n);
+extern unsigned long delete_count(void);
+extern unsigned long delete_key(unsigned long i);
+
+#endif
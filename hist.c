@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+void hist_reset(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    int i;
+
+    if (src->count == 0)
+        return;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* Highest value that falls into bucket i */
+static uint64_t hist_bucket_top(int i)
+{
+    int group = i >> HIST_SUB_BITS;
+    uint64_t sub = i & (HIST_SUB_BUCKETS - 1);
+
+    if (group == 0)
+        return sub;
+    return ((HIST_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+uint64_t hist_percentile(const struct hist *h, double pct)
+{
+    uint64_t want, seen = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (want < 1)
+        want = 1;
+    if (want >= h->count)
+        return h->max;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want) {
+            uint64_t v = hist_bucket_top(i);
+            if (v > h->max)
+                v = h->max;
+            if (v < h->min)
+                v = h->min;
+            return v;
+        }
+    }
+
+    return h->max;
+}
+
+double hist_mean(const struct hist *h)
+{
+    return h->count ? (double)h->sum / h->count : 0.0;
+}
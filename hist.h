@@ -0,0 +1,66 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/*
+ * Log-bucketed latency histogram in the spirit of HdrHistogram: values
+ * are grouped by their most significant bit and each power-of-two range
+ * is split linearly into HIST_SUB_BUCKETS buckets. That keeps the
+ * relative error below 1/HIST_SUB_BUCKETS (~3%) for any value from
+ * nanoseconds to hours while recording is a couple of shifts and an
+ * increment.
+ */
+#define HIST_SUB_BITS    5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS     ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct hist {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+extern void hist_reset(struct hist *h);
+extern void hist_merge(struct hist *dst, const struct hist *src);
+extern uint64_t hist_percentile(const struct hist *h, double pct);
+extern double hist_mean(const struct hist *h);
+
+static inline int hist_msb(uint64_t v)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(v);
+#else
+    int msb = 0;
+
+    while (v >>= 1)
+        msb++;
+    return msb;
+#endif
+}
+
+static inline int hist_bucket(uint64_t v)
+{
+    int msb;
+
+    if (v < HIST_SUB_BUCKETS)
+        return (int)v;
+    msb = hist_msb(v);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+        + (int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+static inline void hist_add(struct hist *h, uint64_t v)
+{
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+#endif
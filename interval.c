@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dbrace.h"
+#include "bench.h"
+
+/*
+ * Interval time series. A phase that runs while a series is open adds
+ * its operations to a private histogram and hands that over with its
+ * first operation ending in a later interval, so a worker stalled in a
+ * checkpoint puts its slow operation into the interval it completes in.
+ * The reporter thread prints each interval a little after it ended;
+ * operations handed over later still count for the results, but no
+ * longer make it into the printed p99.
+ */
+struct iv_slot {
+    unsigned long ops;
+    uint64_t max;
+    double p99;                 /* usec, set when reported */
+    struct hist *h;             /* until reported */
+};
+
+static double iv_secs;                  /* -I, 0: off */
+static pthread_mutex_t iv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t iv_reporter;
+static const char *iv_name;
+static int iv_active, iv_stop;
+static uint64_t iv_start, iv_width;     /* ns */
+static unsigned long iv_ops;            /* handed over so far */
+static struct iv_slot *slots;
+static int nslots, slots_size, reported;
+
+static struct interval_result *ivres;
+static int nivres, ivres_size;
+static struct interval_event *events;
+static int nevents, events_size;
+
+static void *iv_grow(void *p, int *size, int need, size_t elem)
+{
+    int old = *size;
+
+    if (need <= old)
+        return p;
+    while (*size < need)
+        *size = *size ? 2 * *size : 64;
+    if ((p = realloc(p, *size * elem)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+    memset((char *)p + old * elem, 0, (*size - old) * elem);
+    return p;
+}
+
+void interval_set(double secs)
+{
+    iv_secs = secs;
+}
+
+double interval_secs(void)
+{
+    return iv_secs;
+}
+
+/* Slot i, iv_lock held */
+static struct iv_slot *iv_slot(int i)
+{
+    slots = iv_grow(slots, &slots_size, i + 1, sizeof(*slots));
+    if (i >= nslots)
+        nslots = i + 1;
+    return &slots[i];
+}
+
+/* Print slot i, which ended at or before end, iv_lock held */
+static void iv_report(int i, uint64_t end)
+{
+    struct iv_slot *sl = iv_slot(i);
+    uint64_t from = iv_start + i * iv_width;
+    double secs = (end - from < iv_width ? end - from : iv_width) / 1e9;
+
+    if (sl->h) {
+        sl->p99 = hist_percentile(sl->h, 99.0) / 1e3;
+        free(sl->h);
+        sl->h = NULL;
+    }
+    fprintf(stderr, "%s @ %.1f s: %lu ops, %.1f ops/sec, p99 %.2f usec, max %.2f usec\n",
+            iv_name, i * iv_width / 1e9, sl->ops, secs > 0 ? sl->ops / secs : 0.0,
+            sl->p99, sl->max / 1e3);
+}
+
+static void *iv_reporter_main(void *arg)
+{
+    uint64_t grace = iv_width / 10 < 100000000 ? iv_width / 10 : 100000000;
+    uint64_t due, now, nap;
+    struct timespec ts;
+
+    (void)arg;
+    pthread_mutex_lock(&iv_lock);
+    while (!iv_stop) {
+        due = iv_start + (reported + 1) * iv_width + grace;
+        now = bench_now();
+        /* Phases without operations don't get a time series */
+        if (now >= due && iv_ops) {
+            iv_report(reported, now);
+            reported++;
+            continue;
+        }
+        pthread_mutex_unlock(&iv_lock);
+        nap = now < due && due - now < 50000000 ? due - now : 50000000;
+        ts.tv_sec = nap / 1000000000;
+        ts.tv_nsec = nap % 1000000000;
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&iv_lock);
+    }
+    pthread_mutex_unlock(&iv_lock);
+    return NULL;
+}
+
+/*
+ * Start a series for the phases named name, unless -I is off or one is
+ * open already. Returns 1 if it was opened, the caller closes it.
+ */
+int interval_open(const char *name)
+{
+    int rc;
+
+    if (iv_secs <= 0 || iv_active)
+        return 0;
+
+    iv_name = name;
+    iv_width = (uint64_t)(iv_secs * 1e9);
+    iv_ops = 0;
+    nslots = reported = 0;
+    iv_stop = 0;
+    iv_start = bench_now();
+    iv_active = 1;
+
+    rc = pthread_create(&iv_reporter, NULL, iv_reporter_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "%s: pthread_create: %s\n", progname, strerror(rc));
+        exit(1);
+    }
+    return 1;
+}
+
+/* Report what is left and keep the series for the results */
+void interval_close(void)
+{
+    struct interval_result *r;
+    uint64_t end;
+    int i, last;
+
+    if (!iv_active)
+        return;
+
+    pthread_mutex_lock(&iv_lock);
+    iv_stop = 1;
+    pthread_mutex_unlock(&iv_lock);
+    pthread_join(iv_reporter, NULL);
+
+    end = bench_now();
+    last = (end - iv_start + iv_width - 1) / iv_width;
+    for (i = reported; i < last && iv_ops; i++)
+        iv_report(i, end);
+
+    if (iv_ops) {
+        ivres = iv_grow(ivres, &ivres_size, nivres + last, sizeof(*ivres));
+        for (i = 0; i < last; i++) {
+            const struct iv_slot *sl = iv_slot(i);
+            uint64_t from = iv_start + i * iv_width;
+
+            r = &ivres[nivres++];
+            snprintf(r->phase, sizeof(r->phase), "%s", iv_name);
+            r->t = i * iv_width / 1e9;
+            r->secs = (end - from < iv_width ? end - from : iv_width) / 1e9;
+            r->ops = sl->ops;
+            r->p99 = sl->p99;
+            r->max = sl->max / 1e3;
+        }
+    }
+
+    for (i = 0; i < nslots; i++) {
+        free(slots[i].h);
+        memset(&slots[i], 0, sizeof(slots[i]));
+    }
+    iv_active = 0;
+}
+
+/* Join the open series, if any; called when the clock of ph starts */
+void interval_join(struct phase *ph)
+{
+    uint64_t now;
+
+    ph->iv_next = 0;
+    if (!iv_active)
+        return;
+    now = bench_now();
+    ph->iv_next = iv_start + ((now - iv_start) / iv_width + 1) * iv_width;
+    hist_reset(&ph->iv);
+}
+
+/* Hand the operations of ph's current interval over to its slot */
+static void iv_publish(struct phase *ph)
+{
+    struct iv_slot *sl;
+    int i;
+
+    if (ph->iv.count == 0)
+        return;
+
+    pthread_mutex_lock(&iv_lock);
+    i = (ph->iv_next - iv_start) / iv_width - 1;
+    sl = iv_slot(i);
+    sl->ops += ph->iv.count;
+    if (ph->iv.max > sl->max)
+        sl->max = ph->iv.max;
+    if (i >= reported) {
+        if (sl->h == NULL) {
+            if ((sl->h = malloc(sizeof(*sl->h))) == NULL) {
+                fprintf(stderr, "%s: out of memory\n", progname);
+                exit(1);
+            }
+            hist_reset(sl->h);
+        }
+        hist_merge(sl->h, &ph->iv);
+    }
+    iv_ops += ph->iv.count;
+    pthread_mutex_unlock(&iv_lock);
+
+    hist_reset(&ph->iv);
+}
+
+void interval_add(struct phase *ph, uint64_t ns, uint64_t now)
+{
+    if (now >= ph->iv_next) {
+        iv_publish(ph);
+        ph->iv_next += ((now - ph->iv_next) / iv_width + 1) * iv_width;
+    }
+    hist_add(&ph->iv, ns);
+}
+
+/* ph's clock stopped: hand over the rest, close the series if ph opened it */
+void interval_leave(struct phase *ph)
+{
+    if (ph->iv_next) {
+        iv_publish(ph);
+        ph->iv_next = 0;
+    }
+    if (ph->iv_owner) {
+        interval_close();
+        ph->iv_owner = 0;
+    }
+}
+
+/* Put an engine event on the timeline of the open series, from any thread */
+void interval_note(const char *fmt, ...)
+{
+    struct interval_event *ev;
+    va_list ap;
+
+    if (!iv_active)
+        return;
+
+    pthread_mutex_lock(&iv_lock);
+    events = iv_grow(events, &events_size, nevents + 1, sizeof(*events));
+    ev = &events[nevents++];
+    snprintf(ev->phase, sizeof(ev->phase), "%s", iv_name);
+    ev->t = (bench_now() - iv_start) / 1e9;
+    va_start(ap, fmt);
+    vsnprintf(ev->what, sizeof(ev->what), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "%s @ %.1f s: %s\n", ev->phase, ev->t, ev->what);
+    pthread_mutex_unlock(&iv_lock);
+}
+
+const struct interval_result *bench_intervals(int *count)
+{
+    *count = nivres;
+    return ivres;
+}
+
+const struct interval_event *bench_events(int *count)
+{
+    *count = nevents;
+    return events;
+}
+
+/* Drop the intervals and events recorded after the given counts */
+void interval_rewind(int intervals, int nev)
+{
+    if (intervals < nivres)
+        nivres = intervals;
+    if (nev < nevents)
+        nevents = nev;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "rng.h"
+#include "results.h"
+#include "key.h"
+
+static const char *key_enc_names[] = {
+    "native", "be", "string", "varstr", "uuid"
+};
+
+static enum key_enc key_enc = KEY_NATIVE;
+static int key_width = 16;              /* string */
+static int key_shuffle = 0;
+
+/* Insertion order of [perm_first, perm_first + perm_len) when shuffled */
+static unsigned long *perm;
+static unsigned long perm_first, perm_len;
+
+int key_parse(char *spec)
+{
+    char *const tokens[] = {
+        "native", "be", "string", "varstr", "uuid", "width", "seq", "shuffle", NULL
+    };
+    char *value;
+    int tok;
+
+    while (*spec) {
+        tok = getsubopt(&spec, tokens, &value);
+        if (tok >= KEY_NATIVE && tok <= KEY_UUID) {
+            key_enc = tok;
+            continue;
+        }
+        switch (tok) {
+        case 5:
+            if (value == NULL || (key_width = atoi(value)) < 1 || key_width >= KEY_MAX)
+                return -1;
+            break;
+        case 6:
+            key_shuffle = 0;
+            break;
+        case 7:
+            key_shuffle = 1;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown key option '%s'\n", progname, value);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+enum key_enc key_type(void)
+{
+    return key_enc;
+}
+
+/* Store key number n into buf, which holds KEY_MAX bytes, returns the length */
+size_t key_encode(unsigned long n, void *buf)
+{
+    unsigned char *p = buf;
+    uint64_t h, l;
+    int i, len;
+
+    switch (key_enc) {
+    case KEY_BE:
+        for (i = 0; i < 8; i++)
+            p[i] = (uint64_t)n >> (56 - 8 * i);
+        return 8;
+    case KEY_STRING:
+    case KEY_VARSTR:
+        len = snprintf(buf, KEY_MAX, "%0*lu", key_enc == KEY_STRING ? key_width : 1, n);
+        return len < KEY_MAX ? len : KEY_MAX - 1;
+    case KEY_UUID:
+        /* Same number, same UUID, so that later runs find the records */
+        h = rng_seed(n);
+        l = rng_seed(h);
+        for (i = 0; i < 8; i++) {
+            p[i] = h >> (56 - 8 * i);
+            p[8 + i] = l >> (56 - 8 * i);
+        }
+        p[6] = (p[6] & 0x0f) | 0x40;    /* version 4 */
+        p[8] = (p[8] & 0x3f) | 0x80;    /* RFC 4122 variant */
+        return 16;
+    default:
+        memcpy(buf, &n, sizeof(n));
+        return sizeof(n);
+    }
+}
+
+/* Printable form of an encoded key, buf holds KEY_STRLEN bytes */
+const char *key_string(const void *key, size_t len, char *buf)
+{
+    const unsigned char *p = key;
+    unsigned long n = 0;
+    size_t i, off;
+
+    switch (key_enc) {
+    case KEY_NATIVE:
+        if (len != sizeof(n))
+            break;
+        memcpy(&n, key, sizeof(n));
+        snprintf(buf, KEY_STRLEN, "%lu", n);
+        return buf;
+    case KEY_BE:
+        if (len != 8)
+            break;
+        for (i = 0; i < 8; i++)
+            n = n << 8 | p[i];
+        snprintf(buf, KEY_STRLEN, "%lu", n);
+        return buf;
+    case KEY_STRING:
+    case KEY_VARSTR:
+        snprintf(buf, KEY_STRLEN, "%.*s", (int)len, (const char *)key);
+        return buf;
+    default:
+        break;
+    }
+
+    /* UUIDs and anything that doesn't decode go out as hex */
+    for (i = 0, off = 0; i < len && off + 3 < KEY_STRLEN; i++) {
+        if (key_enc == KEY_UUID && (i == 4 || i == 6 || i == 8 || i == 10))
+            buf[off++] = '-';
+        off += sprintf(buf + off, "%02x", p[i]);
+    }
+    buf[off] = '\0';
+    return buf;
+}
+
+/*
+ * The key number populate writes i-th. Shuffled, that's a seeded random
+ * permutation of the populated range laid out before the run, so every
+ * worker slice gets keys from all over the key space.
+ */
+unsigned long key_order(unsigned long i)
+{
+    if (perm == NULL || i < perm_first || i - perm_first >= perm_len)
+        return i;
+    return perm[i - perm_first];
+}
+
+/* Lay out the insertion order of [first, last) */
+void key_init(unsigned long first, unsigned long last)
+{
+    struct phase ph;
+    uint64_t rng;
+    unsigned long i, j, t;
+
+    if (!key_shuffle || last <= first)
+        return;
+    if (perm && perm_first == first && perm_len == last - first)
+        return;
+
+    free(perm);
+    perm_first = first;
+    perm_len = last - first;
+    if ((perm = malloc(perm_len * sizeof(*perm))) == NULL) {
+        fprintf(stderr, "%s: couldn't allocate the shuffled key order\n", progname);
+        exit(1);
+    }
+
+    phase_begin(&ph, "shuffle");
+    rng = rng_seed(random_seed);
+    for (i = 0; i < perm_len; i++)
+        perm[i] = first + i;
+    for (i = perm_len - 1; i > 0; i--) {
+        j = rng_below(&rng, i + 1);
+        t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    phase_end(&ph);
+}
+
+void key_print(void)
+{
+    printf("Keys: %s", key_enc_names[key_enc]);
+    if (key_enc == KEY_STRING)
+        printf(" %d digits", key_width);
+    printf(", %s order\n", key_shuffle ? "shuffled" : "sequential");
+
+    results_option("key_encoding", "%s", key_enc_names[key_enc]);
+    results_option("key_width", "%d", key_enc == KEY_STRING ? key_width : 0);
+    results_option("key_order", "%s", key_shuffle ? "shuffle" : "seq");
+}
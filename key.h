@@ -0,0 +1,34 @@
+#ifndef KEY_H
+#define KEY_H
+
+#include <stddef.h>
+
+/*
+ * Record keys. Every action works on key numbers 1..n; -k picks the
+ * bytes a key number is stored as and the order populate inserts them
+ * in. BerkeleyDB and LevelDB compare the encoded bytes with memcmp(), so
+ * only the big-endian and fixed-width string encodings sort like the
+ * numbers; LMDB sorts native keys as integers.
+ * SQLite and MySQL keep an integer primary key for the two integer
+ * encodings and a text or binary one otherwise.
+ */
+enum key_enc {
+    KEY_NATIVE,                 /* host order unsigned long */
+    KEY_BE,                     /* 8 byte big-endian */
+    KEY_STRING,                 /* zero padded decimal, width digits */
+    KEY_VARSTR,                 /* decimal without padding */
+    KEY_UUID                    /* 16 bytes hashed from the number */
+};
+
+#define KEY_MAX     48          /* longest encoded key */
+#define KEY_STRLEN  64          /* key_string() buffer */
+
+extern int key_parse(char *spec);
+extern void key_init(unsigned long first, unsigned long last);
+extern void key_print(void);
+extern enum key_enc key_type(void);
+extern size_t key_encode(unsigned long n, void *buf);
+extern const char *key_string(const void *key, size_t len, char *buf);
+extern unsigned long key_order(unsigned long i);
+
+#endif
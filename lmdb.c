@@ -0,0 +1,590 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <lmdb.h>
+#include "dbrace.h"
+#include "bench.h"
+#include "worker.h"
+#include "workload.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
+#include "procs.h"
+#include "sink.h"
+#include "delete.h"
+#include "stage.h"
+#include "lmdb.h"
+
+#define LMDB_OK 0
+
+static MDB_env *env;
+static MDB_dbi dbi;
+
+/* -Y options */
+static size_t lmdb_mapsize = LMDB_MAPSIZE;
+static int lmdb_nosync = 0;         /* MDB_NOSYNC: commits don't fsync */
+static int lmdb_nometasync = 0;     /* MDB_NOMETASYNC: the meta page isn't synced */
+static int lmdb_writemap = 0;       /* MDB_WRITEMAP: write through the map */
+static int lmdb_append = 0;         /* MDB_APPEND: populate in key order */
+static int lmdb_copy = 0;           /* reads copy the value out of the map */
+
+static void lmdb_error(int rc, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, ": %s\n", mdb_strerror(rc));
+    va_end(ap);
+    if (rc == MDB_MAP_FULL)
+        fprintf(stderr, "%s: raise the map size with -Y mapsize=<MB>\n", progname);
+    exit(2);
+}
+
+int lmdb_parse_opts(char *spec)
+{
+    char *const tokens[] = {
+        "mapsize", "nosync", "nometasync", "writemap", "append", "copy", NULL
+    };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            if (value == NULL || (lmdb_mapsize = strtoul(value, NULL, 0) * 1024 * 1024) == 0)
+                return -1;
+            break;
+        case 1:
+            lmdb_nosync = 1;
+            break;
+        case 2:
+            lmdb_nometasync = 1;
+            break;
+        case 3:
+            lmdb_writemap = 1;
+            break;
+        case 4:
+            lmdb_append = 1;
+            break;
+        case 5:
+            lmdb_copy = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void lmdb_print_opts(void)
+{
+    printf("Map size: %lu MB", (unsigned long)(lmdb_mapsize / (1024 * 1024)));
+    if (lmdb_nosync)
+        printf(", nosync");
+    if (lmdb_nometasync)
+        printf(", nometasync");
+    if (lmdb_writemap)
+        printf(", writemap");
+    if (lmdb_append)
+        printf(", append");
+    printf(", reads %s\n", lmdb_copy ? "copy the value" : "zero-copy");
+    results_option("lmdb_mapsize_mb", "%lu", (unsigned long)(lmdb_mapsize / (1024 * 1024)));
+    results_option("lmdb_nosync", "%d", lmdb_nosync);
+    results_option("lmdb_nometasync", "%d", lmdb_nometasync);
+    results_option("lmdb_writemap", "%d", lmdb_writemap);
+    results_option("lmdb_append", "%d", lmdb_append);
+    results_option("lmdb_copy", "%d", lmdb_copy);
+}
+
+/*
+ * Reads hand back a pointer into the map. With copy they pay for the
+ * memcpy() the other engines do into their own buffers.
+ */
+static void lmdb_read_value(const MDB_val *data, char **buf, size_t *size)
+{
+    if (!lmdb_copy)
+        return;
+    if (data->mv_size > *size) {
+        *size = data->mv_size;
+        if ((*buf = realloc(*buf, *size)) == NULL)
+            lmdb_error(ENOMEM, "Couldn't allocate value buffer");
+    }
+    memcpy(*buf, data->mv_data, data->mv_size);
+}
+
+static MDB_txn *lmdb_begin(unsigned int flags)
+{
+    MDB_txn *txn;
+    int rc;
+
+    rc = mdb_txn_begin(env, NULL, flags, &txn);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't begin transaction");
+    return txn;
+}
+
+static void lmdb_commit(MDB_txn *txn)
+{
+    int rc;
+
+    rc = mdb_txn_commit(txn);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't commit transaction");
+}
+
+/* Read transactions are kept per thread and renewed for every read */
+static void lmdb_renew(MDB_txn *txn)
+{
+    int rc;
+
+    rc = mdb_txn_renew(txn);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't renew read transaction");
+}
+
+/* Page and map usage, the counters are the gauges of the B+tree */
+static void lmdb_sample(struct counters *c, int begin)
+{
+    MDB_stat st;
+    MDB_envinfo info;
+
+    (void)begin;
+    mdb_env_stat(env, &st);
+    mdb_env_info(env, &info);
+    counters_add(c, "commits", info.me_last_txnid, 0);
+    counters_add(c, "depth", st.ms_depth, 1);
+    counters_add(c, "branch_pages", st.ms_branch_pages, 1);
+    counters_add(c, "leaf_pages", st.ms_leaf_pages, 1);
+    counters_add(c, "overflow_pages", st.ms_overflow_pages, 1);
+    counters_add(c, "map_pages", info.me_last_pgno + 1, 1);
+    counters_add(c, "readers", info.me_numreaders, 1);
+}
+
+void lmdb_print_stats(void)
+{
+    MDB_stat st;
+    MDB_envinfo info;
+
+    mdb_env_stat(env, &st);
+    mdb_env_info(env, &info);
+
+    printf("B+tree: %lu entries, depth %u, %lu branch, %lu leaf and %lu overflow pages of %u bytes\n",
+           (unsigned long)st.ms_entries, st.ms_depth, (unsigned long)st.ms_branch_pages,
+           (unsigned long)st.ms_leaf_pages, (unsigned long)st.ms_overflow_pages, st.ms_psize);
+    printf("Map: %.1f of %lu MB used\n",
+           (double)(info.me_last_pgno + 1) * st.ms_psize / (1024 * 1024),
+           (unsigned long)(info.me_mapsize / (1024 * 1024)));
+
+    results_metric("lmdb_entries", "%lu", (unsigned long)st.ms_entries);
+    results_metric("lmdb_depth", "%u", st.ms_depth);
+    results_metric("lmdb_leaf_pages", "%lu", (unsigned long)st.ms_leaf_pages);
+    results_metric("lmdb_overflow_pages", "%lu", (unsigned long)st.ms_overflow_pages);
+    results_metric("lmdb_used_bytes", "%lu", (unsigned long)((info.me_last_pgno + 1) * st.ms_psize));
+}
+
+void lmdb_dump(void)
+{
+    int rc;
+    MDB_txn *txn;
+    MDB_cursor *cur;
+    MDB_val key, data;
+    struct phase ph;
+    uint64_t t0;
+    char *buf = NULL;
+    size_t size = 0;
+    struct sink *out = print ? sink_new() : NULL;
+
+    txn = lmdb_begin(MDB_RDONLY);
+    rc = mdb_cursor_open(txn, dbi, &cur);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't create cursor");
+
+    phase_begin(&ph, "dump");
+
+    t0 = bench_now();
+    rc = mdb_cursor_get(cur, &key, &data, MDB_FIRST);
+    while (rc == LMDB_OK) {
+        lmdb_read_value(&data, &buf, &size);
+        phase_op(&ph, t0);
+        if (out)
+            sink_record(out, key.mv_data, key.mv_size, data.mv_data, data.mv_size);
+        t0 = bench_now();
+        rc = mdb_cursor_get(cur, &key, &data, MDB_NEXT);
+    }
+
+    sink_free(out);
+    phase_end(&ph);
+
+    if (rc != MDB_NOTFOUND)
+        lmdb_error(rc, "Error iterating over B+tree");
+
+    mdb_cursor_close(cur);
+    mdb_txn_abort(txn);
+    free(buf);
+}
+
+/* Fetch the odd keys of the slice, then the even ones */
+static void lmdb_get_worker(struct worker *w)
+{
+    int rc, pass;
+    unsigned long i;
+    MDB_txn *txn;
+    MDB_val key, data;
+    unsigned char kbuf[KEY_MAX];
+    char *buf = NULL;
+    size_t size = 0;
+    uint64_t t0;
+
+    txn = lmdb_begin(MDB_RDONLY);
+    mdb_txn_reset(txn);
+    key.mv_data = kbuf;
+
+    worker_begin(w);
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = w->first + ((w->first + pass + 1) & 1); i < w->last; i+=2) {
+            t0 = bench_now();
+            key.mv_size = key_encode(i, kbuf);
+            lmdb_renew(txn);
+            rc = mdb_get(txn, dbi, &key, &data);
+            if (rc != LMDB_OK)
+                lmdb_error(rc, "Error fetching key %lu", i);
+            lmdb_read_value(&data, &buf, &size);
+            /* The value lives in the map only as long as the transaction */
+            if (w->out)
+                sink_record(w->out, kbuf, key.mv_size, data.mv_data, data.mv_size);
+            mdb_txn_reset(txn);
+            phase_op(&w->ph, t0);
+        }
+    }
+
+    worker_end(w);
+
+    mdb_txn_abort(txn);
+    free(buf);
+}
+
+static const struct kv_ops lmdb_kv_ops;
+
+void lmdb_get(unsigned long n)
+{
+    workload_warmup(NULL, n, &lmdb_kv_ops);
+    workers_run("get", 1, n, lmdb_get_worker, NULL);
+}
+
+/* Write key n with a value from the arena, LMDB copies it into the page */
+static int lmdb_insert(MDB_txn *txn, unsigned long n, uint64_t *rng, unsigned int flags)
+{
+    MDB_val key, data;
+    unsigned char kbuf[KEY_MAX];
+    size_t len;
+    int rc;
+
+    STAGE_START();
+    key.mv_data = kbuf;
+    key.mv_size = key_encode(n, kbuf);
+    data.mv_data = (void *)value_next(rng, &len);
+    data.mv_size = len;
+    STAGE_END(STAGE_GENERATE);
+
+    rc = mdb_put(txn, dbi, &key, &data, flags);
+    STAGE_END(STAGE_PUT);
+    return rc;
+}
+
+/*
+ * LMDB has a single writer, concurrent workers queue up for the write
+ * transaction instead of deadlocking. Without -t every put commits on
+ * its own, like autocommit in the other engines.
+ */
+struct lmdb_args {
+    unsigned long txnsize;
+};
+
+static void lmdb_populate_worker(struct worker *w)
+{
+    struct lmdb_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    unsigned int flags = lmdb_append ? MDB_APPEND : 0;
+    MDB_txn *txn = NULL;
+    unsigned long i;
+    uint64_t t0;
+    int rc;
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        if (txn == NULL) {
+            STAGE_START();
+            txn = lmdb_begin(0);
+            STAGE_END(STAGE_COMMIT);
+        }
+        rc = lmdb_insert(txn, key_order(i), &w->rng, flags);
+        if (rc == MDB_KEYEXIST && lmdb_append)
+            lmdb_error(rc, "Key %lu is out of order for MDB_APPEND, which needs -j 1, "
+                       "sequential keys and the native, be or string encoding", key_order(i));
+        if (rc != LMDB_OK)
+            lmdb_error(rc, "Couldn't insert key %lu", key_order(i));
+        if (txnsize <= 1 || (i + 1 - w->first) % txnsize == 0) {
+            STAGE_START();
+            lmdb_commit(txn);
+            STAGE_END(STAGE_COMMIT);
+            txn = NULL;
+        }
+        phase_op(&w->ph, t0);
+    }
+    if (txn)
+        lmdb_commit(txn);
+
+    worker_end(w);
+}
+
+void lmdb_populate(unsigned long n, unsigned long txnsize)
+{
+    struct lmdb_args args;
+
+    args.txnsize = txnsize;
+    workers_run("populate", 1, n, lmdb_populate_worker, &args);
+}
+
+/* Deletes commit like populate's puts, a key that is already gone is no error */
+static void lmdb_delete_worker(struct worker *w)
+{
+    struct lmdb_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    MDB_txn *txn = NULL;
+    MDB_val key;
+    unsigned char kbuf[KEY_MAX];
+    unsigned long i;
+    uint64_t t0;
+    int rc;
+
+    key.mv_data = kbuf;
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        if (txn == NULL)
+            txn = lmdb_begin(0);
+        key.mv_size = key_encode(delete_key(i), kbuf);
+        rc = mdb_del(txn, dbi, &key, NULL);
+        if (rc != LMDB_OK && rc != MDB_NOTFOUND)
+            lmdb_error(rc, "Couldn't delete key %lu", delete_key(i));
+        if (txnsize <= 1 || (i + 1 - w->first) % txnsize == 0) {
+            lmdb_commit(txn);
+            txn = NULL;
+        }
+        phase_op(&w->ph, t0);
+    }
+    if (txn)
+        lmdb_commit(txn);
+
+    worker_end(w);
+}
+
+void lmdb_delete(unsigned long txnsize)
+{
+    struct lmdb_args args;
+
+    args.txnsize = txnsize;
+    workers_run("delete", 0, delete_count(), lmdb_delete_worker, &args);
+}
+
+/* Workload primitives, every write commits on its own */
+struct lmdb_ctx {
+    struct worker *w;
+    MDB_txn *rtxn;              /* reset between reads */
+    MDB_cursor *cur;
+    char *buf;
+    size_t size;
+};
+
+static void *lmdb_kv_open(struct worker *w)
+{
+    struct lmdb_ctx *ctx = calloc(1, sizeof(*ctx));
+    int rc;
+
+    if (ctx == NULL)
+        lmdb_error(ENOMEM, "Couldn't allocate workload context");
+    ctx->w = w;
+    ctx->rtxn = lmdb_begin(MDB_RDONLY);
+    rc = mdb_cursor_open(ctx->rtxn, dbi, &ctx->cur);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't create cursor");
+    mdb_txn_reset(ctx->rtxn);
+    return ctx;
+}
+
+static void lmdb_kv_close(void *arg)
+{
+    struct lmdb_ctx *ctx = arg;
+
+    mdb_cursor_close(ctx->cur);
+    mdb_txn_abort(ctx->rtxn);
+    free(ctx->buf);
+    free(ctx);
+}
+
+static int lmdb_kv_read(void *arg, unsigned long k)
+{
+    struct lmdb_ctx *ctx = arg;
+    MDB_val key, data;
+    unsigned char kbuf[KEY_MAX];
+    int rc;
+
+    key.mv_data = kbuf;
+    key.mv_size = key_encode(k, kbuf);
+    lmdb_renew(ctx->rtxn);
+    rc = mdb_get(ctx->rtxn, dbi, &key, &data);
+    if (rc == LMDB_OK) {
+        lmdb_read_value(&data, &ctx->buf, &ctx->size);
+        if (ctx->w->out)
+            sink_record(ctx->w->out, kbuf, key.mv_size, data.mv_data, data.mv_size);
+    }
+    mdb_txn_reset(ctx->rtxn);
+    if (rc == MDB_NOTFOUND)
+        return 1;
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Error fetching key %lu", k);
+    return 0;
+}
+
+static int lmdb_kv_write(void *arg, unsigned long k)
+{
+    struct lmdb_ctx *ctx = arg;
+    MDB_txn *txn;
+    int rc;
+
+    txn = lmdb_begin(0);
+    rc = lmdb_insert(txn, k, &ctx->w->rng, 0);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't write key %lu", k);
+    lmdb_commit(txn);
+    return 0;
+}
+
+/* MDB_SET_RANGE to the first key >= k, then MDB_NEXT */
+static unsigned long lmdb_kv_scan(void *arg, unsigned long k, unsigned long len)
+{
+    struct lmdb_ctx *ctx = arg;
+    MDB_val key, data;
+    unsigned char kbuf[KEY_MAX];
+    unsigned long i;
+    int rc;
+
+    key.mv_data = kbuf;
+    key.mv_size = key_encode(k, kbuf);
+    lmdb_renew(ctx->rtxn);
+    rc = mdb_cursor_renew(ctx->rtxn, ctx->cur);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't renew cursor");
+
+    rc = mdb_cursor_get(ctx->cur, &key, &data, MDB_SET_RANGE);
+    for (i = 0; rc == LMDB_OK; ) {
+        lmdb_read_value(&data, &ctx->buf, &ctx->size);
+        if (ctx->w->out)
+            sink_record(ctx->w->out, key.mv_data, key.mv_size, data.mv_data, data.mv_size);
+        if (++i == len)
+            break;
+        rc = mdb_cursor_get(ctx->cur, &key, &data, MDB_NEXT);
+    }
+    mdb_txn_reset(ctx->rtxn);
+
+    if (rc != LMDB_OK && rc != MDB_NOTFOUND)
+        lmdb_error(rc, "Error scanning from key %lu", k);
+    return i;
+}
+
+static const struct kv_ops lmdb_kv_ops = {
+    lmdb_kv_open,
+    lmdb_kv_close,
+    lmdb_kv_read,
+    lmdb_kv_write,
+    lmdb_kv_write,
+    lmdb_kv_scan
+};
+
+void lmdb_workload(struct workload *wl, unsigned long n)
+{
+    workload_run(wl, n, &lmdb_kv_ops);
+}
+
+/*
+ * -C, before opening. LMDB has no cache of its own, the map is backed by
+ * the OS page cache, so evicting or reading in the files is all it takes.
+ */
+void lmdb_cache_files(void)
+{
+    struct phase ph;
+
+    if (cache_state() == CACHE_ASIS)
+        return;
+
+    phase_begin(&ph, cache_state() == CACHE_COLD ? "evict" : "preread");
+    cache_dir(LMDB_ENV_DIRECTORY);
+    phase_end(&ph);
+    cache_report();
+}
+
+void lmdb_open(void)
+{
+    unsigned int flags = MDB_NOTLS;
+    struct stat sb;
+    MDB_txn *txn;
+    int major, minor, patch, rc;
+
+    if (stat(LMDB_ENV_DIRECTORY, &sb) != 0 && mkdir(LMDB_ENV_DIRECTORY, S_IRWXU) != 0)
+        lmdb_error(errno, "mkdir %s failed", LMDB_ENV_DIRECTORY);
+
+    results_version("lmdb", "%s", mdb_version(&major, &minor, &patch));
+
+    if ((rc = mdb_env_create(&env)) != LMDB_OK)
+        lmdb_error(rc, "Couldn't create environment");
+    if ((rc = mdb_env_set_mapsize(env, lmdb_mapsize)) != LMDB_OK)
+        lmdb_error(rc, "Couldn't set map size to %lu MB",
+                   (unsigned long)(lmdb_mapsize / (1024 * 1024)));
+    /* Every worker of every process, and the warm-up's, holds a read transaction */
+    if ((rc = mdb_env_set_maxreaders(env, procs_count() * nthreads + 8)) != LMDB_OK)
+        lmdb_error(rc, "Couldn't set the number of readers");
+
+    if (lmdb_nosync)
+        flags |= MDB_NOSYNC;
+    if (lmdb_nometasync)
+        flags |= MDB_NOMETASYNC;
+    if (lmdb_writemap)
+        flags |= MDB_WRITEMAP;
+    rc = mdb_env_open(env, LMDB_ENV_DIRECTORY, flags, S_IRUSR | S_IWUSR);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "mdb_env_open: %s", LMDB_ENV_DIRECTORY);
+
+    /* Native keys are host order integers, MDB_INTEGERKEY sorts them as such */
+    txn = lmdb_begin(0);
+    rc = mdb_dbi_open(txn, NULL, MDB_CREATE | (key_type() == KEY_NATIVE ? MDB_INTEGERKEY : 0), &dbi);
+    if (rc != LMDB_OK)
+        lmdb_error(rc, "Couldn't open the database");
+    lmdb_commit(txn);
+
+    bench_counters(lmdb_sample);
+}
+
+/* What nosync put off is written out here, so that close shows its cost */
+void lmdb_close(void)
+{
+    int rc;
+
+    bench_counters(NULL);
+
+    if ((lmdb_nosync || lmdb_nometasync) && (rc = mdb_env_sync(env, 1)) != LMDB_OK)
+        lmdb_error(rc, "Couldn't sync environment %s", LMDB_ENV_DIRECTORY);
+    mdb_dbi_close(env, dbi);
+    mdb_env_close(env);
+}
@@ -0,0 +1,21 @@
+#ifndef LMDB_H
+#define LMDB_H
+
+#include "workload.h"
+
+#define LMDB_ENV_DIRECTORY "lmdb"
+#define LMDB_MAPSIZE (1024UL * 1024 * 1024)    /* default, bytes */
+
+extern void lmdb_open(void);
+extern void lmdb_close(void);
+extern void lmdb_cache_files(void);
+extern void lmdb_dump(void);
+extern void lmdb_get(unsigned long n);
+extern void lmdb_populate(unsigned long n, unsigned long txnsize);
+extern void lmdb_delete(unsigned long txnsize);
+extern void lmdb_workload(struct workload *wl, unsigned long n);
+extern int lmdb_parse_opts(char *spec);
+extern void lmdb_print_opts(void);
+extern void lmdb_print_stats(void);
+
+#endif
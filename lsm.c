@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <leveldb/c.h>
+#include "dbrace.h"
+#include "bench.h"
+#include "worker.h"
+#include "workload.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
+#include "sink.h"
+#include "delete.h"
+#include "stage.h"
+#include "lsm.h"
+
+#define LSM_LEVELS 7            /* config::kNumLevels */
+
+static leveldb_t *db;
+static leveldb_options_t *options;
+static leveldb_cache_t *block_cache;
+static leveldb_filterpolicy_t *filter;
+static leveldb_readoptions_t *ropts;
+static leveldb_writeoptions_t *wopts;
+
+/* -G options */
+static unsigned long lsm_wbuf = LSM_WRITE_BUFFER_MB;    /* MB */
+static int lsm_compress = 1;        /* snappy, if LevelDB was built with it */
+static int lsm_sync = 0;            /* every write fsyncs the log */
+static int lsm_bloom = 0;           /* bloom filter bits per key, 0: none */
+
+/*
+ * Key and value bytes handed to LevelDB since the open, which is what
+ * the log is written with. Workers add theirs up when they are done.
+ */
+static pthread_mutex_t lsm_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long lsm_put_bytes;
+
+/* A row of the "leveldb.stats" compaction table */
+struct lsm_level {
+    int files;
+    double size, secs, read, written;   /* MB, s */
+};
+
+static void lsm_error(char *err, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, ": %s\n", err ? err : "unknown error");
+    va_end(ap);
+    exit(2);
+}
+
+int lsm_parse_opts(char *spec)
+{
+    char *const tokens[] = { "wbuf", "nocompress", "sync", "bloom", NULL };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            if (value == NULL || (lsm_wbuf = strtoul(value, NULL, 0)) == 0)
+                return -1;
+            break;
+        case 1:
+            lsm_compress = 0;
+            break;
+        case 2:
+            lsm_sync = 1;
+            break;
+        case 3:
+            if (value == NULL || (lsm_bloom = atoi(value)) < 1)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void lsm_print_opts(void)
+{
+    printf("Write buffer: %lu MB, compression %s, log writes %s", lsm_wbuf,
+           lsm_compress ? "snappy" : "off", lsm_sync ? "sync" : "async");
+    if (lsm_bloom)
+        printf(", bloom filter %d bits/key", lsm_bloom);
+    printf("\n");
+    results_option("lsm_write_buffer_mb", "%lu", lsm_wbuf);
+    results_option("lsm_compression", "%d", lsm_compress);
+    results_option("lsm_sync", "%d", lsm_sync);
+    results_option("lsm_bloom_bits", "%d", lsm_bloom);
+}
+
+static void lsm_account(unsigned long long bytes)
+{
+    pthread_mutex_lock(&lsm_lock);
+    lsm_put_bytes += bytes;
+    pthread_mutex_unlock(&lsm_lock);
+}
+
+/*
+ * Parse the per-level table of "leveldb.stats". LevelDB keeps the
+ * compaction work of the open in it, memtable flushes included, in
+ * whole MB only.
+ */
+static void lsm_levels(struct lsm_level *lv)
+{
+    char *stats, *line, *next;
+    struct lsm_level l;
+    int level;
+
+    memset(lv, 0, LSM_LEVELS * sizeof(*lv));
+    if ((stats = leveldb_property_value(db, "leveldb.stats")) == NULL)
+        return;
+    for (line = stats; line; line = next) {
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        if (sscanf(line, "%d %d %lf %lf %lf %lf", &level, &l.files, &l.size,
+                   &l.secs, &l.read, &l.written) == 6 && level >= 0 && level < LSM_LEVELS)
+            lv[level] = l;
+    }
+    leveldb_free(stats);
+}
+
+/* Compaction work and the shape of the tree */
+static void lsm_sample(struct counters *c, int begin)
+{
+    struct lsm_level lv[LSM_LEVELS], sum;
+    unsigned long long put;
+    int i;
+
+    (void)begin;
+    lsm_levels(lv);
+    memset(&sum, 0, sizeof(sum));
+    for (i = 0; i < LSM_LEVELS; i++) {
+        sum.files += lv[i].files;
+        sum.size += lv[i].size;
+        sum.secs += lv[i].secs;
+        sum.read += lv[i].read;
+        sum.written += lv[i].written;
+    }
+    pthread_mutex_lock(&lsm_lock);
+    put = lsm_put_bytes;
+    pthread_mutex_unlock(&lsm_lock);
+
+    counters_add(c, "put_kb", put / 1024, 0);
+    counters_add(c, "compact_read_mb", sum.read, 0);
+    counters_add(c, "compact_write_mb", sum.written, 0);
+    counters_add(c, "compact_ms", sum.secs * 1000, 0);
+    counters_add(c, "l0_files", lv[0].files, 1);
+    counters_add(c, "sst_files", sum.files, 1);
+    counters_add(c, "sst_mb", sum.size, 1);
+}
+
+static unsigned long long lsm_disk_bytes(void)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat sb;
+    char path[PATH_MAX];
+    unsigned long long bytes = 0;
+
+    if ((d = opendir(LSM_DIRECTORY)) == NULL)
+        return 0;
+    while ((de = readdir(d)) != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", LSM_DIRECTORY, de->d_name);
+        if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+            bytes += sb.st_size;
+    }
+    closedir(d);
+    return bytes;
+}
+
+/*
+ * Write amplification counts the log as the bytes put and adds what
+ * flushes and compactions wrote; space amplification compares the files
+ * with the key and value bytes a scan of the live records finds.
+ */
+void lsm_print_stats(void)
+{
+    struct lsm_level lv[LSM_LEVELS];
+    leveldb_readoptions_t *scan;
+    leveldb_iterator_t *it;
+    unsigned long entries = 0;
+    unsigned long long live = 0, disk, put;
+    double read = 0, written = 0, secs = 0, mb = 1024.0 * 1024;
+    size_t klen, vlen;
+    char *err = NULL;
+    int i;
+
+    lsm_levels(lv);
+    printf("Levels:");
+    for (i = 0; i < LSM_LEVELS; i++) {
+        if (lv[i].files)
+            printf(" L%d %d files %.0f MB", i, lv[i].files, lv[i].size);
+        read += lv[i].read;
+        written += lv[i].written;
+        secs += lv[i].secs;
+    }
+    printf("\nCompactions: %.0f MB read, %.0f MB written, %.0f s\n", read, written, secs);
+
+    scan = leveldb_readoptions_create();
+    leveldb_readoptions_set_fill_cache(scan, 0);
+    it = leveldb_create_iterator(db, scan);
+    for (leveldb_iter_seek_to_first(it); leveldb_iter_valid(it); leveldb_iter_next(it)) {
+        leveldb_iter_key(it, &klen);
+        leveldb_iter_value(it, &vlen);
+        live += klen + vlen;
+        entries++;
+    }
+    leveldb_iter_get_error(it, &err);
+    if (err)
+        lsm_error(err, "Error iterating over the database");
+    leveldb_iter_destroy(it);
+    leveldb_readoptions_destroy(scan);
+
+    disk = lsm_disk_bytes();
+    put = lsm_put_bytes;
+    if (put)
+        printf("Write amplification: %.2f (%.1f MB put)\n", (put + written * mb) / put, put / mb);
+    if (live)
+        printf("Space amplification: %.2f (%.1f MB on disk for %lu entries of %.1f MB)\n",
+               (double)disk / live, disk / mb, entries, live / mb);
+
+    results_metric("lsm_entries", "%lu", entries);
+    results_metric("lsm_l0_files", "%d", lv[0].files);
+    results_metric("lsm_compact_read_mb", "%.0f", read);
+    results_metric("lsm_compact_write_mb", "%.0f", written);
+    results_metric("lsm_put_bytes", "%llu", put);
+    results_metric("lsm_live_bytes", "%llu", live);
+    results_metric("lsm_disk_bytes", "%llu", disk);
+    if (put)
+        results_metric("lsm_write_amp", "%.3f", (put + written * mb) / put);
+    if (live)
+        results_metric("lsm_space_amp", "%.3f", (double)disk / live);
+}
+
+void lsm_dump(void)
+{
+    leveldb_iterator_t *it;
+    const char *k, *v;
+    size_t klen, vlen;
+    struct phase ph;
+    uint64_t t0;
+    char *err = NULL;
+    struct sink *out = print ? sink_new() : NULL;
+
+    it = leveldb_create_iterator(db, ropts);
+
+    phase_begin(&ph, "dump");
+
+    t0 = bench_now();
+    for (leveldb_iter_seek_to_first(it); leveldb_iter_valid(it); leveldb_iter_next(it)) {
+        k = leveldb_iter_key(it, &klen);
+        v = leveldb_iter_value(it, &vlen);
+        phase_op(&ph, t0);
+        if (out)
+            sink_record(out, k, klen, v, vlen);
+        t0 = bench_now();
+    }
+
+    sink_free(out);
+    phase_end(&ph);
+
+    leveldb_iter_get_error(it, &err);
+    if (err)
+        lsm_error(err, "Error iterating over the database");
+    leveldb_iter_destroy(it);
+}
+
+/* Fetch the odd keys of the slice, then the even ones */
+static void lsm_get_worker(struct worker *w)
+{
+    int pass;
+    unsigned long i;
+    unsigned char kbuf[KEY_MAX];
+    size_t klen, vlen;
+    char *value, *err = NULL;
+    uint64_t t0;
+
+    worker_begin(w);
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = w->first + ((w->first + pass + 1) & 1); i < w->last; i+=2) {
+            t0 = bench_now();
+            klen = key_encode(i, kbuf);
+            /* The C API hands back a malloc()ed copy of the value */
+            value = leveldb_get(db, ropts, (char *)kbuf, klen, &vlen, &err);
+            if (err)
+                lsm_error(err, "Error fetching key %lu", i);
+            if (value == NULL)
+                lsm_error("not found", "Error fetching key %lu", i);
+            if (w->out)
+                sink_record(w->out, kbuf, klen, value, vlen);
+            leveldb_free(value);
+            phase_op(&w->ph, t0);
+        }
+    }
+
+    worker_end(w);
+}
+
+static const struct kv_ops lsm_kv_ops;
+
+void lsm_get(unsigned long n)
+{
+    workload_warmup(NULL, n, &lsm_kv_ops);
+    workers_run("get", 1, n, lsm_get_worker, NULL);
+}
+
+/*
+ * With -t the puts of a worker go to LevelDB in WriteBatches of that
+ * many records, one log write each; otherwise every put is its own write.
+ */
+struct lsm_args {
+    unsigned long txnsize;
+};
+
+static void lsm_write(leveldb_writebatch_t *batch)
+{
+    char *err = NULL;
+
+    leveldb_write(db, wopts, batch, &err);
+    if (err)
+        lsm_error(err, "Couldn't write batch");
+    leveldb_writebatch_clear(batch);
+}
+
+static void lsm_populate_worker(struct worker *w)
+{
+    struct lsm_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    leveldb_writebatch_t *batch = NULL;
+    unsigned long i, inbatch = 0;
+    unsigned long long bytes = 0;
+    unsigned char kbuf[KEY_MAX];
+    const char *value;
+    size_t klen, vlen;
+    char *err = NULL;
+    uint64_t t0;
+
+    if (txnsize > 1)
+        batch = leveldb_writebatch_create();
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        STAGE_START();
+        klen = key_encode(key_order(i), kbuf);
+        value = value_next(&w->rng, &vlen);
+        STAGE_END(STAGE_GENERATE);
+        if (batch) {
+            /* Into the batch; the log and memtable see it at the commit */
+            leveldb_writebatch_put(batch, (char *)kbuf, klen, value, vlen);
+            STAGE_END(STAGE_PUT);
+            if (++inbatch == txnsize) {
+                lsm_write(batch);
+                STAGE_END(STAGE_COMMIT);
+                inbatch = 0;
+            }
+        } else {
+            leveldb_put(db, wopts, (char *)kbuf, klen, value, vlen, &err);
+            if (err)
+                lsm_error(err, "Couldn't insert key %lu", key_order(i));
+            STAGE_END(STAGE_PUT);
+        }
+        bytes += klen + vlen;
+        phase_op(&w->ph, t0);
+    }
+    if (inbatch)
+        lsm_write(batch);
+
+    worker_end(w);
+
+    if (batch)
+        leveldb_writebatch_destroy(batch);
+    lsm_account(bytes);
+}
+
+void lsm_populate(unsigned long n, unsigned long txnsize)
+{
+    struct lsm_args args;
+
+    args.txnsize = txnsize;
+    workers_run("populate", 1, n, lsm_populate_worker, &args);
+}
+
+/* Deletes put a tombstone each, batched like populate's puts */
+static void lsm_delete_worker(struct worker *w)
+{
+    struct lsm_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    leveldb_writebatch_t *batch = NULL;
+    unsigned long i, inbatch = 0;
+    unsigned long long bytes = 0;
+    unsigned char kbuf[KEY_MAX];
+    size_t klen;
+    char *err = NULL;
+    uint64_t t0;
+
+    if (txnsize > 1)
+        batch = leveldb_writebatch_create();
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        klen = key_encode(delete_key(i), kbuf);
+        if (batch) {
+            leveldb_writebatch_delete(batch, (char *)kbuf, klen);
+            if (++inbatch == txnsize) {
+                lsm_write(batch);
+                inbatch = 0;
+            }
+        } else {
+            leveldb_delete(db, wopts, (char *)kbuf, klen, &err);
+            if (err)
+                lsm_error(err, "Couldn't delete key %lu", delete_key(i));
+        }
+        bytes += klen;
+        phase_op(&w->ph, t0);
+    }
+    if (inbatch)
+        lsm_write(batch);
+
+    worker_end(w);
+
+    if (batch)
+        leveldb_writebatch_destroy(batch);
+    lsm_account(bytes);
+}
+
+void lsm_delete(unsigned long txnsize)
+{
+    struct lsm_args args;
+
+    args.txnsize = txnsize;
+    workers_run("delete", 0, delete_count(), lsm_delete_worker, &args);
+}
+
+/*
+ * A manual compaction of the whole key range merges every level down to
+ * the last one, dropping the tombstones and overwritten values on the way.
+ */
+void lsm_compact(void)
+{
+    struct phase ph;
+    uint64_t t0;
+
+    phase_begin(&ph, "compact");
+    t0 = bench_now();
+    leveldb_compact_range(db, NULL, 0, NULL, 0);
+    phase_op(&ph, t0);
+    phase_end(&ph);
+}
+
+/* Workload primitives, every write is a single put */
+struct lsm_ctx {
+    struct worker *w;
+    unsigned long long bytes;   /* put by this worker */
+};
+
+static void *lsm_kv_open(struct worker *w)
+{
+    struct lsm_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL)
+        lsm_error("out of memory", "Couldn't allocate workload context");
+    ctx->w = w;
+    return ctx;
+}
+
+static void lsm_kv_close(void *arg)
+{
+    struct lsm_ctx *ctx = arg;
+
+    lsm_account(ctx->bytes);
+    free(ctx);
+}
+
+static int lsm_kv_read(void *arg, unsigned long k)
+{
+    struct lsm_ctx *ctx = arg;
+    unsigned char kbuf[KEY_MAX];
+    size_t klen, vlen;
+    char *value, *err = NULL;
+
+    klen = key_encode(k, kbuf);
+    value = leveldb_get(db, ropts, (char *)kbuf, klen, &vlen, &err);
+    if (err)
+        lsm_error(err, "Error fetching key %lu", k);
+    if (value == NULL)
+        return 1;
+    if (ctx->w->out)
+        sink_record(ctx->w->out, kbuf, klen, value, vlen);
+    leveldb_free(value);
+    return 0;
+}
+
+static int lsm_kv_write(void *arg, unsigned long k)
+{
+    struct lsm_ctx *ctx = arg;
+    unsigned char kbuf[KEY_MAX];
+    const char *value;
+    size_t klen, vlen;
+    char *err = NULL;
+
+    klen = key_encode(k, kbuf);
+    value = value_next(&ctx->w->rng, &vlen);
+    leveldb_put(db, wopts, (char *)kbuf, klen, value, vlen, &err);
+    if (err)
+        lsm_error(err, "Couldn't write key %lu", k);
+    ctx->bytes += klen + vlen;
+    return 0;
+}
+
+/* Seek to the first key >= k, then step; the iterator reads a snapshot */
+static unsigned long lsm_kv_scan(void *arg, unsigned long k, unsigned long len)
+{
+    struct lsm_ctx *ctx = arg;
+    leveldb_iterator_t *it;
+    unsigned char kbuf[KEY_MAX];
+    const char *key, *value;
+    size_t klen, vlen;
+    unsigned long i = 0;
+    char *err = NULL;
+
+    it = leveldb_create_iterator(db, ropts);
+    klen = key_encode(k, kbuf);
+    for (leveldb_iter_seek(it, (char *)kbuf, klen); leveldb_iter_valid(it) && i < len;
+         leveldb_iter_next(it)) {
+        key = leveldb_iter_key(it, &klen);
+        value = leveldb_iter_value(it, &vlen);
+        if (ctx->w->out)
+            sink_record(ctx->w->out, key, klen, value, vlen);
+        i++;
+    }
+    leveldb_iter_get_error(it, &err);
+    if (err)
+        lsm_error(err, "Error scanning from key %lu", k);
+    leveldb_iter_destroy(it);
+    return i;
+}
+
+static const struct kv_ops lsm_kv_ops = {
+    lsm_kv_open,
+    lsm_kv_close,
+    lsm_kv_read,
+    lsm_kv_write,
+    lsm_kv_write,
+    lsm_kv_scan
+};
+
+void lsm_workload(struct workload *wl, unsigned long n)
+{
+    workload_run(wl, n, &lsm_kv_ops);
+}
+
+/* -C, before opening */
+void lsm_cache_files(void)
+{
+    struct phase ph;
+
+    if (cache_state() == CACHE_ASIS)
+        return;
+
+    phase_begin(&ph, cache_state() == CACHE_COLD ? "evict" : "preread");
+    cache_dir(LSM_DIRECTORY);
+    phase_end(&ph);
+    cache_report();
+}
+
+/* -C warm, after opening: pull every block through the block cache */
+void lsm_preload(void)
+{
+    leveldb_iterator_t *it;
+    struct phase ph;
+    uint64_t t0;
+    char *err = NULL;
+
+    if (cache_state() != CACHE_WARM)
+        return;
+
+    it = leveldb_create_iterator(db, ropts);
+
+    phase_begin(&ph, "preload");
+    t0 = bench_now();
+    for (leveldb_iter_seek_to_first(it); leveldb_iter_valid(it); leveldb_iter_next(it)) {
+        phase_op(&ph, t0);
+        t0 = bench_now();
+    }
+    phase_end(&ph);
+
+    leveldb_iter_get_error(it, &err);
+    if (err)
+        lsm_error(err, "Error iterating over the database");
+    leveldb_iter_destroy(it);
+}
+
+void lsm_open(unsigned long cachebytes)
+{
+    char *err = NULL;
+
+    results_version("leveldb", "%d.%d", leveldb_major_version(), leveldb_minor_version());
+
+    options = leveldb_options_create();
+    leveldb_options_set_create_if_missing(options, 1);
+    block_cache = leveldb_cache_create_lru(cachebytes);
+    leveldb_options_set_cache(options, block_cache);
+    leveldb_options_set_write_buffer_size(options, lsm_wbuf * 1024 * 1024);
+    leveldb_options_set_compression(options, lsm_compress ? leveldb_snappy_compression
+                                                          : leveldb_no_compression);
+    if (lsm_bloom) {
+        filter = leveldb_filterpolicy_create_bloom(lsm_bloom);
+        leveldb_options_set_filter_policy(options, filter);
+    }
+
+    ropts = leveldb_readoptions_create();
+    wopts = leveldb_writeoptions_create();
+    leveldb_writeoptions_set_sync(wopts, lsm_sync);
+
+    db = leveldb_open(options, LSM_DIRECTORY, &err);
+    if (err)
+        lsm_error(err, "leveldb_open: %s", LSM_DIRECTORY);
+
+    lsm_put_bytes = 0;
+    bench_counters(lsm_sample);
+}
+
+/* Closing waits for a running compaction to finish */
+void lsm_close(void)
+{
+    bench_counters(NULL);
+
+    leveldb_close(db);
+    leveldb_writeoptions_destroy(wopts);
+    leveldb_readoptions_destroy(ropts);
+    leveldb_options_destroy(options);
+    if (filter)
+        leveldb_filterpolicy_destroy(filter);
+    leveldb_cache_destroy(block_cache);
+}
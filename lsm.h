@@ -0,0 +1,24 @@
+#ifndef LSM_H
+#define LSM_H
+
+#include "workload.h"
+
+#define LSM_DIRECTORY "leveldb"
+#define LSM_CACHE_MB 8              /* default block cache */
+#define LSM_WRITE_BUFFER_MB 4       /* default memtable size */
+
+extern void lsm_open(unsigned long cachebytes);
+extern void lsm_close(void);
+extern void lsm_cache_files(void);
+extern void lsm_preload(void);
+extern void lsm_dump(void);
+extern void lsm_get(unsigned long n);
+extern void lsm_populate(unsigned long n, unsigned long txnsize);
+extern void lsm_delete(unsigned long txnsize);
+extern void lsm_compact(void);
+extern void lsm_workload(struct workload *wl, unsigned long n);
+extern int lsm_parse_opts(char *spec);
+extern void lsm_print_opts(void);
+extern void lsm_print_stats(void);
+
+#endif
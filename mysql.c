@@ -9,6 +9,15 @@
 #include <fcntl.h>
 
 #include "dbrace.h"
+#include "bench.h"
+#include "worker.h"
+#include "workload.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
+#include "sink.h"
+#include "secondary.h"
 #include "mysql.h"
 
 #include <my_global.h>
@@ -16,109 +25,1112 @@
 
 static MYSQL *con;
 
-static void exit_error(void)
+/* -M options */
+static int mysql_prepared = 0;  /* binary protocol prepared statements */
+static int mysql_rows = 1;      /* rows per INSERT statement */
+static int mysql_pipeline = 1;  /* lookups in flight per connection */
+
+/* Connection parameters, kept for worker threads opening their own */
+static char *host, *user, *pw, *dbname;
+
+static void exit_error(MYSQL *c)
 {
-    fprintf(stderr, "%s\n", con ? mysql_error(con) : "Couldn't initialize MySQL library");
-    if (con)
-        mysql_close(con);
+    fprintf(stderr, "%s\n", c ? mysql_error(c) : "Couldn't initialize MySQL library");
+    if (c)
+        mysql_close(c);
     exit(1);        
 }
 
+static pthread_mutex_t version_lock = PTHREAD_MUTEX_INITIALIZER;
+static int version_recorded;
+
+static MYSQL *mysql_connect(void)
+{
+    MYSQL *c;
+
+    if ((c = mysql_init(NULL)) == NULL)
+        exit_error(c);
+
+    if (mysql_real_connect(c, host, user, pw, dbname, 0, NULL,
+                           mysql_pipeline > 1 ? CLIENT_MULTI_STATEMENTS : 0) == NULL)
+        exit_error(c);
+
+    /* Workers connect concurrently, the first one records the versions */
+    pthread_mutex_lock(&version_lock);
+    if (!version_recorded) {
+        results_version("mysql_client", "%s", mysql_get_client_info());
+        results_version("mysql_server", "%s", mysql_get_server_info(c));
+        version_recorded = 1;
+    }
+    pthread_mutex_unlock(&version_lock);
+
+    return c;
+}
+
+/*
+ * Server counters for every phase. The worker sessions are gone by the
+ * time a phase is reported, so these are the GLOBAL counters, read over
+ * a connection of our own: other clients of the server count too, and
+ * so do a few Handler_write of each SHOW STATUS.
+ */
+static const char *mysql_status_vars[] = {
+    "Handler_read_key", "Handler_read_next", "Handler_write", "Handler_update",
+    "Handler_commit", "Innodb_buffer_pool_read_requests", "Innodb_buffer_pool_reads",
+    "Innodb_buffer_pool_pages_flushed", "Innodb_data_fsyncs", "Innodb_os_log_written",
+    "Innodb_log_waits", "Innodb_row_lock_waits", "Innodb_row_lock_time"
+};
+#define MYSQL_STATUS_VARS (sizeof(mysql_status_vars) / sizeof(mysql_status_vars[0]))
+
+static MYSQL *stats_con;
+
+static void mysql_sample(struct counters *c, int begin)
+{
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    uint64_t v[MYSQL_STATUS_VARS] = { 0 };
+    size_t i;
+
+    (void)begin;
+    if (mysql_query(stats_con, "SHOW GLOBAL STATUS"))
+        exit_error(stats_con);
+    if ((result = mysql_store_result(stats_con)) == NULL)
+        exit_error(stats_con);
+    while ((row = mysql_fetch_row(result))) {
+        for (i = 0; i < MYSQL_STATUS_VARS; i++) {
+            if (row[0] && row[1] && strcmp(row[0], mysql_status_vars[i]) == 0) {
+                v[i] = strtoull(row[1], NULL, 10);
+                break;
+            }
+        }
+    }
+    mysql_free_result(result);
+
+    for (i = 0; i < MYSQL_STATUS_VARS; i++)
+        counters_add(c, mysql_status_vars[i], v[i], 0);
+}
+
+static void mysql_stats_begin(void)
+{
+    stats_con = mysql_connect();
+    bench_counters(mysql_sample);
+}
+
+static void mysql_stats_end(void)
+{
+    bench_counters(NULL);
+    mysql_close(stats_con);
+    stats_con = NULL;
+}
+
+/*
+ * -C for the reading actions. The files and the buffer pool are the
+ * server's, cold takes a server restart; warm reads the table through
+ * the buffer pool.
+ */
+static void mysql_cache(void)
+{
+    MYSQL_RES *result;
+    struct phase ph;
+
+    if (cache_state() == CACHE_COLD) {
+        fprintf(stderr, "%s: MySQL keeps its cache, restart the server for a cold run\n",
+                progname);
+        return;
+    }
+    if (cache_state() != CACHE_WARM)
+        return;
+
+    phase_begin(&ph, "preload");
+    if (mysql_query(stats_con, "SELECT COUNT(*), SUM(LENGTH(Value)) FROM dbrace"))
+        exit_error(stats_con);
+    if ((result = mysql_store_result(stats_con)) == NULL)
+        exit_error(stats_con);
+    mysql_free_result(result);
+    phase_end(&ph);
+}
+
 static void mysql_open(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db)
 {
-    if ((con = mysql_init(NULL)) == NULL)
-        exit_error();
+    host = mysql_host;
+    user = mysql_user;
+    pw = mysql_pw;
+    dbname = mysql_db;
 
-    if (mysql_real_connect(con, mysql_host, mysql_user, mysql_pw, mysql_db, 0, NULL, 0) == NULL)
-        exit_error();
+    con = mysql_connect();
+}
 
+int mysql_parse_opts(char *spec)
+{
+    char *const tokens[] = { "prepared", "rows", "pipeline", NULL };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            mysql_prepared = 1;
+            break;
+        case 1:
+            if (value == NULL || (mysql_rows = strtoul(value, NULL, 0)) < 1)
+                return -1;
+            break;
+        case 2:
+            if (value == NULL || (mysql_pipeline = strtoul(value, NULL, 0)) < 1)
+                return -1;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown MySQL option '%s'\n", progname, value);
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
-static void mysql_insert(unsigned long key, int random)
+void mysql_print_opts(void)
 {
-    int rc;
-    char data[256];
-    int dlen = 14, i;
-    char binbuf[1024], sqlbuf[2048];
+    printf("Statements: %s, %d row%s per INSERT\n",
+           mysql_prepared ? "prepared" : "text", mysql_rows, mysql_rows > 1 ? "s" : "");
+    if (mysql_pipeline > 1)
+        printf("Pipeline depth: %d\n", mysql_pipeline);
+    results_option("mysql_statements", "%s", mysql_prepared ? "prepared" : "text");
+    results_option("mysql_rows", "%d", mysql_rows);
+    results_option("mysql_pipeline", "%d", mysql_pipeline);
+}
 
-    if (random)
-        dlen = rand() % (255 - 1) + 1; /* 1 to 255 byte data */
+/* Longest key literal: X'<hex>' */
+#define MYSQL_KEY_SQL (2 * KEY_MAX + 4)
 
-    for (i = 0; i < dlen - 1; i++)
-        data[i] = (key + i) % (128 - 32) + 32;
-    data[i] = 0;
-    mysql_real_escape_string(con, binbuf, data, dlen);
+/*
+ * Key number key as an SQL literal. The integer encodings are stored in
+ * an INT column, strings and UUIDs in binary columns compared bytewise.
+ */
+static int mysql_key_sql(char *buf, unsigned long key)
+{
+    unsigned char kbuf[KEY_MAX];
+    size_t i, len;
+    int n;
 
-    snprintf(sqlbuf, 4095, "INSERT INTO dbrace VALUES(%lu, '%s')", key, binbuf);
+    switch (key_type()) {
+    case KEY_STRING:
+    case KEY_VARSTR:
+        len = key_encode(key, kbuf);
+        return sprintf(buf, "'%.*s'", (int)len, (char *)kbuf);
+    case KEY_UUID:
+        len = key_encode(key, kbuf);
+        n = sprintf(buf, "X'");
+        for (i = 0; i < len; i++)
+            n += sprintf(buf + n, "%02x", kbuf[i]);
+        buf[n++] = '\'';
+        buf[n] = '\0';
+        return n;
+    default:
+        return sprintf(buf, "%lu", key);
+    }
+}
 
-    if (mysql_query(con, sqlbuf))
-        exit_error();
+/*
+ * Bind a key parameter or Id result: the key number itself for the
+ * integer encodings, otherwise the encoded bytes in kbuf (KEY_MAX).
+ */
+static void mysql_bind_key(MYSQL_BIND *b, unsigned long long *key,
+                           unsigned char *kbuf, unsigned long *klen)
+{
+    memset(b, 0, sizeof(*b));
+    if (key_type() == KEY_NATIVE || key_type() == KEY_BE) {
+        b->buffer_type = MYSQL_TYPE_LONGLONG;
+        b->buffer = key;
+        b->is_unsigned = 1;
+    } else {
+        b->buffer_type = MYSQL_TYPE_BLOB;
+        b->buffer = kbuf;
+        b->buffer_length = KEY_MAX;
+        b->length = klen;
+    }
+}
+
+/* Room for a value fetched into a bound buffer, at least the VARCHAR(255) */
+static unsigned long mysql_value_size(void)
+{
+    return value_max() > 256 ? value_max() : 256;
+}
+
+/* The key of a text protocol row as key_encode() has it, for the sink */
+static const void *mysql_row_key(MYSQL_RES *result, MYSQL_ROW row, unsigned char *buf,
+                                 size_t *len)
+{
+    switch (key_type()) {
+    case KEY_NATIVE:
+    case KEY_BE:
+        *len = key_encode(strtoul(row[0], NULL, 10), buf);
+        return buf;
+    default:
+        *len = mysql_fetch_lengths(result)[0];
+        return row[0];
+    }
+}
+
+enum mysql_write_mode {
+    MYSQL_INSERT,
+    MYSQL_UPDATE,
+    MYSQL_REPLACE
+};
+
+/* Room for a statement carrying one value, every value byte escaped into two */
+static size_t mysql_sql_size(void)
+{
+    return 2 * value_max() + MYSQL_KEY_SQL + 128;
+}
+
+/*
+ * Write one row, either as a new record or over an existing one. The
+ * value is escaped from the arena straight into sqlbuf, which must hold
+ * mysql_sql_size() bytes.
+ */
+static int mysql_write(MYSQL *c, unsigned long key, uint64_t *rng,
+                       enum mysql_write_mode mode, char *sqlbuf)
+{
+    const char *data;
+    char keysql[MYSQL_KEY_SQL];
+    size_t dlen, len;
+
+    data = value_next(rng, &dlen);
+    mysql_key_sql(keysql, key);
+
+    if (mode == MYSQL_UPDATE)
+        len = sprintf(sqlbuf, "UPDATE dbrace SET Value='");
+    else
+        len = sprintf(sqlbuf, "%s INTO dbrace VALUES(%s, '",
+                      mode == MYSQL_REPLACE ? "REPLACE" : "INSERT", keysql);
+    len += mysql_real_escape_string(c, sqlbuf + len, data, dlen);
+    if (mode == MYSQL_UPDATE)
+        len += sprintf(sqlbuf + len, "' WHERE Id=%s", keysql);
+    else
+        len += sprintf(sqlbuf + len, "')");
+
+    return mysql_real_query(c, sqlbuf, len);
+}
+
+/*
+ * Rows buffered for one INSERT statement, the values stay in the arena.
+ * In text mode the statement is formatted into sql; in prepared mode the
+ * values are bound in binary form to a statement with rows placeholder
+ * pairs, the shorter tail batch gets its own statement.
+ */
+struct mysql_batch {
+    MYSQL *c;
+    int rows;                   /* rows per statement */
+    int count;                  /* rows buffered */
+    unsigned long long *keys;
+    unsigned char *kbufs;       /* rows * KEY_MAX, prepared non-integer keys */
+    unsigned long *klengths;
+    const char **values;
+    unsigned long *lengths;
+    MYSQL_BIND *bind;
+    MYSQL_STMT *stmt;
+    MYSQL_STMT *tail;
+    char *sql;
+    size_t sqlsize;
+};
+
+static MYSQL_STMT *mysql_prepare_insert(MYSQL *c, int rows)
+{
+    MYSQL_STMT *stmt;
+    char *sql;
+    size_t len;
+    int i;
+
+    sql = malloc(64 + rows * 8);
+    if (sql == NULL)
+        exit_error(c);
+    len = sprintf(sql, "INSERT INTO dbrace VALUES");
+    for (i = 0; i < rows; i++)
+        len += sprintf(sql + len, "%s(?,?)", i ? "," : "");
+
+    if ((stmt = mysql_stmt_init(c)) == NULL)
+        exit_error(c);
+    if (mysql_stmt_prepare(stmt, sql, len)) {
+        fprintf(stderr, "%s\n", mysql_stmt_error(stmt));
+        exit(1);
+    }
+    free(sql);
+
+    return stmt;
+}
+
+static void mysql_batch_init(struct mysql_batch *b, MYSQL *c)
+{
+    int i;
+
+    memset(b, 0, sizeof(*b));
+    b->c = c;
+    b->rows = mysql_rows;
+    b->keys = calloc(b->rows, sizeof(*b->keys));
+    b->values = calloc(b->rows, sizeof(*b->values));
+    b->lengths = calloc(b->rows, sizeof(*b->lengths));
+    if (b->keys == NULL || b->values == NULL || b->lengths == NULL)
+        exit_error(c);
+
+    if (mysql_prepared) {
+        b->bind = calloc(2 * b->rows, sizeof(*b->bind));
+        if (b->bind == NULL)
+            exit_error(c);
+        if (key_type() != KEY_NATIVE && key_type() != KEY_BE) {
+            b->kbufs = malloc((size_t)b->rows * KEY_MAX);
+            b->klengths = calloc(b->rows, sizeof(*b->klengths));
+            if (b->kbufs == NULL || b->klengths == NULL)
+                exit_error(c);
+        }
+        for (i = 0; i < b->rows; i++) {
+            if (b->kbufs == NULL) {
+                b->bind[2 * i].buffer_type = MYSQL_TYPE_LONGLONG;
+                b->bind[2 * i].buffer = &b->keys[i];
+                b->bind[2 * i].is_unsigned = 1;
+            } else {
+                b->bind[2 * i].buffer_type = MYSQL_TYPE_BLOB;
+                b->bind[2 * i].buffer = b->kbufs + (size_t)i * KEY_MAX;
+                b->bind[2 * i].buffer_length = KEY_MAX;
+                b->bind[2 * i].length = &b->klengths[i];
+            }
+            b->bind[2 * i + 1].buffer_type = MYSQL_TYPE_BLOB;
+            b->bind[2 * i + 1].length = &b->lengths[i];
+        }
+        b->stmt = mysql_prepare_insert(c, b->rows);
+    } else {
+        /* Worst case every value byte is escaped into two */
+        b->sqlsize = 64 + (size_t)b->rows * (2 * value_max() + MYSQL_KEY_SQL + 32);
+        b->sql = malloc(b->sqlsize);
+        if (b->sql == NULL)
+            exit_error(c);
+    }
+}
+
+static void mysql_batch_flush(struct mysql_batch *b)
+{
+    MYSQL_STMT *stmt = b->stmt;
+    size_t len;
+    int i;
+
+    if (b->count == 0)
+        return;
+
+    if (mysql_prepared) {
+        if (b->count < b->rows) {
+            /* The binds of the leading rows are reused for the tail */
+            if (b->tail)
+                mysql_stmt_close(b->tail);
+            b->tail = stmt = mysql_prepare_insert(b->c, b->count);
+        }
+        /* The value buffers moved, binding only updates the client side */
+        for (i = 0; i < b->count; i++) {
+            b->bind[2 * i + 1].buffer = (void *)b->values[i];
+            b->bind[2 * i + 1].buffer_length = b->lengths[i];
+        }
+        if (mysql_stmt_bind_param(stmt, b->bind)) {
+            fprintf(stderr, "%s\n", mysql_stmt_error(stmt));
+            exit(1);
+        }
+        if (mysql_stmt_execute(stmt)) {
+            fprintf(stderr, "%s\n", mysql_stmt_error(stmt));
+            exit(1);
+        }
+    } else {
+        len = sprintf(b->sql, "INSERT INTO dbrace VALUES");
+        for (i = 0; i < b->count; i++) {
+            len += sprintf(b->sql + len, "%s(", i ? "," : "");
+            len += mysql_key_sql(b->sql + len, b->keys[i]);
+            len += sprintf(b->sql + len, ",'");
+            len += mysql_real_escape_string(b->c, b->sql + len,
+                                            b->values[i], b->lengths[i]);
+            b->sql[len++] = '\'';
+            b->sql[len++] = ')';
+        }
+        if (mysql_real_query(b->c, b->sql, len))
+            exit_error(b->c);
+    }
+
+    b->count = 0;
+}
+
+/* Buffer a row, the statement goes out once the batch is full */
+static void mysql_batch_add(struct mysql_batch *b, unsigned long key, uint64_t *rng)
+{
+    size_t len;
+
+    b->keys[b->count] = key;
+    if (b->kbufs)
+        b->klengths[b->count] = key_encode(key, b->kbufs + (size_t)b->count * KEY_MAX);
+    b->values[b->count] = value_next(rng, &len);
+    b->lengths[b->count] = len;
+    if (++b->count == b->rows)
+        mysql_batch_flush(b);
+}
+
+static void mysql_batch_free(struct mysql_batch *b)
+{
+    if (b->stmt)
+        mysql_stmt_close(b->stmt);
+    if (b->tail)
+        mysql_stmt_close(b->tail);
+    free(b->keys);
+    free(b->kbufs);
+    free(b->klengths);
+    free(b->values);
+    free(b->lengths);
+    free(b->bind);
+    free(b->sql);
+}
+
+struct mysql_args {
+    unsigned long txnsize;
+};
+
+/*
+ * Rows are grouped into statements of mysql_rows rows and, with -t, into
+ * explicit transactions of txnsize rows. A transaction always ends on a
+ * statement boundary, so it may run over by less than one statement.
+ */
+static void mysql_populate_worker(struct worker *w)
+{
+    struct mysql_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
+    unsigned long i, pending = 0;
+    struct mysql_batch batch;
+    MYSQL *c;
+    uint64_t t0;
+
+    mysql_thread_init();
+    c = mysql_connect();
+    mysql_batch_init(&batch, c);
+
+    worker_begin(w);
+
+    if (txnsize > 1 && mysql_query(c, "BEGIN"))
+        exit_error(c);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        mysql_batch_add(&batch, key_order(i), &w->rng);
+        if (txnsize > 1 && ++pending >= txnsize && batch.count == 0) {
+            if (mysql_query(c, "COMMIT") || mysql_query(c, "BEGIN"))
+                exit_error(c);
+            pending = 0;
+        }
+        phase_op(&w->ph, t0);
+    }
+
+    mysql_batch_flush(&batch);
+    if (txnsize > 1 && mysql_query(c, "COMMIT"))
+        exit_error(c);
+
+    worker_end(w);
+
+    mysql_batch_free(&batch);
+    mysql_close(c);
+    mysql_thread_end();
 }
 
 void mysql_populate(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
-                    unsigned long n, unsigned long txnsize, int random)
+                    unsigned long n, unsigned long txnsize)
 {
+    struct phase ph;
+    struct mysql_args args;
+    char sqlbuf[128], idtype[32];
+
+    if (mysql_library_init(0, NULL, NULL))
+        exit_error(NULL);
+
+    phase_begin(&ph, "open");
+
     mysql_open(mysql_host, mysql_user, mysql_pw, mysql_db);
 
     if (mysql_query(con, "DROP TABLE IF EXISTS dbrace"))
-        exit_error();
+        exit_error(con);
 
-    if (mysql_query(con, "CREATE TABLE dbrace(Id INT PRIMARY KEY,Value VARCHAR(255))"))
-        exit_error();
+    switch (key_type()) {
+    case KEY_STRING:
+    case KEY_VARSTR:
+        snprintf(idtype, sizeof(idtype), "VARBINARY(%d)", KEY_MAX);
+        break;
+    case KEY_UUID:
+        snprintf(idtype, sizeof(idtype), "BINARY(16)");
+        break;
+    default:
+        snprintf(idtype, sizeof(idtype), "INT");
+        break;
+    }
+
+    /* Values past what VARCHAR(255) holds need max_allowed_packet to match */
+    snprintf(sqlbuf, sizeof(sqlbuf), "CREATE TABLE dbrace(Id %s PRIMARY KEY,Value %s)",
+             idtype, value_max() <= 255 ? "VARCHAR(255)" : "LONGBLOB");
+    if (mysql_query(con, sqlbuf))
+        exit_error(con);
 
-    for (unsigned long i = 1; i < n; i++) {
-        mysql_insert(i, random);
+    /* A prefix index, which a LONGBLOB can't do without anyway */
+    if (secondary_prefix()) {
+        snprintf(sqlbuf, sizeof(sqlbuf), "CREATE INDEX dbrace_value ON dbrace(Value(%lu))",
+                 (unsigned long)secondary_prefix());
+        if (mysql_query(con, sqlbuf))
+            exit_error(con);
     }
 
     mysql_close(con);
+    mysql_stats_begin();
+
+    phase_end(&ph);
+
+    args.txnsize = txnsize;
+    workers_run("populate", 1, n, mysql_populate_worker, &args);
+
+    mysql_stats_end();
+    mysql_library_end();
 }
 
-void mysql_get(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
-               unsigned long n)
+/* One text SELECT per key */
+static void mysql_get_text(struct worker *w, MYSQL *c)
 {
     MYSQL_RES *result = NULL;
     MYSQL_ROW row;
-    char sqlbuf[1024];
-
-    mysql_open(mysql_host, mysql_user, mysql_pw, mysql_db);
+    char sqlbuf[1024], keysql[MYSQL_KEY_SQL];
+    unsigned char kbuf[KEY_MAX];
+    uint64_t t0;
 
-    for (unsigned long i = 1; i <= n; i++) {
-        snprintf(sqlbuf, 1023, "SELECT Value FROM dbrace WHERE Id=%lu", i);
-        if (mysql_query(con, sqlbuf))
-            exit_error();
+    for (unsigned long i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        mysql_key_sql(keysql, i);
+        snprintf(sqlbuf, sizeof(sqlbuf), "SELECT Value FROM dbrace WHERE Id=%s", keysql);
+        if (mysql_query(c, sqlbuf))
+            exit_error(c);
 
-        if ((result = mysql_store_result(con)) == NULL)
-            exit_error();
+        if ((result = mysql_store_result(c)) == NULL)
+            exit_error(c);
 
         if ((row = mysql_fetch_row(result))) {
-            if (print)
-                printf("%lu: %s\n", i, row[0]);
+            if (w->out)
+                sink_record(w->out, kbuf, key_encode(i, kbuf), row[0],
+                            mysql_fetch_lengths(result)[0]);
         }
         mysql_free_result(result);
+        phase_op(&w->ph, t0);
     }
+}
+
+/* Point lookups through a prepared statement, key and value in binary form */
+static void mysql_get_prepared(struct worker *w, MYSQL *c)
+{
+    MYSQL_STMT *stmt;
+    MYSQL_BIND param, result;
+    unsigned long long key;
+    unsigned char kbuf[KEY_MAX];
+    char *value;
+    unsigned long length, size, klen;
+    uint64_t t0;
+    int rc;
 
+    /* -V tells how large the stored values may be */
+    size = mysql_value_size();
+    if ((value = malloc(size)) == NULL)
+        exit_error(NULL);
+    if ((stmt = mysql_stmt_init(c)) == NULL)
+        exit_error(c);
+    if (mysql_stmt_prepare(stmt, "SELECT Value FROM dbrace WHERE Id=?",
+                           strlen("SELECT Value FROM dbrace WHERE Id=?")))
+        goto stmt_error;
+
+    mysql_bind_key(&param, &key, kbuf, &klen);
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = value;
+    result.buffer_length = size;
+    result.length = &length;
+    if (mysql_stmt_bind_param(stmt, &param) || mysql_stmt_bind_result(stmt, &result))
+        goto stmt_error;
+
+    for (key = w->first; key < w->last; key++) {
+        t0 = bench_now();
+        klen = key_encode(key, kbuf);
+        if (mysql_stmt_execute(stmt))
+            goto stmt_error;
+        while ((rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED) {
+            if (w->out)
+                sink_record(w->out, kbuf, klen, value, length < size ? length : size);
+        }
+        if (rc != MYSQL_NO_DATA)
+            goto stmt_error;
+        phase_op(&w->ph, t0);
+    }
+
+    mysql_stmt_close(stmt);
+    free(value);
+    return;
+
+stmt_error:
+    fprintf(stderr, "%s\n", mysql_stmt_error(stmt));
+    exit(1);
+}
+
+/*
+ * Pipelined lookups: mysql_pipeline SELECTs go out in one multi-statement
+ * round trip and their results are read back as they arrive, so each
+ * key's latency runs from sending the batch to reading its result.
+ */
+static void mysql_get_pipelined(struct worker *w, MYSQL *c)
+{
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    char *sqlbuf;
+    unsigned char kbuf[KEY_MAX];
+    size_t len;
+    unsigned long i, key, batch;
+    uint64_t t0;
+    int status;
+
+    sqlbuf = malloc((64 + MYSQL_KEY_SQL) * mysql_pipeline);
+    if (sqlbuf == NULL)
+        exit_error(c);
+
+    for (i = w->first; i < w->last; i += batch) {
+        batch = w->last - i < (unsigned long)mysql_pipeline ? w->last - i : mysql_pipeline;
+        len = 0;
+        for (key = i; key < i + batch; key++) {
+            len += sprintf(sqlbuf + len, "SELECT Value FROM dbrace WHERE Id=");
+            len += mysql_key_sql(sqlbuf + len, key);
+            sqlbuf[len++] = ';';
+        }
+
+        t0 = bench_now();
+        if (mysql_real_query(c, sqlbuf, len))
+            exit_error(c);
+
+        key = i;
+        do {
+            if ((result = mysql_store_result(c)) == NULL)
+                exit_error(c);
+            if ((row = mysql_fetch_row(result)) && w->out)
+                sink_record(w->out, kbuf, key_encode(key, kbuf), row[0],
+                            mysql_fetch_lengths(result)[0]);
+            mysql_free_result(result);
+            phase_op(&w->ph, t0);
+            key++;
+        } while ((status = mysql_next_result(c)) == 0);
+        if (status > 0)
+            exit_error(c);
+    }
+
+    free(sqlbuf);
+}
+
+static void mysql_get_worker(struct worker *w)
+{
+    MYSQL *c;
+
+    mysql_thread_init();
+    c = mysql_connect();
+
+    worker_begin(w);
+
+    if (mysql_pipeline > 1)
+        mysql_get_pipelined(w, c);
+    else if (mysql_prepared)
+        mysql_get_prepared(w, c);
+    else
+        mysql_get_text(w, c);
+
+    worker_end(w);
+
+    mysql_close(c);
+    mysql_thread_end();
+}
+
+/* Gather every record's indexed field, in key order, for the lookups */
+static void mysql_collect(void)
+{
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    struct phase ph;
+    char sqlbuf[128];
+
+    phase_begin(&ph, "collect");
+
+    mysql_open(host, user, pw, dbname);
+
+    snprintf(sqlbuf, sizeof(sqlbuf), "SELECT LEFT(Value, %lu) FROM dbrace ORDER BY Id",
+             (unsigned long)secondary_prefix());
+    if (mysql_query(con, sqlbuf))
+        exit_error(con);
+
+    if ((result = mysql_use_result(con)) == NULL)
+        exit_error(con);
+
+    secondary_reset();
+    while ((row = mysql_fetch_row(result)))
+        secondary_add(row[0], mysql_fetch_lengths(result)[0]);
+    if (mysql_errno(con))
+        exit_error(con);
+
+    mysql_free_result(result);
     mysql_close(con);
+
+    phase_end(&ph);
+}
+
+/*
+ * Lookups by value prefix. InnoDB only walks a prefix index for a range,
+ * so the field goes into a LIKE pattern, its own % and _ escaped.
+ */
+static void mysql_index_get_worker(struct worker *w)
+{
+    MYSQL *c;
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    char *sqlbuf, pattern[2 * SECONDARY_MAX];
+    const char *field;
+    unsigned char kbuf[KEY_MAX];
+    const void *key;
+    size_t len, klen, plen, sqllen;
+    unsigned long i;
+    uint64_t t0;
+
+    mysql_thread_init();
+    c = mysql_connect();
+
+    if ((sqlbuf = malloc(4 * SECONDARY_MAX + 128)) == NULL)
+        exit_error(c);
+
+    worker_begin(w);
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        field = secondary_key(i, &len);
+        for (plen = 0; len > 0; len--, field++) {
+            if (*field == '%' || *field == '_' || *field == '\\')
+                pattern[plen++] = '\\';
+            pattern[plen++] = *field;
+        }
+        sqllen = sprintf(sqlbuf, "SELECT Id,Value FROM dbrace WHERE Value LIKE '");
+        sqllen += mysql_real_escape_string(c, sqlbuf + sqllen, pattern, plen);
+        sqllen += sprintf(sqlbuf + sqllen, "%%' LIMIT 1");
+        if (mysql_real_query(c, sqlbuf, sqllen))
+            exit_error(c);
+
+        if ((result = mysql_store_result(c)) == NULL)
+            exit_error(c);
+
+        if ((row = mysql_fetch_row(result)) && w->out) {
+            key = mysql_row_key(result, row, kbuf, &klen);
+            sink_record(w->out, key, klen, row[1], mysql_fetch_lengths(result)[1]);
+        }
+        mysql_free_result(result);
+        phase_op(&w->ph, t0);
+    }
+
+    worker_end(w);
+
+    free(sqlbuf);
+    mysql_close(c);
+    mysql_thread_end();
+}
+
+static const struct kv_ops mysql_kv_ops;
+
+void mysql_get(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
+               unsigned long n)
+{
+    host = mysql_host;
+    user = mysql_user;
+    pw = mysql_pw;
+    dbname = mysql_db;
+
+    if (mysql_library_init(0, NULL, NULL))
+        exit_error(NULL);
+
+    mysql_stats_begin();
+    mysql_cache();
+    workload_warmup(NULL, n + 1, &mysql_kv_ops);
+    if (secondary_prefix()) {
+        mysql_collect();
+        workers_run("index get", 0, secondary_count(), mysql_index_get_worker, NULL);
+    } else {
+        workers_run("get", 1, n + 1, mysql_get_worker, NULL);
+    }
+    mysql_stats_end();
+
+    mysql_library_end();
 }
 
 void mysql_dump(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db)
 {
     MYSQL_RES *result = NULL;
     MYSQL_ROW row;
+    struct phase ph;
+    uint64_t t0;
+    unsigned char kbuf[KEY_MAX];
+    const void *key;
+    size_t klen;
+    struct sink *out = print ? sink_new() : NULL;
+
+    phase_begin(&ph, "open");
 
     mysql_open(mysql_host, mysql_user, mysql_pw, mysql_db);
+    mysql_stats_begin();
 
+    phase_end(&ph);
+    mysql_cache();
+    phase_begin(&ph, "dump");
+
+    /*
+     * Stream the rows off the wire instead of buffering the whole table
+     * on the client. The first row also carries the query round trip.
+     */
+    t0 = bench_now();
     if (mysql_query(con, "SELECT Id,Value FROM dbrace"))
-        exit_error();
+        exit_error(con);
 
-    if ((result = mysql_store_result(con)) ==NULL)
-        exit_error();
+    if ((result = mysql_use_result(con)) == NULL)
+        exit_error(con);
 
     while ((row = mysql_fetch_row(result))) {
-        if (print)
-            printf("%s: %s\n", row[0], row[1]);
+        phase_op(&ph, t0);
+        if (out) {
+            key = mysql_row_key(result, row, kbuf, &klen);
+            sink_record(out, key, klen, row[1], mysql_fetch_lengths(result)[1]);
+        }
+        t0 = bench_now();
     }
+    if (mysql_errno(con))
+        exit_error(con);
 
     if (result)
         mysql_free_result(result);
+
+    sink_free(out);
+    phase_end(&ph);
+    phase_begin(&ph, "close");
+
     mysql_close(con);
+
+    phase_end(&ph);
+    mysql_stats_end();
+}
+
+/*
+ * Workload primitives. Every thread has its own connection; statements
+ * are autocommitted and retried when InnoDB picks them as deadlock or
+ * lock wait timeout victim.
+ */
+#define ER_LOCK_WAIT_TIMEOUT 1205
+#define ER_LOCK_DEADLOCK     1213
+
+struct mysql_ctx {
+    struct worker *w;
+    MYSQL *c;
+    char *sql;                  /* mysql_sql_size() */
+
+    /* -M prepared range scans */
+    MYSQL_STMT *scan;
+    MYSQL_BIND param[2], result[2];
+    unsigned long long key, limit, id;
+    unsigned char kbuf[KEY_MAX], idbuf[KEY_MAX];
+    unsigned long klen, idlen, vlen, vsize;
+    char *value;
+};
+
+#define MYSQL_SCAN_SQL "SELECT Id,Value FROM dbrace WHERE Id>=? ORDER BY Id LIMIT ?"
+
+static void mysql_prepare_scan(struct mysql_ctx *ctx)
+{
+    ctx->vsize = mysql_value_size();
+    if ((ctx->value = malloc(ctx->vsize)) == NULL)
+        exit_error(NULL);
+    if ((ctx->scan = mysql_stmt_init(ctx->c)) == NULL)
+        exit_error(ctx->c);
+    if (mysql_stmt_prepare(ctx->scan, MYSQL_SCAN_SQL, strlen(MYSQL_SCAN_SQL)))
+        goto stmt_error;
+
+    mysql_bind_key(&ctx->param[0], &ctx->key, ctx->kbuf, &ctx->klen);
+    memset(&ctx->param[1], 0, sizeof(ctx->param[1]));
+    ctx->param[1].buffer_type = MYSQL_TYPE_LONGLONG;
+    ctx->param[1].buffer = &ctx->limit;
+    ctx->param[1].is_unsigned = 1;
+    mysql_bind_key(&ctx->result[0], &ctx->id, ctx->idbuf, &ctx->idlen);
+    memset(&ctx->result[1], 0, sizeof(ctx->result[1]));
+    ctx->result[1].buffer_type = MYSQL_TYPE_STRING;
+    ctx->result[1].buffer = ctx->value;
+    ctx->result[1].buffer_length = ctx->vsize;
+    ctx->result[1].length = &ctx->vlen;
+    if (mysql_stmt_bind_param(ctx->scan, ctx->param) ||
+        mysql_stmt_bind_result(ctx->scan, ctx->result))
+        goto stmt_error;
+    return;
+
+stmt_error:
+    fprintf(stderr, "%s\n", mysql_stmt_error(ctx->scan));
+    exit(1);
+}
+
+static void *mysql_kv_open(struct worker *w)
+{
+    struct mysql_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL)
+        exit_error(NULL);
+    mysql_thread_init();
+    ctx->w = w;
+    if ((ctx->sql = malloc(mysql_sql_size())) == NULL)
+        exit_error(NULL);
+    ctx->c = mysql_connect();
+    if (mysql_prepared)
+        mysql_prepare_scan(ctx);
+    return ctx;
+}
+
+static void mysql_kv_close(void *arg)
+{
+    struct mysql_ctx *ctx = arg;
+
+    if (ctx->scan)
+        mysql_stmt_close(ctx->scan);
+    mysql_close(ctx->c);
+    mysql_thread_end();
+    free(ctx->value);
+    free(ctx->sql);
+    free(ctx);
+}
+
+/* Runs a text SELECT Id,Value, returns the number of rows */
+static unsigned long mysql_kv_select(struct mysql_ctx *ctx, const char *sqlbuf)
+{
+    MYSQL_RES *result;
+    MYSQL_ROW row;
+    unsigned long rows = 0;
+    unsigned char kbuf[KEY_MAX];
+    const void *key;
+    size_t klen;
+
+    if (mysql_query(ctx->c, sqlbuf))
+        exit_error(ctx->c);
+
+    if ((result = mysql_store_result(ctx->c)) == NULL)
+        exit_error(ctx->c);
+
+    while ((row = mysql_fetch_row(result))) {
+        rows++;
+        if (ctx->w->out) {
+            key = mysql_row_key(result, row, kbuf, &klen);
+            sink_record(ctx->w->out, key, klen, row[1], mysql_fetch_lengths(result)[1]);
+        }
+    }
+    mysql_free_result(result);
+
+    return rows;
+}
+
+static int mysql_kv_read(void *arg, unsigned long key)
+{
+    char sqlbuf[1024], keysql[MYSQL_KEY_SQL];
+
+    mysql_key_sql(keysql, key);
+    snprintf(sqlbuf, sizeof(sqlbuf), "SELECT Id,Value FROM dbrace WHERE Id=%s", keysql);
+    return mysql_kv_select(arg, sqlbuf) == 0;
+}
+
+/* The rows come back in binary form and unbuffered, fetched one by one */
+static unsigned long mysql_kv_scan_prepared(struct mysql_ctx *ctx, unsigned long key,
+                                            unsigned long len)
+{
+    unsigned long rows = 0;
+    unsigned char kbuf[KEY_MAX];
+    int rc;
+
+    ctx->key = key;
+    ctx->limit = len;
+    if (ctx->param[0].buffer_type != MYSQL_TYPE_LONGLONG)
+        ctx->klen = key_encode(key, ctx->kbuf);
+    if (mysql_stmt_execute(ctx->scan))
+        goto stmt_error;
+    while ((rc = mysql_stmt_fetch(ctx->scan)) == 0 || rc == MYSQL_DATA_TRUNCATED) {
+        rows++;
+        if (!ctx->w->out)
+            continue;
+        if (ctx->result[0].buffer_type == MYSQL_TYPE_LONGLONG)
+            sink_record(ctx->w->out, kbuf, key_encode(ctx->id, kbuf), ctx->value,
+                        ctx->vlen < ctx->vsize ? ctx->vlen : ctx->vsize);
+        else
+            sink_record(ctx->w->out, ctx->idbuf, ctx->idlen < KEY_MAX ? ctx->idlen : KEY_MAX,
+                        ctx->value, ctx->vlen < ctx->vsize ? ctx->vlen : ctx->vsize);
+    }
+    if (rc != MYSQL_NO_DATA)
+        goto stmt_error;
+    return rows;
+
+stmt_error:
+    fprintf(stderr, "%s\n", mysql_stmt_error(ctx->scan));
+    exit(1);
+}
+
+static unsigned long mysql_kv_scan(void *arg, unsigned long key, unsigned long len)
+{
+    struct mysql_ctx *ctx = arg;
+    char sqlbuf[1024], keysql[MYSQL_KEY_SQL];
+
+    if (ctx->scan)
+        return mysql_kv_scan_prepared(ctx, key, len);
+
+    mysql_key_sql(keysql, key);
+    snprintf(sqlbuf, sizeof(sqlbuf),
+             "SELECT Id,Value FROM dbrace WHERE Id>=%s ORDER BY Id LIMIT %lu", keysql, len);
+    return mysql_kv_select(arg, sqlbuf);
+}
+
+/* InnoDB reads are consistent reads, only writers wait for row locks */
+static int mysql_kv_write(struct mysql_ctx *ctx, unsigned long key, enum mysql_write_mode mode)
+{
+    uint64_t t0 = bench_now();
+
+    while (mysql_write(ctx->c, key, &ctx->w->rng, mode, ctx->sql)) {
+        if (mysql_errno(ctx->c) != ER_LOCK_DEADLOCK &&
+            mysql_errno(ctx->c) != ER_LOCK_WAIT_TIMEOUT)
+            exit_error(ctx->c);
+        ctx->w->retries++;
+        ctx->w->retry_wait += bench_now() - t0;
+        t0 = bench_now();
+    }
+    return 0;
+}
+
+static int mysql_kv_update(void *arg, unsigned long key)
+{
+    return mysql_kv_write(arg, key, MYSQL_UPDATE);
+}
+
+static int mysql_kv_insert(void *arg, unsigned long key)
+{
+    return mysql_kv_write(arg, key, MYSQL_REPLACE);
+}
+
+static const struct kv_ops mysql_kv_ops = {
+    mysql_kv_open,
+    mysql_kv_close,
+    mysql_kv_read,
+    mysql_kv_update,
+    mysql_kv_insert,
+    mysql_kv_scan
+};
+
+void mysql_workload(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
+                    struct workload *wl, unsigned long n)
+{
+    host = mysql_host;
+    user = mysql_user;
+    pw = mysql_pw;
+    dbname = mysql_db;
+
+    if (mysql_library_init(0, NULL, NULL))
+        exit_error(NULL);
+
+    mysql_stats_begin();
+    mysql_cache();
+    workload_run(wl, n, &mysql_kv_ops);
+    mysql_stats_end();
+
+    mysql_library_end();
 }
@@ -1,12 +1,20 @@
 #ifndef MYSQL_H
 #define MYSQL_H
 
+#include "workload.h"
+
+extern int mysql_parse_opts(char *spec);
+extern void mysql_print_opts(void);
+
 extern void mysql_populate(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
-                           unsigned long n, unsigned long txnsize, int random);
+                           unsigned long n, unsigned long txnsize);
 
 extern void mysql_get(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
                       unsigned long n);
 
 extern void mysql_dump(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db);
 
+extern void mysql_workload(char *mysql_host, char *mysql_user, char *mysql_pw, char *mysql_db,
+                           struct workload *wl, unsigned long n);
+
 #endif
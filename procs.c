@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "results.h"
+#include "procs.h"
+
+static int nprocs = 0;          /* -N, 0: one process */
+static int procs_shared = 0;    /* every process works on all keys */
+static int proc_id = -1;        /* number of this child, -1 in the parent */
+
+/* What a child sends back for each of its phases */
+struct proc_phase {
+    struct phase_result r;
+    struct hist lat;
+};
+
+int procs_parse(char *spec)
+{
+    char *const tokens[] = { "partitioned", "shared", NULL };
+    char *value, *end;
+
+    nprocs = strtol(spec, &end, 0);
+    if (nprocs < 1 || (*end != '\0' && *end != ','))
+        return -1;
+    spec = *end ? end + 1 : end;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            procs_shared = 0;
+            break;
+        case 1:
+            procs_shared = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void procs_print(void)
+{
+    if (nprocs == 0)
+        return;
+    printf("Processes: %d, %s keys\n", nprocs, procs_shared ? "shared" : "partitioned");
+    results_option("procs", "%d", nprocs);
+    results_option("procs_keys", "%s", procs_shared ? "shared" : "partitioned");
+}
+
+int procs_active(void)
+{
+    return nprocs > 0;
+}
+
+int procs_count(void)
+{
+    return nprocs ? nprocs : 1;
+}
+
+int procs_child(void)
+{
+    return proc_id >= 0;
+}
+
+/* 0 outside of a multi-process run */
+int procs_id(void)
+{
+    return proc_id >= 0 ? proc_id : 0;
+}
+
+/* Narrow [first, last) to the slice of this process, unless keys are shared */
+void procs_slice(unsigned long *first, unsigned long *last)
+{
+    unsigned long chunk, from, to;
+
+    if (proc_id < 0 || procs_shared)
+        return;
+    chunk = *last > *first ? (*last - *first + nprocs - 1) / nprocs : 0;
+    from = *first + proc_id * chunk;
+    to = from + chunk;
+    *first = from < *last ? from : *last;
+    *last = to < *last ? to : *last;
+}
+
+static void procs_send(int fd)
+{
+    static struct proc_phase p;
+    const struct phase_result *res;
+    const struct hist *lat;
+    int count, i;
+
+    res = bench_results(&count);
+    for (i = 0; i < count; i++) {
+        p.r = res[i];
+        if ((lat = bench_result_latency(i)) != NULL)
+            p.lat = *lat;
+        else
+            hist_reset(&p.lat);
+        if (write(fd, &p, sizeof(p)) != (ssize_t)sizeof(p))
+            _exit(1);
+    }
+}
+
+static int procs_receive(int fd, struct proc_phase *res)
+{
+    ssize_t got, len = 0, max = BENCH_MAX_RESULTS * sizeof(*res);
+
+    while ((got = read(fd, (char *)res + len, max - len)) > 0 ||
+           (got < 0 && errno == EINTR))
+        if (got > 0)
+            len += got;
+    return len / sizeof(*res);
+}
+
+/*
+ * One phase of every process, merged: operations and latencies add up,
+ * the wall time runs from the first process starting the phase to the
+ * last one ending it. CLOCK_MONOTONIC is the same clock in every process.
+ */
+static void procs_report(const struct proc_phase *res, const int *counts)
+{
+    static struct phase agg;
+    const struct proc_phase *p;
+    uint64_t start, end, elapsed;
+    int i, j;
+
+    for (j = 0; j < counts[0]; j++) {
+        memset(&agg, 0, sizeof(agg));
+        agg.name = res[j].r.name;
+        hist_reset(&agg.lat);
+        start = UINT64_MAX;
+        end = 0;
+        for (i = 0; i < nprocs; i++) {
+            p = &res[i * BENCH_MAX_RESULTS + j];
+            if (j >= counts[i] || strcmp(p->r.name, agg.name) != 0)
+                continue;
+            elapsed = (uint64_t)(p->r.secs * 1e9);
+            agg.ops += p->r.ops;
+            hist_merge(&agg.lat, &p->lat);
+            if (p->r.start < start)
+                start = p->r.start;
+            if (p->r.start + elapsed > end)
+                end = p->r.start + elapsed;
+            if (elapsed > agg.elapsed)
+                agg.elapsed = elapsed;
+            if (p->r.ops && nprocs > 1)
+                printf("%s[proc %d]: %lu ops in %.6f s, %.1f ops/sec, p99 %.2f usec\n",
+                       agg.name, i, p->r.ops, p->r.secs,
+                       p->r.secs > 0 ? p->r.ops / p->r.secs : 0.0, p->r.p99);
+        }
+        /* Phases without operations report the slowest process */
+        if (agg.ops) {
+            agg.start = start;
+            agg.elapsed = end - start;
+        }
+        phase_report(&agg);
+    }
+}
+
+/*
+ * Fork the processes, each with its stdout silenced, let them all start
+ * body at once and collect their phases through a pipe each.
+ */
+void procs_run(void (*body)(void))
+{
+    struct proc_phase *res;
+    int *counts, (*fds)[2], gate[2], i, j, status, failed = 0;
+    pid_t *pids;
+    char c;
+
+    res = calloc(nprocs * BENCH_MAX_RESULTS, sizeof(*res));
+    counts = calloc(nprocs, sizeof(*counts));
+    fds = calloc(nprocs, sizeof(*fds));
+    pids = calloc(nprocs, sizeof(*pids));
+    if (res == NULL || counts == NULL || fds == NULL || pids == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+
+    if (pipe(gate) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+
+    for (i = 0; i < nprocs; i++) {
+        if (pipe(fds[i]) != 0) {
+            perror("pipe");
+            exit(1);
+        }
+        if ((pids[i] = fork()) < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            proc_id = i;
+            close(gate[1]);
+            for (j = 0; j < i; j++)
+                close(fds[j][0]);
+            close(fds[i][0]);
+            if (freopen("/dev/null", "w", stdout) == NULL)
+                _exit(1);
+            bench_results_reset();
+            bench_keep_latency();
+            /* The parent closing the gate starts everyone */
+            while (read(gate[0], &c, 1) < 0 && errno == EINTR)
+                ;
+            body();
+            fflush(stdout);
+            procs_send(fds[i][1]);
+            _exit(0);
+        }
+        close(fds[i][1]);
+    }
+    close(gate[0]);
+    close(gate[1]);
+
+    for (i = 0; i < nprocs; i++) {
+        counts[i] = procs_receive(fds[i][0], &res[i * BENCH_MAX_RESULTS]);
+        close(fds[i][0]);
+    }
+    for (i = 0; i < nprocs; i++) {
+        while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+            ;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s: process %d failed\n", progname, i);
+            failed++;
+        }
+    }
+    if (failed)
+        exit(1);
+
+    procs_report(res, counts);
+
+    free(res);
+    free(counts);
+    free(fds);
+    free(pids);
+}
@@ -0,0 +1,22 @@
+#ifndef PROCS_H
+#define PROCS_H
+
+/*
+ * Multi-process runs (-N): the parent creates the database, then forks
+ * that many processes which each open it on their own and run the
+ * action against it at the same time, the way the worker processes of a
+ * deployment share one BerkeleyDB environment, SQLite file or LMDB
+ * environment. Every process either takes its slice of the keys, the
+ * way threads do, or works on all of them. The parent merges the phases
+ * of its children into one report.
+ */
+extern int procs_parse(char *spec);
+extern void procs_print(void);
+extern int procs_active(void);
+extern int procs_count(void);
+extern int procs_child(void);
+extern int procs_id(void);
+extern void procs_slice(unsigned long *first, unsigned long *last);
+extern void procs_run(void (*body)(void));
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "results.h"
+
+#define RESULTS_MAX_KV 64
+
+struct results_table {
+    const char *name;
+    int count;
+    struct {
+        char key[32];
+        char value[160];
+    } kv[RESULTS_MAX_KV];
+};
+
+static struct results_table host = { .name = "host" };
+static struct results_table versions = { .name = "versions" };
+static struct results_table options = { .name = "options" };
+static struct results_table metrics = { .name = "metrics" };
+
+static void table_set(struct results_table *t, const char *key, const char *fmt, va_list ap)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++)
+        if (strcmp(t->kv[i].key, key) == 0)
+            break;
+    if (i == RESULTS_MAX_KV)
+        return;
+    if (i == t->count) {
+        snprintf(t->kv[i].key, sizeof(t->kv[i].key), "%s", key);
+        t->count++;
+    }
+    vsnprintf(t->kv[i].value, sizeof(t->kv[i].value), fmt, ap);
+}
+
+static void table_printf(struct results_table *t, const char *key, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    table_set(t, key, fmt, ap);
+    va_end(ap);
+}
+
+void results_option(const char *key, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    table_set(&options, key, fmt, ap);
+    va_end(ap);
+}
+
+void results_version(const char *key, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    table_set(&versions, key, fmt, ap);
+    va_end(ap);
+}
+
+void results_metric(const char *key, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    table_set(&metrics, key, fmt, ap);
+    va_end(ap);
+}
+
+static void results_host(void)
+{
+    struct utsname un;
+    char buf[256], *p;
+    long pages, pagesize;
+    FILE *f;
+
+    if (gethostname(buf, sizeof(buf)) == 0) {
+        buf[sizeof(buf) - 1] = '\0';
+        table_printf(&host, "name", "%s", buf);
+    }
+    if (uname(&un) == 0) {
+        table_printf(&host, "os", "%s %s", un.sysname, un.release);
+        table_printf(&host, "machine", "%s", un.machine);
+    }
+
+    /* Linux only, elsewhere the machine type has to do */
+    if ((f = fopen("/proc/cpuinfo", "r")) != NULL) {
+        while (fgets(buf, sizeof(buf), f) != NULL) {
+            if (strncmp(buf, "model name", 10) != 0 || (p = strchr(buf, ':')) == NULL)
+                continue;
+            for (p++; isspace((unsigned char)*p); p++)
+                ;
+            p[strcspn(p, "\n")] = '\0';
+            table_printf(&host, "cpu", "%s", p);
+            break;
+        }
+        fclose(f);
+    }
+    table_printf(&host, "cpus", "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+
+    pages = sysconf(_SC_PHYS_PAGES);
+    pagesize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pagesize > 0)
+        table_printf(&host, "memory_mb", "%lu",
+                     (unsigned long)((double)pages * pagesize / (1024 * 1024)));
+}
+
+static int is_number(const char *s)
+{
+    char *end;
+
+    if (!isdigit((unsigned char)*s) && !(*s == '-' && isdigit((unsigned char)s[1])))
+        return 0;
+    (void)strtod(s, &end);
+    return *end == '\0';
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    putc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            putc(*s, f);
+    }
+    putc('"', f);
+}
+
+static void json_table(FILE *f, const struct results_table *t)
+{
+    int i;
+
+    fprintf(f, "  \"%s\": {", t->name);
+    for (i = 0; i < t->count; i++) {
+        fprintf(f, "%s\n    ", i ? "," : "");
+        json_string(f, t->kv[i].key);
+        fprintf(f, ": ");
+        if (is_number(t->kv[i].value))
+            fprintf(f, "%s", t->kv[i].value);
+        else
+            json_string(f, t->kv[i].value);
+    }
+    fprintf(f, "%s},\n", t->count ? "\n  " : "");
+}
+
+static double result_rate(const struct phase_result *r)
+{
+    return r->secs > 0 ? r->ops / r->secs : 0;
+}
+
+static void json_usage(FILE *f, const struct phase_result *r)
+{
+    int i;
+
+    fprintf(f, ", \"user_s\": %.3f, \"sys_s\": %.3f, \"minflt\": %ld, \"majflt\": %ld, "
+            "\"nvcsw\": %ld, \"nivcsw\": %ld, \"read_kb\": %llu, \"write_kb\": %llu",
+            r->res.utime, r->res.stime, r->res.minflt, r->res.majflt,
+            r->res.nvcsw, r->res.nivcsw, r->res.rbytes / 1024, r->res.wbytes / 1024);
+    if (r->cnt.count == 0)
+        return;
+    fprintf(f, ", \"engine\": {");
+    for (i = 0; i < r->cnt.count; i++)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", r->cnt.names[i],
+                (unsigned long long)r->cnt.values[i]);
+    fprintf(f, "}");
+}
+
+static double interval_rate(const struct interval_result *r)
+{
+    return r->secs > 0 ? r->ops / r->secs : 0;
+}
+
+/* -I time series and engine events, one per line like the phases */
+static void json_intervals(FILE *f)
+{
+    const struct interval_result *iv;
+    const struct interval_event *ev;
+    int i, count;
+
+    iv = bench_intervals(&count);
+    fprintf(f, ",\n  \"intervals\": [");
+    for (i = 0; i < count; i++) {
+        fprintf(f, "%s\n    {\"phase\": ", i ? "," : "");
+        json_string(f, iv[i].phase);
+        fprintf(f, ", \"t\": %.3f, \"secs\": %.3f, \"ops\": %lu, \"ops_per_sec\": %.1f, "
+                "\"p99_us\": %.2f, \"max_us\": %.2f}",
+                iv[i].t, iv[i].secs, iv[i].ops, interval_rate(&iv[i]), iv[i].p99, iv[i].max);
+    }
+    fprintf(f, "%s]", count ? "\n  " : "");
+
+    ev = bench_events(&count);
+    fprintf(f, ",\n  \"events\": [");
+    for (i = 0; i < count; i++) {
+        fprintf(f, "%s\n    {\"phase\": ", i ? "," : "");
+        json_string(f, ev[i].phase);
+        fprintf(f, ", \"t\": %.3f, \"event\": ", ev[i].t);
+        json_string(f, ev[i].what);
+        fprintf(f, "}");
+    }
+    fprintf(f, "%s]", count ? "\n  " : "");
+}
+
+/*
+ * Every phase goes on a line of its own, results_compare() relies on
+ * that instead of carrying a full JSON parser.
+ */
+static void write_json(FILE *f, const char *date)
+{
+    const struct phase_result *res;
+    int i, count;
+
+    res = bench_results(&count);
+
+    fprintf(f, "{\n  \"date\": \"%s\",\n", date);
+    json_table(f, &host);
+    json_table(f, &versions);
+    json_table(f, &options);
+    json_table(f, &metrics);
+    fprintf(f, "  \"phases\": [");
+    for (i = 0; i < count; i++) {
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        json_string(f, res[i].name);
+        fprintf(f, ", \"ops\": %lu, \"secs\": %.6f, \"ops_per_sec\": %.1f, "
+                "\"avg_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+                "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f",
+                res[i].ops, res[i].secs, result_rate(&res[i]),
+                res[i].avg, res[i].p50, res[i].p90, res[i].p99, res[i].p999, res[i].max);
+        if (res[i].sampled)
+            json_usage(f, &res[i]);
+        fprintf(f, "}");
+    }
+    fprintf(f, "%s]", count ? "\n  " : "");
+    if (interval_secs() > 0)
+        json_intervals(f);
+    fprintf(f, "\n}\n");
+}
+
+static void csv_table(FILE *f, const struct results_table *t)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++)
+        fprintf(f, "# %s.%s: %s\n", t->name, t->kv[i].key, t->kv[i].value);
+}
+
+/*
+ * The -I time series follows the phases after an empty line, as a table
+ * of its own. Events go in between with only the time and the event set.
+ */
+static void csv_intervals(FILE *f)
+{
+    const struct interval_result *iv;
+    const struct interval_event *ev;
+    int i, j, count, nev;
+
+    iv = bench_intervals(&count);
+    ev = bench_events(&nev);
+    fprintf(f, "\ninterval_phase,t,secs,ops,ops_per_sec,p99_us,max_us,event\n");
+    for (i = 0, j = 0; i < count || j < nev; ) {
+        if (j < nev && (i == count || (strcmp(ev[j].phase, iv[i].phase) == 0 &&
+                                       ev[j].t < iv[i].t + iv[i].secs))) {
+            fprintf(f, "%s,%.3f,,,,,,%s\n", ev[j].phase, ev[j].t, ev[j].what);
+            j++;
+        } else {
+            fprintf(f, "%s,%.3f,%.3f,%lu,%.1f,%.2f,%.2f,\n", iv[i].phase, iv[i].t, iv[i].secs,
+                    iv[i].ops, interval_rate(&iv[i]), iv[i].p99, iv[i].max);
+            i++;
+        }
+    }
+}
+
+static void write_csv(FILE *f, const char *date)
+{
+    const struct phase_result *res;
+    int i, count;
+
+    res = bench_results(&count);
+
+    fprintf(f, "# date: %s\n", date);
+    csv_table(f, &host);
+    csv_table(f, &versions);
+    csv_table(f, &options);
+    csv_table(f, &metrics);
+    fprintf(f, "phase,ops,secs,ops_per_sec,avg_us,p50_us,p90_us,p99_us,p999_us,max_us,"
+            "user_s,sys_s,minflt,majflt,nvcsw,nivcsw,read_kb,write_kb,engine\n");
+    for (i = 0; i < count; i++) {
+        const struct resources *r = &res[i].res;
+        int j;
+
+        fprintf(f, "%s,%lu,%.6f,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,",
+                res[i].name, res[i].ops, res[i].secs, result_rate(&res[i]),
+                res[i].avg, res[i].p50, res[i].p90, res[i].p99, res[i].p999, res[i].max);
+        if (res[i].sampled)
+            fprintf(f, "%.3f,%.3f,%ld,%ld,%ld,%ld,%llu,%llu,",
+                    r->utime, r->stime, r->minflt, r->majflt, r->nvcsw, r->nivcsw,
+                    r->rbytes / 1024, r->wbytes / 1024);
+        else
+            fprintf(f, ",,,,,,,,");
+        /* Engine counters differ between backends, they share one column */
+        for (j = 0; j < res[i].cnt.count; j++)
+            fprintf(f, "%s%s=%llu", j ? ";" : "", res[i].cnt.names[j],
+                    (unsigned long long)res[i].cnt.values[j]);
+        fprintf(f, "\n");
+    }
+    if (interval_secs() > 0)
+        csv_intervals(f);
+}
+
+/* Write the results of this run to path, "-" is stdout */
+void results_write(const char *path)
+{
+    size_t len = strlen(path);
+    char date[32];
+    time_t now;
+    FILE *f;
+
+    now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    results_host();
+
+    if (strcmp(path, "-") == 0) {
+        f = stdout;
+    } else if ((f = fopen(path, "w")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    if (len > 4 && strcmp(path + len - 4, ".csv") == 0)
+        write_csv(f, date);
+    else
+        write_json(f, date);
+
+    if (f != stdout && fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+/*
+ * Comparison
+ */
+struct cmp_phase {
+    char name[32];
+    int seq;                    /* earlier phases of the same name */
+    unsigned long ops;
+    double rate, p99;
+};
+
+struct cmp_file {
+    int count;
+    struct cmp_phase phase[BENCH_MAX_RESULTS];
+};
+
+static void cmp_add(struct cmp_file *cf, const char *name, unsigned long ops,
+                    double rate, double p99)
+{
+    struct cmp_phase *cp;
+    int i;
+
+    if (cf->count == BENCH_MAX_RESULTS)
+        return;
+    cp = &cf->phase[cf->count];
+    snprintf(cp->name, sizeof(cp->name), "%s", name);
+    cp->seq = 0;
+    for (i = 0; i < cf->count; i++)
+        if (strcmp(cf->phase[i].name, cp->name) == 0)
+            cp->seq++;
+    cp->ops = ops;
+    cp->rate = rate;
+    cp->p99 = p99;
+    cf->count++;
+}
+
+/* Value of "key": in a line written by write_json() */
+static int json_field(const char *line, const char *key, char *buf, size_t len)
+{
+    char pattern[40];
+    const char *p;
+    size_t n;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    if ((p = strstr(line, pattern)) == NULL)
+        return -1;
+    for (p += strlen(pattern); *p == ' '; p++)
+        ;
+    if (*p == '"') {
+        p++;
+        n = strcspn(p, "\"");
+    } else {
+        n = strcspn(p, ",}\n");
+    }
+    if (n >= len)
+        n = len - 1;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    return 0;
+}
+
+static void cmp_json_line(struct cmp_file *cf, const char *line)
+{
+    char name[32], ops[32], rate[32], p99[32];
+
+    if (json_field(line, "name", name, sizeof(name)) != 0 ||
+        json_field(line, "ops", ops, sizeof(ops)) != 0 ||
+        json_field(line, "ops_per_sec", rate, sizeof(rate)) != 0 ||
+        json_field(line, "p99_us", p99, sizeof(p99)) != 0)
+        return;
+    cmp_add(cf, name, strtoul(ops, 0, 0), atof(rate), atof(p99));
+}
+
+/* Column positions come from the header line, unknown columns are skipped */
+static void cmp_csv_line(struct cmp_file *cf, char *line, int *cols)
+{
+    char *field, *fields[4] = { NULL };
+    int i, k;
+    const char *names[4] = { "phase", "ops", "ops_per_sec", "p99_us" };
+
+    line[strcspn(line, "\r\n")] = '\0';
+    for (i = 0; (field = strsep(&line, ",")) != NULL; i++) {
+        for (k = 0; k < 4; k++) {
+            if (cols[k] < 0 && strcmp(field, names[k]) == 0)
+                cols[k] = i;
+            else if (cols[k] == i)
+                fields[k] = field;
+        }
+    }
+    if (fields[0] && fields[1] && fields[2] && fields[3])
+        cmp_add(cf, fields[0], strtoul(fields[1], 0, 0), atof(fields[2]), atof(fields[3]));
+}
+
+static void cmp_load(const char *path, struct cmp_file *cf)
+{
+    char line[4096];
+    int cols[4] = { -1, -1, -1, -1 };
+    int json = -1;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    cf->count = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (json < 0)
+            json = line[0] == '{';
+        if (json)
+            cmp_json_line(cf, line);
+        else if (line[0] == '\n')
+            break;              /* the -I time series follows */
+        else if (line[0] != '#')
+            cmp_csv_line(cf, line, cols);
+    }
+    fclose(f);
+
+    if (cf->count == 0) {
+        fprintf(stderr, "%s: no phases in %s\n", progname, path);
+        exit(1);
+    }
+}
+
+static double change(double from, double to)
+{
+    return from > 0 ? 100.0 * (to - from) / from : 0;
+}
+
+/*
+ * Match the phases of two result files by name and order and flag every
+ * phase whose throughput dropped or whose p99 latency rose by more than
+ * threshold percent. Returns the number of regressions.
+ */
+int results_compare(const char *base, const char *cur, double threshold)
+{
+    static struct cmp_file b, c;
+    const struct cmp_phase *bp, *cp;
+    double dr, dp;
+    int i, j, regressions = 0;
+
+    cmp_load(base, &b);
+    cmp_load(cur, &c);
+
+    printf("Comparing %s against %s, threshold %.1f%%\n\n", cur, base, threshold);
+    printf("%-20s %12s %12s %8s %10s %10s %8s\n",
+           "phase", "base ops/s", "ops/s", "change", "base p99", "p99", "change");
+
+    for (i = 0; i < c.count; i++) {
+        cp = &c.phase[i];
+        if (cp->ops == 0)
+            continue;
+        bp = NULL;
+        for (j = 0; j < b.count; j++)
+            if (strcmp(b.phase[j].name, cp->name) == 0 && b.phase[j].seq == cp->seq)
+                bp = &b.phase[j];
+        if (bp == NULL || bp->ops == 0) {
+            printf("%-20s %12s %12.1f\n", cp->name, "-", cp->rate);
+            continue;
+        }
+
+        dr = change(bp->rate, cp->rate);
+        dp = change(bp->p99, cp->p99);
+        printf("%-20s %12.1f %12.1f %+7.1f%% %10.2f %10.2f %+7.1f%%",
+               cp->name, bp->rate, cp->rate, dr, bp->p99, cp->p99, dp);
+        if (dr < -threshold || dp > threshold) {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        printf("\n");
+    }
+
+    for (j = 0; j < b.count; j++) {
+        bp = &b.phase[j];
+        if (bp->ops == 0)
+            continue;
+        for (i = 0; i < c.count; i++)
+            if (strcmp(c.phase[i].name, bp->name) == 0 && c.phase[i].seq == bp->seq)
+                break;
+        if (i == c.count)
+            printf("%-20s %12.1f %12s\n", bp->name, bp->rate, "-");
+    }
+
+    printf("\n%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions;
+}
@@ -0,0 +1,16 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/*
+ * Machine readable results: -O <file> writes the options, library
+ * versions, host, engine counters and every reported phase of a run as
+ * JSON, or as CSV if the file name ends in .csv. -K compares two such
+ * files.
+ */
+extern void results_option(const char *key, const char *fmt, ...);
+extern void results_version(const char *key, const char *fmt, ...);
+extern void results_metric(const char *key, const char *fmt, ...);
+extern void results_write(const char *path);
+extern int results_compare(const char *base, const char *cur, double threshold);
+
+#endif
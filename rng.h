@@ -0,0 +1,46 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/*
+ * Small per-thread pseudo random generator (xorshift64*). rand() is
+ * global, locked and on some platforms only 15 bits wide, none of which
+ * is acceptable inside a timed multi-threaded loop.
+ */
+
+static inline uint64_t rng_seed(uint64_t seed)
+{
+    /* splitmix64 so that seeds 1, 2, 3... yield unrelated streams */
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+static inline uint64_t rng_next(uint64_t *s)
+{
+    uint64_t x = *s;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [0, 1) */
+static inline double rng_double(uint64_t *s)
+{
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Uniform in [0, n) */
+static inline uint64_t rng_below(uint64_t *s, uint64_t n)
+{
+    return n ? rng_next(s) % n : 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dbrace.h"
+#include "results.h"
+#include "secondary.h"
+
+static size_t prefix = 0;                   /* -i, 0: no index */
+
+/* The collected fields, prefix bytes apart, and their lengths */
+static unsigned char *fields;
+static unsigned char *lengths;
+static unsigned long nfields, fields_size;
+
+int secondary_parse(char *spec)
+{
+    char *end;
+
+    prefix = strtoul(spec, &end, 0);
+    if (*end != '\0' || prefix < 1 || prefix > SECONDARY_MAX)
+        return -1;
+    return 0;
+}
+
+/* -X index=, the collected fields no longer fit */
+void secondary_set(size_t bytes)
+{
+    prefix = bytes < SECONDARY_MAX ? bytes : SECONDARY_MAX;
+    free(fields);
+    free(lengths);
+    fields = lengths = NULL;
+    nfields = fields_size = 0;
+}
+
+void secondary_print(void)
+{
+    if (prefix)
+        printf("Secondary index: first %lu value bytes\n", (unsigned long)prefix);
+    results_option("secondary_prefix", "%lu", (unsigned long)prefix);
+}
+
+size_t secondary_prefix(void)
+{
+    return prefix;
+}
+
+/* Bytes of a value of len bytes that go into the index */
+size_t secondary_field(size_t len)
+{
+    return len < prefix ? len : prefix;
+}
+
+void secondary_reset(void)
+{
+    nfields = 0;
+}
+
+void secondary_add(const void *value, size_t len)
+{
+    if (nfields == fields_size) {
+        fields_size = fields_size ? 2 * fields_size : 4096;
+        fields = realloc(fields, fields_size * prefix);
+        lengths = realloc(lengths, fields_size);
+        if (fields == NULL || lengths == NULL) {
+            fprintf(stderr, "%s: couldn't allocate the secondary keys\n", progname);
+            exit(1);
+        }
+    }
+    len = secondary_field(len);
+    memcpy(fields + nfields * prefix, value, len);
+    lengths[nfields++] = len;
+}
+
+unsigned long secondary_count(void)
+{
+    return nfields;
+}
+
+const void *secondary_key(unsigned long i, size_t *len)
+{
+    *len = lengths[i];
+    return fields + i * prefix;
+}
@@ -0,0 +1,26 @@
+#ifndef SECONDARY_H
+#define SECONDARY_H
+
+#include <stddef.h>
+
+/*
+ * Secondary index (-i <bytes>): BerkeleyDB, SQLite and MySQL keep an
+ * index on the first <bytes> bytes of the value next to the primary key,
+ * the way real schemas index a column or two, and every write maintains
+ * it. Gets look records up through the index instead of by key: an
+ * untimed pass first collects the indexed field of every record in key
+ * order, and the lookups then go through those fields.
+ */
+#define SECONDARY_MAX 255           /* longest indexed prefix */
+
+extern int secondary_parse(char *spec);
+extern void secondary_set(size_t prefix);
+extern void secondary_print(void);
+extern size_t secondary_prefix(void);
+extern size_t secondary_field(size_t len);
+extern void secondary_reset(void);
+extern void secondary_add(const void *value, size_t len);
+extern unsigned long secondary_count(void);
+extern const void *secondary_key(unsigned long i, size_t *len);
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dbrace.h"
+#include "key.h"
+#include "results.h"
+#include "sink.h"
+
+enum sink_format {
+    SINK_TEXT,
+    SINK_BINARY
+};
+
+static const char *sink_format_names[] = { "text", "binary", NULL };
+
+struct sink {
+    char *buf;
+    size_t len, size;
+};
+
+static enum sink_format sink_format = SINK_TEXT;
+static char *sink_path = NULL;              /* NULL: stdout */
+static size_t sink_size = SINK_BUFFER_KB * 1024;
+static int sink_fd = -1;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* -F text|binary,file=<path>,buffer=<KB> */
+int sink_parse(char *spec)
+{
+    char *const tokens[] = { "text", "binary", "file", "buffer", NULL };
+    char *value;
+
+    while (*spec) {
+        switch (getsubopt(&spec, tokens, &value)) {
+        case 0:
+            sink_format = SINK_TEXT;
+            break;
+        case 1:
+            sink_format = SINK_BINARY;
+            break;
+        case 2:
+            if (value == NULL || *value == '\0')
+                return -1;
+            sink_path = strdup(value);
+            break;
+        case 3:
+            if (value == NULL || (sink_size = strtoul(value, NULL, 0) * 1024) == 0)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    /* Binary records would end up between the report lines */
+    if (sink_format == SINK_BINARY && sink_path == NULL)
+        return -1;
+
+    return 0;
+}
+
+void sink_print(void)
+{
+    printf("Output: %s to %s, %lu KB buffer per thread\n", sink_format_names[sink_format],
+           sink_path ? sink_path : "stdout", (unsigned long)(sink_size / 1024));
+    results_option("output_format", "%s", sink_format_names[sink_format]);
+    results_option("output_buffer_kb", "%lu", (unsigned long)(sink_size / 1024));
+}
+
+/*
+ * Open the file up front, before -N forks, so that every process
+ * appends to the same one instead of truncating it for the others.
+ */
+void sink_open(void)
+{
+    if (sink_path == NULL) {
+        sink_fd = STDOUT_FILENO;
+        return;
+    }
+    if ((sink_fd = open(sink_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        fprintf(stderr, "%s: couldn't open %s: %s\n", progname, sink_path, strerror(errno));
+        exit(1);
+    }
+}
+
+void sink_close(void)
+{
+    if (sink_fd >= 0 && sink_fd != STDOUT_FILENO && close(sink_fd) != 0) {
+        fprintf(stderr, "%s: couldn't write %s: %s\n", progname, sink_path, strerror(errno));
+        exit(1);
+    }
+    sink_fd = -1;
+}
+
+struct sink *sink_new(void)
+{
+    struct sink *s;
+
+    if ((s = malloc(sizeof(*s))) == NULL || (s->buf = malloc(sink_size)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+    s->len = 0;
+    s->size = sink_size;
+    return s;
+}
+
+/* One write of the whole buffer, in between the threads' */
+void sink_flush(struct sink *s)
+{
+    size_t off = 0;
+    ssize_t rc;
+
+    if (s == NULL || s->len == 0)
+        return;
+
+    pthread_mutex_lock(&sink_lock);
+    /* Text goes to stdout behind whatever the report printed so far */
+    if (sink_fd == STDOUT_FILENO)
+        fflush(stdout);
+    while (off < s->len) {
+        if ((rc = write(sink_fd, s->buf + off, s->len - off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: couldn't write %s: %s\n", progname,
+                    sink_path ? sink_path : "output", strerror(errno));
+            exit(1);
+        }
+        off += rc;
+    }
+    pthread_mutex_unlock(&sink_lock);
+    s->len = 0;
+}
+
+void sink_free(struct sink *s)
+{
+    if (s == NULL)
+        return;
+    sink_flush(s);
+    free(s->buf);
+    free(s);
+}
+
+static char *sink_put32(char *p, size_t v)
+{
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+    return p + 4;
+}
+
+static char *sink_put(char *p, const void *data, size_t len)
+{
+    memcpy(p, data, len);
+    return p + len;
+}
+
+void sink_record(struct sink *s, const void *key, size_t klen, const void *data, size_t dlen)
+{
+    char kstr[KEY_STRLEN];
+    size_t need;
+    char *p;
+
+    if (sink_format == SINK_TEXT) {
+        key = key_string(key, klen, kstr);
+        klen = strlen(key);
+        need = sizeof("key: , data: \n") - 1 + klen + dlen;
+    } else {
+        need = 8 + klen + dlen;
+    }
+
+    if (s->len + need > s->size) {
+        sink_flush(s);
+        /* A record larger than the buffer grows it for good */
+        if (need > s->size) {
+            if ((p = realloc(s->buf, need)) == NULL) {
+                fprintf(stderr, "%s: out of memory\n", progname);
+                exit(1);
+            }
+            s->buf = p;
+            s->size = need;
+        }
+    }
+
+    p = s->buf + s->len;
+    if (sink_format == SINK_TEXT) {
+        p = sink_put(p, "key: ", 5);
+        p = sink_put(p, key, klen);
+        p = sink_put(p, ", data: ", 8);
+        p = sink_put(p, data, dlen);
+        *p++ = '\n';
+    } else {
+        p = sink_put(sink_put32(p, klen), key, klen);
+        p = sink_put(sink_put32(p, dlen), data, dlen);
+    }
+    s->len = p - s->buf;
+}
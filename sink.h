@@ -0,0 +1,30 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+
+/*
+ * Record output of -o. Every thread formats its records into a large
+ * buffer of its own which goes out in a single write when it is full,
+ * instead of a printf per record. The text format has one line per
+ * record, "key: <key>, data: <value>". The binary one (-F binary) has,
+ * for every record, the key length as 4 bytes big-endian, the key as
+ * the engine stores it (see key.h), the value length the same way and
+ * the value; there is no header and records follow in the order the
+ * action read them.
+ */
+#define SINK_BUFFER_KB 1024         /* default buffer per thread */
+
+struct sink;
+
+extern int sink_parse(char *spec);
+extern void sink_print(void);
+extern void sink_open(void);
+extern void sink_close(void);
+extern struct sink *sink_new(void);
+extern void sink_record(struct sink *s, const void *key, size_t klen,
+                        const void *data, size_t dlen);
+extern void sink_flush(struct sink *s);
+extern void sink_free(struct sink *s);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
@@ -7,217 +8,1171 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <sqlite3.h>
 #include "dbrace.h"
+#include "bench.h"
+#include "worker.h"
+#include "workload.h"
+#include "results.h"
+#include "value.h"
+#include "key.h"
+#include "cache.h"
+#include "procs.h"
+#include "sink.h"
+#include "delete.h"
+#include "secondary.h"
+#include "crash.h"
+#include "stage.h"
 #include "sqlite.h"
 
 static sqlite3 *sqldb;
 
-void sqlite_dump(void)
+static void sqlite_exec_sql(sqlite3 *conn, const char *sql)
 {
     int rc;
+    char *zErrMsg = NULL;
+
+    rc = sqlite3_exec(conn, sql, NULL, NULL, &zErrMsg);
+    if( rc!=SQLITE_OK ){
+        fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
+        sqlite3_free(zErrMsg);
+        exit(1);
+    }
+}
+
+/*
+ * Tuning profile: pragmas applied to every connection right after it is
+ * opened. NULL leaves SQLite's default. page_size comes first since it
+ * can't change any more once a database is in WAL mode.
+ */
+enum {
+    PRAGMA_PAGE_SIZE,
+    PRAGMA_JOURNAL_MODE,
+    PRAGMA_SYNCHRONOUS,
+    PRAGMA_LOCKING_MODE,
+    PRAGMA_MMAP_SIZE,
+    PRAGMA_CACHE_SIZE,
+    PRAGMA_TEMP_STORE,
+    PRAGMA_AUTO_VACUUM,
+    PRAGMA_COUNT
+};
+
+static const char *pragma_names[PRAGMA_COUNT] = {
+    "page_size", "journal_mode", "synchronous", "locking_mode",
+    "mmap_size", "cache_size", "temp_store", "auto_vacuum"
+};
+
+struct sqlite_profile {
+    const char *name;
+    const char *pragmas[PRAGMA_COUNT];
+};
+
+static const struct sqlite_profile sqlite_profiles[] = {
+    /* name         page_size journal   sync      locking      mmap         cache  temp_store auto_vacuum */
+    { "default",  { NULL,     NULL,     NULL,     NULL,        NULL,        NULL,  NULL,      NULL } },
+    { "wal",      { NULL,     "WAL",    "NORMAL", NULL,        NULL,        NULL,  NULL,      NULL } },
+    { "safe",     { NULL,     "WAL",    "FULL",   NULL,        NULL,        NULL,  NULL,      NULL } },
+    { "fast",     { NULL,     "WAL",    "OFF",    "EXCLUSIVE", "268435456", NULL,  "MEMORY",  NULL } },
+    { "mmap",     { NULL,     "WAL",    "NORMAL", NULL,        "1073741824", NULL, NULL,      NULL } },
+};
+
+#define SQLITE_NPROFILES (sizeof(sqlite_profiles) / sizeof(sqlite_profiles[0]))
+
+static const char *profile_name = "default";
+static int profile_modified = 0;
+static char *pragma_values[PRAGMA_COUNT];
+
+int sqlite_parse_profile(char *spec)
+{
+    char *tokens[SQLITE_NPROFILES + PRAGMA_COUNT + 1];
+    char *value;
+    size_t len;
+    int i, tok;
+
+    for (i = 0; i < (int)SQLITE_NPROFILES; i++)
+        tokens[i] = (char *)sqlite_profiles[i].name;
+    for (i = 0; i < PRAGMA_COUNT; i++)
+        tokens[SQLITE_NPROFILES + i] = (char *)pragma_names[i];
+    tokens[SQLITE_NPROFILES + PRAGMA_COUNT] = NULL;
+
+    while (*spec) {
+        tok = getsubopt(&spec, tokens, &value);
+        if (tok < 0) {
+            fprintf(stderr, "%s: unknown SQLite profile or pragma '%s'\n", progname, value);
+            return -1;
+        }
+        if (tok < (int)SQLITE_NPROFILES) {
+            profile_name = sqlite_profiles[tok].name;
+            profile_modified = 0;
+            for (i = 0; i < PRAGMA_COUNT; i++)
+                pragma_values[i] = (char *)sqlite_profiles[tok].pragmas[i];
+            continue;
+        }
+        if (value == NULL || *value == '\0') {
+            fprintf(stderr, "%s: pragma '%s' needs a value\n", progname, tokens[tok]);
+            return -1;
+        }
+        tok -= SQLITE_NPROFILES;
+        if (tok == PRAGMA_CACHE_SIZE) {
+            /* <n> is in pages, <n>k in KiB which SQLite takes as negative */
+            len = strlen(value);
+            if (value[len - 1] == 'k' || value[len - 1] == 'K') {
+                value[len - 1] = '\0';
+                memmove(value + 1, value, len);
+                value[0] = '-';
+            }
+        }
+        pragma_values[tok] = value;
+        profile_modified = 1;
+    }
+
+    return 0;
+}
+
+/* An exclusive lock keeps every other connection out */
+static void sqlite_check_profile(void)
+{
+    const char *locking = pragma_values[PRAGMA_LOCKING_MODE];
+
+    if ((nthreads > 1 || procs_count() > 1) && locking && strcasecmp(locking, "EXCLUSIVE") == 0) {
+        fprintf(stderr, "%s: locking_mode=EXCLUSIVE only works with a single thread\n", progname);
+        exit(1);
+    }
+}
+
+/* From every thread that opens a connection, so it leaves pragma_values alone */
+static void sqlite_apply_profile(sqlite3 *conn)
+{
+    char sql[128], pages[32];
+    const char *value;
+    int i;
+
+    for (i = 0; i < PRAGMA_COUNT; i++) {
+        value = pragma_values[i];
+        /* -c still sets the page cache unless the profile says otherwise */
+        if (i == PRAGMA_CACHE_SIZE && value == NULL && cache) {
+            snprintf(pages, sizeof(pages), "%lu", cache);
+            value = pages;
+        }
+        if (value == NULL)
+            continue;
+        snprintf(sql, sizeof(sql), "PRAGMA %s=%s;", pragma_names[i], value);
+        sqlite_exec_sql(conn, sql);
+    }
+}
+
+/* Print, and record for the results, the settings the connection actually ended up with */
+static void sqlite_print_settings(sqlite3 *conn)
+{
     sqlite3_stmt *sql_stmt;
+    char sql[64], key[32];
+    int i;
+
+    printf("SQLite %s, profile %s%s:", sqlite3_libversion(), profile_name,
+           profile_modified ? " with overrides" : "");
+    results_version("sqlite", "%s", sqlite3_libversion());
+    results_option("sqlite_profile", "%s%s", profile_name, profile_modified ? "+" : "");
+    for (i = 0; i < PRAGMA_COUNT; i++) {
+        snprintf(sql, sizeof(sql), "PRAGMA %s;", pragma_names[i]);
+        if (sqlite3_prepare_v2(conn, sql, -1, &sql_stmt, NULL) != SQLITE_OK)
+            continue;
+        if (sqlite3_step(sql_stmt) == SQLITE_ROW) {
+            printf(" %s=%s", pragma_names[i], sqlite3_column_text(sql_stmt, 0));
+            snprintf(key, sizeof(key), "sqlite_%s", pragma_names[i]);
+            results_option(key, "%s", (const char *)sqlite3_column_text(sql_stmt, 0));
+        }
+        sqlite3_finalize(sql_stmt);
+    }
+    printf("\n");
+}
+
+/*
+ * Bind key number key: the integer encodings go in as the INTEGER
+ * PRIMARY KEY, that is the rowid, the others in their encoded form.
+ */
+static int sqlite_bind_key(sqlite3_stmt *sql_stmt, int i, unsigned long key)
+{
+    unsigned char kbuf[KEY_MAX];
+    size_t len;
+
+    switch (key_type()) {
+    case KEY_STRING:
+    case KEY_VARSTR:
+        len = key_encode(key, kbuf);
+        return sqlite3_bind_text(sql_stmt, i, (char *)kbuf, len, SQLITE_TRANSIENT);
+    case KEY_UUID:
+        len = key_encode(key, kbuf);
+        return sqlite3_bind_blob(sql_stmt, i, kbuf, len, SQLITE_TRANSIENT);
+    default:
+        return sqlite3_bind_int64(sql_stmt, i, key);
+    }
+}
+
+/*
+ * Hand a key,value row to the sink as the columns hold it: integer keys
+ * are encoded from their int64 and everything else is taken as a blob,
+ * so SQLite converts nothing to text.
+ */
+static void sqlite_record(struct sink *out, sqlite3_stmt *sql_stmt)
+{
+    unsigned char kbuf[KEY_MAX];
+    const void *key = kbuf;
+    size_t klen;
+
+    switch (key_type()) {
+    case KEY_NATIVE:
+    case KEY_BE:
+        klen = key_encode(sqlite3_column_int64(sql_stmt, 0), kbuf);
+        break;
+    default:
+        key = sqlite3_column_blob(sql_stmt, 0);
+        klen = sqlite3_column_bytes(sql_stmt, 0);
+        break;
+    }
+    sink_record(out, key, klen, sqlite3_column_blob(sql_stmt, 1), sqlite3_column_bytes(sql_stmt, 1));
+}
+
+/*
+ * Page cache counters are kept per connection. Open connections are
+ * summed when a phase is sampled, closed ones have been folded into
+ * sqlite_closed.
+ */
+enum { SQLITE_CNT_HIT, SQLITE_CNT_MISS, SQLITE_CNT_WRITE, SQLITE_CNT_SPILL, SQLITE_CNT_COUNT };
+
+static pthread_mutex_t sqlite_conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static sqlite3 **sqlite_conns;
+static int sqlite_nconns, sqlite_conns_size;
+static uint64_t sqlite_closed[SQLITE_CNT_COUNT];
+
+static void sqlite_cache_counts(sqlite3 *conn, uint64_t *v)
+{
+    int cur, hw;
+
+    if (sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_HIT, &cur, &hw, 0) == SQLITE_OK)
+        v[SQLITE_CNT_HIT] += cur;
+    if (sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hw, 0) == SQLITE_OK)
+        v[SQLITE_CNT_MISS] += cur;
+    if (sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_WRITE, &cur, &hw, 0) == SQLITE_OK)
+        v[SQLITE_CNT_WRITE] += cur;
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+    if (sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_SPILL, &cur, &hw, 0) == SQLITE_OK)
+        v[SQLITE_CNT_SPILL] += cur;
+#endif
+}
+
+/* The memory high-water mark restarts with every phase */
+static void sqlite_sample(struct counters *c, int begin)
+{
+    uint64_t v[SQLITE_CNT_COUNT];
+    sqlite3_int64 cur, hw;
+    int i;
+
+    pthread_mutex_lock(&sqlite_conns_lock);
+    memcpy(v, sqlite_closed, sizeof(v));
+    for (i = 0; i < sqlite_nconns; i++)
+        sqlite_cache_counts(sqlite_conns[i], v);
+    pthread_mutex_unlock(&sqlite_conns_lock);
+
+    counters_add(c, "cache_hit", v[SQLITE_CNT_HIT], 0);
+    counters_add(c, "cache_miss", v[SQLITE_CNT_MISS], 0);
+    counters_add(c, "cache_write", v[SQLITE_CNT_WRITE], 0);
+    counters_add(c, "cache_spill", v[SQLITE_CNT_SPILL], 0);
+    if (sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &cur, &hw, begin) == SQLITE_OK)
+        counters_add(c, "memory_highwater", hw, 1);
+}
+
+/*
+ * With -I the WAL is checkpointed from this hook instead of SQLite's
+ * own, at the same threshold, so that checkpoints show on the timeline.
+ * Installing it replaces the autocheckpoint, which is a WAL hook too.
+ * With -y checkpoint= it leaves the checkpoints to that thread.
+ */
+#define SQLITE_WAL_AUTOCHECKPOINT 1000  /* pages */
+
+static int sqlite_wal_hook(void *arg, sqlite3 *conn, const char *db, int pages)
+{
+    uint64_t t0;
+    int logged, done, rc;
+
+    (void)arg;
+    if (pages < SQLITE_WAL_AUTOCHECKPOINT || crash_checkpoint_secs() > 0)
+        return SQLITE_OK;
+
+    /* Busy when another connection is checkpointing, SQLite ignores that too */
+    t0 = bench_now();
+    rc = sqlite3_wal_checkpoint_v2(conn, db, SQLITE_CHECKPOINT_PASSIVE, &logged, &done);
+    if (rc == SQLITE_OK)
+        interval_note("wal checkpoint: %d of %d pages in %.1f ms", done, logged,
+                      (bench_now() - t0) / 1e6);
+    return SQLITE_OK;
+}
+
+/*
+ * Busy handler of the worker connections: back off like
+ * sqlite3_busy_timeout() does, adding the time slept to the retry wait of
+ * the worker.
+ */
+static int sqlite_busy(void *arg, int count)
+{
+    static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+    static const int totals[] = { 0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228 };
+    const int ndelays = sizeof(delays) / sizeof(delays[0]);
+    struct worker *w = arg;
+    int delay, prior;
+    uint64_t t0;
+
+    if (count < ndelays) {
+        delay = delays[count];
+        prior = totals[count];
+    } else {
+        delay = delays[ndelays - 1];
+        prior = totals[ndelays - 1] + delay * (count - (ndelays - 1));
+    }
+    if (prior + delay > SQLITE_BUSY_WAIT) {
+        delay = SQLITE_BUSY_WAIT - prior;
+        if (delay <= 0)
+            return 0;
+    }
+    t0 = bench_now();
+    sqlite3_sleep(delay);
+    w->retry_wait += bench_now() - t0;
+    return 1;
+}
+
+/*
+ * Open a private connection. Worker threads each get their own, so the
+ * per-connection mutex is not needed; lock contention between writers
+ * is absorbed by the busy handler.
+ */
+static sqlite3 *sqlite_connect(void)
+{
+    int rc;
+    sqlite3 *conn;
 
-    rc = sqlite3_open(SQLITE_FILENAME, &sqldb);
+    rc = sqlite3_open_v2(SQLITE_FILENAME, &conn,
+                         SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+                         NULL);
     if (rc != SQLITE_OK) {
         printf("sqlite3_open: Couldn't open %s", SQLITE_FILENAME);
         exit(1);
     }
-    
+    sqlite3_busy_timeout(conn, SQLITE_BUSY_WAIT);
+    sqlite_apply_profile(conn);
+    /* -y checkpoint= takes over from SQLite's own checkpoints */
+    if (crash_checkpoint_secs() > 0)
+        sqlite3_wal_autocheckpoint(conn, 0);
+    /* Last, the autocheckpoint would replace it */
+    if (interval_secs() > 0)
+        sqlite3_wal_hook(conn, sqlite_wal_hook, NULL);
+
+    pthread_mutex_lock(&sqlite_conns_lock);
+    if (sqlite_nconns == sqlite_conns_size) {
+        sqlite_conns_size = sqlite_conns_size ? 2 * sqlite_conns_size : 16;
+        sqlite_conns = realloc(sqlite_conns, sqlite_conns_size * sizeof(*sqlite_conns));
+        if (sqlite_conns == NULL) {
+            printf("Couldn't allocate connection list\n");
+            exit(1);
+        }
+    }
+    sqlite_conns[sqlite_nconns++] = conn;
+    pthread_mutex_unlock(&sqlite_conns_lock);
+    bench_counters(sqlite_sample);
+
+    return conn;
+}
+
+static void sqlite_disconnect(sqlite3 *conn)
+{
+    int i, rc;
+
+    pthread_mutex_lock(&sqlite_conns_lock);
+    sqlite_cache_counts(conn, sqlite_closed);
+    for (i = 0; i < sqlite_nconns; i++) {
+        if (sqlite_conns[i] == conn) {
+            sqlite_conns[i] = sqlite_conns[--sqlite_nconns];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sqlite_conns_lock);
+
+    rc = sqlite3_close(conn);
+    if (rc != SQLITE_OK)
+        printf("sqlite3_close: %s", sqlite3_errmsg(conn));
+}
+
+/* -C: evict the database files from the page cache or read them in */
+void sqlite_cache_files(void)
+{
+    struct phase ph;
+
+    if (cache_state() == CACHE_ASIS)
+        return;
+
+    phase_begin(&ph, cache_state() == CACHE_COLD ? "evict" : "preread");
+    cache_file(SQLITE_FILENAME);
+    cache_file(SQLITE_FILENAME "-wal");
+    cache_file(SQLITE_FILENAME "-journal");
+    phase_end(&ph);
+    cache_report();
+}
+
+/*
+ * -C warm: the page cache belongs to the connection, so every connection
+ * of a reading action fills its own before the clock starts.
+ */
+static void sqlite_preload(sqlite3 *conn)
+{
+    if (cache_state() == CACHE_WARM)
+        sqlite_exec_sql(conn, "select count(*), sum(length(value)) from tbl;");
+}
+
+void sqlite_dump(void)
+{
+    int rc;
+    sqlite3_stmt *sql_stmt;
+    struct phase ph;
+    uint64_t t0;
+    struct sink *out = print ? sink_new() : NULL;
+
+    phase_begin(&ph, "open");
+
+    sqldb = sqlite_connect();
+    sqlite_print_settings(sqldb);
+    sqlite_preload(sqldb);
+
     rc = sqlite3_prepare(sqldb, "select key,value from tbl;", -1, &sql_stmt, NULL);
     if( rc!=SQLITE_OK ){
         printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(sqldb));
         exit(1);
     }
 
-    while ( SQLITE_ROW == (rc = sqlite3_step(sql_stmt)) )
-	if (print)
-            printf("Key: '%s' - Value: '%s'\n",
-                   sqlite3_column_text(sql_stmt, 0),
-                   sqlite3_column_text(sql_stmt, 1) );
-    
+    phase_end(&ph);
+    phase_begin(&ph, "dump");
+
+    t0 = bench_now();
+    while ( SQLITE_ROW == (rc = sqlite3_step(sql_stmt)) ) {
+        phase_op(&ph, t0);
+        if (out)
+            sqlite_record(out, sql_stmt);
+        t0 = bench_now();
+    }
+
+    sink_free(out);
+    phase_end(&ph);
+    phase_begin(&ph, "close");
+
     sqlite3_finalize(sql_stmt);
 
-    rc = sqlite3_close(sqldb);
-    if (rc != SQLITE_OK)
-        printf("sqlite3_close: %s", sqlite3_errmsg(sqldb));
+    sqlite_disconnect(sqldb);
+
+    phase_end(&ph);
 }
 
-void sqlite_get(unsigned long n)
+/* Fetch the odd keys of the slice, then the even ones */
+static void sqlite_get_worker(struct worker *w)
 {
-    int rc;
+    int rc, pass;
+    sqlite3 *conn;
     sqlite3_stmt *sql_stmt;
     unsigned long i;
+    uint64_t t0;
 
-    rc = sqlite3_open(SQLITE_FILENAME, &sqldb);
-    if (rc != SQLITE_OK) {
-        printf("sqlite3_open: Couldn't open %s", SQLITE_FILENAME);
+    conn = sqlite_connect();
+    sqlite3_busy_handler(conn, sqlite_busy, w);
+    sqlite_preload(conn);
+
+    rc = sqlite3_prepare(conn, "select key,value from tbl where key=?;", -1, &sql_stmt, NULL);
+    if( rc!=SQLITE_OK ){
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
 
-    rc = sqlite3_prepare(sqldb, "select key,value from tbl where key=?;", -1, &sql_stmt, NULL);
+    worker_begin(w);
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = w->first + ((w->first + pass + 1) & 1); i < w->last; i+=2) {
+            t0 = bench_now();
+            rc = sqlite_bind_key(sql_stmt, 1, i);
+            if( rc != SQLITE_OK ){
+                printf("sqlite3_bind error: %s\n", sqlite3_errmsg(conn));
+                exit(1);
+            }
+
+            rc = sqlite3_step(sql_stmt);
+            if ( rc == SQLITE_ROW ){
+                if (w->out)
+                    sqlite_record(w->out, sql_stmt);
+            }
+            sqlite3_reset(sql_stmt);
+            phase_op(&w->ph, t0);
+        }
+    }
+
+    worker_end(w);
+
+    sqlite3_finalize(sql_stmt);
+
+    sqlite_disconnect(conn);
+}
+
+/* Apply the profile once up front and report what is in effect */
+static void sqlite_setup(void)
+{
+    struct phase ph;
+
+    sqlite_check_profile();
+
+    phase_begin(&ph, "open");
+
+    sqldb = sqlite_connect();
+    sqlite_print_settings(sqldb);
+
+    sqlite_disconnect(sqldb);
+
+    phase_end(&ph);
+}
+
+/*
+ * The index is on an expression, and SQLite only uses it for a query that
+ * spells the same expression: the prefix length is part of the SQL.
+ */
+static char *sqlite_index_sql(const char *fmt)
+{
+    char *sql = sqlite3_mprintf(fmt, (int)secondary_prefix());
+
+    if (sql == NULL) {
+        printf("sqlite3_mprintf error: out of memory\n");
+        exit(1);
+    }
+    return sql;
+}
+
+/* Gather every record's indexed field, in key order, for the lookups */
+static void sqlite_collect(void)
+{
+    int rc;
+    sqlite3_stmt *sql_stmt;
+    struct phase ph;
+    char *sql;
+
+    phase_begin(&ph, "collect");
+
+    sqldb = sqlite_connect();
+
+    /* Without the index, or with another prefix, every lookup would scan the table */
+    sql = sqlite_index_sql("select 1 from sqlite_master where type = 'index' and name = 'tbl_value' "
+                           "and sql like '%%substr(value, 1, %d))';");
+    rc = sqlite3_prepare_v2(sqldb, sql, -1, &sql_stmt, NULL);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_step(sql_stmt);
+    if (rc != SQLITE_ROW) {
+        fprintf(stderr, "%s: %s has no index on the first %lu value bytes, populate it with -i\n",
+                progname, SQLITE_FILENAME, (unsigned long)secondary_prefix());
+        exit(1);
+    }
+    sqlite3_free(sql);
+    sqlite3_finalize(sql_stmt);
+
+    sql = sqlite_index_sql("select substr(value, 1, %d) from tbl;");
+    rc = sqlite3_prepare_v2(sqldb, sql, -1, &sql_stmt, NULL);
     if( rc!=SQLITE_OK ){
         printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(sqldb));
         exit(1);
     }
+    sqlite3_free(sql);
 
-    for (i=1; i < n; i+=2) {
-        rc = sqlite3_bind_int(sql_stmt, 1, i);
-        if( rc != SQLITE_OK ){
-            printf("sqlite3_bind_int error: %s\n", sqlite3_errmsg(sqldb));
-            exit(1);
-        }
+    secondary_reset();
+    while ( SQLITE_ROW == (rc = sqlite3_step(sql_stmt)) )
+        secondary_add(sqlite3_column_blob(sql_stmt, 0), sqlite3_column_bytes(sql_stmt, 0));
 
-        rc = sqlite3_step(sql_stmt);
-        if ( rc == SQLITE_ROW ){
-	    if (print)
-		printf("Key: '%s' - Value: '%s'\n",
-		       sqlite3_column_text(sql_stmt, 0),
-		       sqlite3_column_text(sql_stmt, 1) );
-        }
-        sqlite3_reset(sql_stmt);
+    sqlite3_finalize(sql_stmt);
+    sqlite_disconnect(sqldb);
+
+    phase_end(&ph);
+}
+
+static void sqlite_index_get_worker(struct worker *w)
+{
+    int rc;
+    sqlite3 *conn;
+    sqlite3_stmt *sql_stmt;
+    unsigned long i;
+    const void *field;
+    size_t len;
+    char *sql;
+    uint64_t t0;
+
+    conn = sqlite_connect();
+    sqlite3_busy_handler(conn, sqlite_busy, w);
+    sqlite_preload(conn);
+
+    sql = sqlite_index_sql("select key,value from tbl where substr(value, 1, %d)=? limit 1;");
+    rc = sqlite3_prepare(conn, sql, -1, &sql_stmt, NULL);
+    if( rc!=SQLITE_OK ){
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(conn));
+        exit(1);
     }
+    sqlite3_free(sql);
+
+    worker_begin(w);
 
-    for (i=2; i < n; i+=2) {
-        rc = sqlite3_bind_int(sql_stmt, 1, i);
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        field = secondary_key(i, &len);
+        rc = sqlite3_bind_blob(sql_stmt, 1, field, len, SQLITE_STATIC);
         if( rc != SQLITE_OK ){
-            printf("sqlite3_bind_int error: %s\n", sqlite3_errmsg(sqldb));
+            printf("sqlite3_bind error: %s\n", sqlite3_errmsg(conn));
             exit(1);
         }
 
         rc = sqlite3_step(sql_stmt);
         if ( rc == SQLITE_ROW ){
-	    if (print)
-		printf("Key: '%s' - Value: '%s'\n",
-		       sqlite3_column_text(sql_stmt, 0),
-		       sqlite3_column_text(sql_stmt, 1) );
+            if (w->out)
+                sqlite_record(w->out, sql_stmt);
         }
         sqlite3_reset(sql_stmt);
+        phase_op(&w->ph, t0);
     }
-    
+
+    worker_end(w);
+
     sqlite3_finalize(sql_stmt);
 
-    rc = sqlite3_close(sqldb);
-    if (rc != SQLITE_OK)
-        printf("sqlite3_close: %s", sqlite3_errmsg(sqldb));
+    sqlite_disconnect(conn);
 }
 
-static int sqlite_insert(sqlite3_stmt *sql_stmt, unsigned long key, int random)
+static const struct kv_ops sqlite_kv_ops;
+
+void sqlite_get(unsigned long n)
+{
+    sqlite_setup();
+    workload_warmup(NULL, n, &sqlite_kv_ops);
+    if (secondary_prefix()) {
+        sqlite_collect();
+        workers_run("index get", 0, secondary_count(), sqlite_index_get_worker, NULL);
+        return;
+    }
+    workers_run("get", 1, n, sqlite_get_worker, NULL);
+}
+
+/* The value is bound in place in the arena, SQLite copies it once into the page */
+static int sqlite_insert(sqlite3 *conn, sqlite3_stmt *sql_stmt, unsigned long key,
+                         uint64_t *rng)
 {
     int rc;
-    char data[256];
-    int dlen = 14, i;
+    const char *data;
+    size_t dlen;
 
-    if (random)
-        dlen = rand() % (255 - 1) + 1; /* 1 to 255 byte data */
+    STAGE_START();
+    data = value_next(rng, &dlen);
+    STAGE_END(STAGE_GENERATE);
 
-    for (i = 0; i < dlen - 1; i++)
-        data[i] = (key + i) % (128 - 32) + 32;
-    data[i] = 0;
+    /* Binding the key encodes it */
+    rc = sqlite_bind_key(sql_stmt, 1, key);
+    if( rc!=SQLITE_OK ){
+        printf("sqlite3_bind error: %s\n", sqlite3_errmsg(conn));
+        exit(1);
+    }
 
-    rc = sqlite3_bind_int(sql_stmt, 1, key);
+    rc = sqlite3_bind_blob(sql_stmt, 2, data, dlen, SQLITE_STATIC);
     if( rc!=SQLITE_OK ){
-        printf("sqlite3_bind_int error: %s\n", sqlite3_errmsg(sqldb));
+        printf("sqlite3_bind_blob error: %s.\n", sqlite3_errmsg(conn));
+        exit(1);
+    }
+    STAGE_END(STAGE_BIND);
+
+    rc = sqlite3_step(sql_stmt);
+    if( rc!=SQLITE_DONE && rc!=SQLITE_BUSY ){
+        printf("sqlite3_step error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
+    STAGE_END(STAGE_PUT);
 
-    rc = sqlite3_bind_text(sql_stmt, 2, data, dlen, SQLITE_STATIC);
+    sqlite3_reset(sql_stmt);
+    STAGE_END(STAGE_RESET);
+
+    return rc;
+}
+
+/* Deleting a key that is already gone is no error */
+static int sqlite_delete_key(sqlite3 *conn, sqlite3_stmt *sql_stmt, unsigned long key,
+                             uint64_t *rng)
+{
+    int rc;
+
+    (void)rng;
+    rc = sqlite_bind_key(sql_stmt, 1, key);
     if( rc!=SQLITE_OK ){
-        printf("sqlite3_bind_text error: %s.\n", sqlite3_errmsg(sqldb));
+        printf("sqlite3_bind error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
 
     rc = sqlite3_step(sql_stmt);
-    if( rc!=SQLITE_DONE ){
-        printf("sqlite3_step error.\n");
+    if( rc!=SQLITE_DONE && rc!=SQLITE_BUSY ){
+        printf("sqlite3_step error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
 
     sqlite3_reset(sql_stmt);
 
-    return 0;
+    return rc;
 }
 
-void sqlite_populate(unsigned int n, int random, unsigned long txnsize)
+struct sqlite_args {
+    unsigned long txnsize;
+    const char *sql;
+    int (*write)(sqlite3 *conn, sqlite3_stmt *sql_stmt, unsigned long key, uint64_t *rng);
+    unsigned long (*key)(unsigned long i);
+};
+
+/* Insert or delete args->key(i) of the slice, txnsize of them per transaction */
+static void sqlite_txn_worker(struct worker *w)
 {
-    static int inited = 0;
+    struct sqlite_args *args = w->arg;
+    unsigned long txnsize = args->txnsize;
     int rc;
     unsigned long i;
-    char sql_str[200];
-    char *zErrMsg = NULL;
+    sqlite3 *conn;
     sqlite3_stmt *sql_stmt;
+    uint64_t t0;
 
-    unlink(SQLITE_FILENAME);
-    rc = sqlite3_open(SQLITE_FILENAME, &sqldb);
-    if (rc != SQLITE_OK) {
-        printf("sqlite3_open: Couldn't open %s", SQLITE_FILENAME);
+    conn = sqlite_connect();
+    sqlite3_busy_handler(conn, sqlite_busy, w);
+
+    rc = sqlite3_prepare(conn, args->sql, -1, &sql_stmt, NULL);
+    if( rc!=SQLITE_OK ){
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
 
-    if ( ! inited) {
-        rc = sqlite3_prepare(sqldb, "insert into tbl VALUES (?, ?);", -1, &sql_stmt, NULL);
-        if( rc!=SQLITE_OK ){
-            printf("sqlite3_prepare error.\n");
-            exit(1);
+    worker_begin(w);
+
+    /*
+     * Take the write lock up front: two deferred transactions that both
+     * try to upgrade would deadlock and bypass the busy handler.
+     */
+    if (txnsize > 1)
+        sqlite_exec_sql(conn, "BEGIN IMMEDIATE TRANSACTION;");
+
+    for (i = w->first; i < w->last; i++) {
+        t0 = bench_now();
+        if (args->write(conn, sql_stmt, args->key(i), &w->rng) == SQLITE_BUSY) {
+            w->retries++;
+            i--;
+            continue;
+        }
+        if (txnsize > 1 && (i + 1 - w->first) % txnsize == 0) {
+            STAGE_START();
+            sqlite_exec_sql(conn, "END TRANSACTION;");
+            crash_committed(i + 1 - w->first);
+            sqlite_exec_sql(conn, "BEGIN IMMEDIATE TRANSACTION;");
+            STAGE_END(STAGE_COMMIT);
+        } else if (txnsize <= 1) {
+            crash_committed(i + 1 - w->first);
         }
-        inited = 1;
+        phase_op(&w->ph, t0);
     }
 
-    rc = sqlite3_exec(sqldb, "create table tbl(key INTEGER PRIMARY KEY, value BLOB);", NULL, NULL, &zErrMsg);
-    if( rc!=SQLITE_OK ){
-        fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-        sqlite3_free(zErrMsg);
+    if (txnsize > 1)
+        sqlite_exec_sql(conn, "END TRANSACTION;");
+    crash_committed(w->last - w->first);
+
+    worker_end(w);
+
+    sqlite3_finalize(sql_stmt);
+
+    sqlite_disconnect(conn);
+}
+
+/* A fresh database with an empty table */
+void sqlite_create(void)
+{
+    sqlite_check_profile();
+
+    /* A stale WAL would be replayed into the fresh database */
+    unlink(SQLITE_FILENAME);
+    unlink(SQLITE_FILENAME "-wal");
+    unlink(SQLITE_FILENAME "-shm");
+    unlink(SQLITE_FILENAME "-journal");
+    sqldb = sqlite_connect();
+
+    /* Without a rowid the table is a btree on the key, as in the other engines */
+    switch (key_type()) {
+    case KEY_STRING:
+    case KEY_VARSTR:
+        sqlite_exec_sql(sqldb, "create table tbl(key TEXT PRIMARY KEY, value BLOB) without rowid;");
+        break;
+    case KEY_UUID:
+        sqlite_exec_sql(sqldb, "create table tbl(key BLOB PRIMARY KEY, value BLOB) without rowid;");
+        break;
+    default:
+        sqlite_exec_sql(sqldb, "create table tbl(key INTEGER PRIMARY KEY, value BLOB);");
+        break;
+    }
+    if (secondary_prefix()) {
+        char *sql = sqlite_index_sql("create index tbl_value on tbl(substr(value, 1, %d));");
+
+        sqlite_exec_sql(sqldb, sql);
+        sqlite3_free(sql);
+    }
+    sqlite_print_settings(sqldb);
+
+    sqlite_disconnect(sqldb);
+}
+
+/* With -N and -y the parent created the table for the processes */
+void sqlite_populate(unsigned int n, unsigned long txnsize)
+{
+    struct sqlite_args args;
+    struct phase ph;
+
+    if (!procs_child() && !crash_child()) {
+        phase_begin(&ph, "open");
+        sqlite_create();
+        phase_end(&ph);
+    }
+
+    args.txnsize = txnsize;
+    args.sql = "insert into tbl VALUES (?, ?);";
+    args.write = sqlite_insert;
+    args.key = key_order;
+    workers_run("populate", 1, n, sqlite_txn_worker, &args);
+}
+
+void sqlite_delete(unsigned long txnsize)
+{
+    struct sqlite_args args;
+
+    sqlite_setup();
+    args.txnsize = txnsize;
+    args.sql = "delete from tbl where key=?;";
+    args.write = sqlite_delete_key;
+    args.key = delete_key;
+    workers_run("delete", 0, delete_count(), sqlite_txn_worker, &args);
+}
+
+static long long sqlite_pragma_int(sqlite3 *conn, const char *pragma)
+{
+    sqlite3_stmt *sql_stmt;
+    char sql[64];
+    long long v = 0;
+
+    snprintf(sql, sizeof(sql), "PRAGMA %s;", pragma);
+    if (sqlite3_prepare_v2(conn, sql, -1, &sql_stmt, NULL) != SQLITE_OK) {
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(conn));
         exit(1);
     }
+    if (sqlite3_step(sql_stmt) == SQLITE_ROW)
+        v = sqlite3_column_int64(sql_stmt, 0);
+    sqlite3_finalize(sql_stmt);
 
-    sprintf(sql_str,"PRAGMA default_cache_size = %lu;", cache);
+    return v;
+}
+
+/*
+ * VACUUM rebuilds the whole file without its free pages. A database
+ * created with -S auto_vacuum=incremental gets incremental_vacuum
+ * instead, which moves pages from the end of the file into the free ones
+ * and truncates it.
+ */
+void sqlite_compact(void)
+{
+    struct phase ph;
+    long long pages, freelist, after;
+    int incremental;
+    uint64_t t0;
+
+    sqlite_setup();
+
+    sqldb = sqlite_connect();
+    incremental = sqlite_pragma_int(sqldb, "auto_vacuum") == 2;
+    pages = sqlite_pragma_int(sqldb, "page_count");
+    freelist = sqlite_pragma_int(sqldb, "freelist_count");
+
+    phase_begin(&ph, incremental ? "incremental vacuum" : "vacuum");
+    t0 = bench_now();
+    sqlite_exec_sql(sqldb, incremental ? "PRAGMA incremental_vacuum;" : "VACUUM;");
+    phase_op(&ph, t0);
+    phase_end(&ph);
 
-    rc = sqlite3_exec(sqldb, sql_str, NULL, NULL, &zErrMsg);
+    after = sqlite_pragma_int(sqldb, "page_count");
+    printf("Vacuum: %lld pages with %lld free before, %lld after\n", pages, freelist, after);
+    results_metric("sqlite_vacuum_pages_before", "%lld", pages);
+    results_metric("sqlite_vacuum_free_before", "%lld", freelist);
+    results_metric("sqlite_vacuum_pages_after", "%lld", after);
+
+    sqlite_disconnect(sqldb);
+}
+
+/*
+ * -y: open the database a killed process left behind. The first read
+ * rolls back a hot journal or rebuilds the WAL index from the WAL, whose
+ * committed frames stay readable until the next checkpoint.
+ */
+static sqlite3_stmt *sqlite_fetch_stmt;
+
+void sqlite_recover(void)
+{
+    int rc;
+
+    sqldb = sqlite_connect();
+    sqlite_exec_sql(sqldb, "select count(*) from sqlite_master;");
+
+    rc = sqlite3_prepare_v2(sqldb, "select value from tbl where key=?;", -1,
+                            &sqlite_fetch_stmt, NULL);
     if( rc!=SQLITE_OK ){
-        fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-        sqlite3_free(zErrMsg);
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(sqldb));
         exit(1);
     }
+}
 
-    if (txnsize > 1) {
-        rc = sqlite3_exec(sqldb, "BEGIN TRANSACTION;", NULL, NULL, &zErrMsg);
-        if( rc!=SQLITE_OK ){
-            fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-            sqlite3_free(zErrMsg);
-            exit(1);
-        }
+/* -y: the value of key n, if it is there, valid until the next call */
+int sqlite_fetch(unsigned long n, const void **data, size_t *len)
+{
+    int rc;
+
+    sqlite3_reset(sqlite_fetch_stmt);
+    rc = sqlite_bind_key(sqlite_fetch_stmt, 1, n);
+    if( rc != SQLITE_OK ){
+        printf("sqlite3_bind error: %s\n", sqlite3_errmsg(sqldb));
+        exit(1);
     }
-    for (i = 1; i < n; i++) {
-        sqlite_insert(sql_stmt, i, random);
-        if (txnsize > 1 && i % txnsize == 0) {
-            rc = sqlite3_exec(sqldb, "END TRANSACTION;", NULL, NULL, &zErrMsg);
-            if( rc!=SQLITE_OK ){
-                fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-                sqlite3_free(zErrMsg);
-                exit(1);
-            }
-            rc = sqlite3_exec(sqldb, "BEGIN TRANSACTION;", NULL, NULL, &zErrMsg);
-            if( rc!=SQLITE_OK ){
-                fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-                sqlite3_free(zErrMsg);
-                exit(1);
-            }
+    rc = sqlite3_step(sqlite_fetch_stmt);
+    if (rc == SQLITE_DONE)
+        return 0;
+    if (rc != SQLITE_ROW) {
+        printf("sqlite3_step error: %s\n", sqlite3_errmsg(sqldb));
+        exit(1);
+    }
+    *data = sqlite3_column_blob(sqlite_fetch_stmt, 0);
+    *len = sqlite3_column_bytes(sqlite_fetch_stmt, 0);
+    return 1;
+}
+
+void sqlite_recover_close(void)
+{
+    sqlite3_finalize(sqlite_fetch_stmt);
+    sqlite_fetch_stmt = NULL;
+    sqlite_disconnect(sqldb);
+}
+
+/* -y checkpoint=, from the checkpoint thread on a connection of its own */
+void sqlite_checkpoint(void)
+{
+    static sqlite3 *conn;
+    int logged, done, rc;
+
+    if (conn == NULL)
+        conn = sqlite_connect();
+    rc = sqlite3_wal_checkpoint_v2(conn, NULL, SQLITE_CHECKPOINT_PASSIVE, &logged, &done);
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        printf("sqlite3_wal_checkpoint error: %s\n", sqlite3_errmsg(conn));
+        exit(1);
+    }
+}
+
+/*
+ * What the table costs on disk: the file against the key and value bytes
+ * dbstat finds in it, how full its leaf pages are and how many pages sit
+ * on the free list. Without SQLITE_ENABLE_DBSTAT_VTAB only the page
+ * counts are there.
+ */
+void sqlite_print_space(void)
+{
+    sqlite3 *conn;
+    sqlite3_stmt *sql_stmt;
+    struct stat sb;
+    long long pages, freelist, psize;
+    unsigned long long file = 0, wal = 0, payload = 0, leaf = 0, unused = 0, index = 0;
+    double mb = 1024.0 * 1024.0, fill = 0.0;
+    int dbstat;
+
+    conn = sqlite_connect();
+    psize = sqlite_pragma_int(conn, "page_size");
+    pages = sqlite_pragma_int(conn, "page_count");
+    freelist = sqlite_pragma_int(conn, "freelist_count");
+    dbstat = sqlite3_prepare_v2(conn,
+                                "select sum(case when pagetype != 'internal' then payload else 0 end), "
+                                "sum(pagetype = 'leaf'), "
+                                "sum(case when pagetype = 'leaf' then unused else 0 end) "
+                                "from dbstat where name = 'tbl';",
+                                -1, &sql_stmt, NULL) == SQLITE_OK;
+    if (dbstat) {
+        if (sqlite3_step(sql_stmt) == SQLITE_ROW) {
+            payload = sqlite3_column_int64(sql_stmt, 0);
+            leaf = sqlite3_column_int64(sql_stmt, 1);
+            unused = sqlite3_column_int64(sql_stmt, 2);
         }
+        sqlite3_finalize(sql_stmt);
     }
+    if (dbstat && secondary_prefix() &&
+        sqlite3_prepare_v2(conn, "select sum(pgsize) from dbstat where name = 'tbl_value';",
+                           -1, &sql_stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(sql_stmt) == SQLITE_ROW)
+            index = sqlite3_column_int64(sql_stmt, 0);
+        sqlite3_finalize(sql_stmt);
+    }
+    sqlite_disconnect(conn);
 
-    if (txnsize > 1) {
-        rc = sqlite3_exec(sqldb, "END TRANSACTION;", NULL, NULL, &zErrMsg);
-        if( rc!=SQLITE_OK ){
-            fprintf(stderr, "sqlite3_exec error: %s\n", zErrMsg);
-            sqlite3_free(zErrMsg);
-            exit(1);
+    if (stat(SQLITE_FILENAME, &sb) == 0)
+        file = sb.st_size;
+    if (stat(SQLITE_FILENAME "-wal", &sb) == 0)
+        wal = sb.st_size;
+    if (leaf)
+        fill = 1.0 - (double)unused / (leaf * psize);
+
+    printf("Space: %.1f MB file, %lld pages, %lld free", file / mb, pages, freelist);
+    if (dbstat)
+        printf(", leaf fill %.1f%%, %.1f MB of keys and values", 100.0 * fill, payload / mb);
+    if (index)
+        printf(", %.1f MB index", index / mb);
+    if (payload)
+        printf(" (space amplification %.2f)", (double)file / payload);
+    printf(", %.1f MB of WAL\n", wal / mb);
+
+    results_metric("sqlite_file_bytes", "%llu", file);
+    results_metric("sqlite_wal_bytes", "%llu", wal);
+    results_metric("sqlite_pages", "%lld", pages);
+    results_metric("sqlite_free_pages", "%lld", freelist);
+    if (dbstat) {
+        results_metric("sqlite_leaf_fill", "%.3f", fill);
+        results_metric("sqlite_payload_bytes", "%llu", payload);
+    }
+    if (index)
+        results_metric("sqlite_index_bytes", "%llu", index);
+    if (payload)
+        results_metric("sqlite_space_amp", "%.3f", (double)file / payload);
+}
+
+/* Workload primitives, all autocommit */
+struct sqlite_ctx {
+    struct worker *w;
+    sqlite3 *conn;
+    sqlite3_stmt *read, *update, *insert, *scan;
+};
+
+static sqlite3_stmt *sqlite_prepare_stmt(sqlite3 *conn, const char *sql)
+{
+    int rc;
+    sqlite3_stmt *sql_stmt;
+
+    rc = sqlite3_prepare_v2(conn, sql, -1, &sql_stmt, NULL);
+    if( rc!=SQLITE_OK ){
+        printf("sqlite3_prepare error: %s\n", sqlite3_errmsg(conn));
+        exit(1);
+    }
+    return sql_stmt;
+}
+
+static void *sqlite_kv_open(struct worker *w)
+{
+    struct sqlite_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL) {
+        printf("Couldn't allocate workload context\n");
+        exit(1);
+    }
+    ctx->w = w;
+    ctx->conn = sqlite_connect();
+    sqlite3_busy_handler(ctx->conn, sqlite_busy, w);
+    sqlite_preload(ctx->conn);
+    ctx->read = sqlite_prepare_stmt(ctx->conn, "select key,value from tbl where key=?;");
+    ctx->update = sqlite_prepare_stmt(ctx->conn, "update tbl set value=?2 where key=?1;");
+    ctx->insert = sqlite_prepare_stmt(ctx->conn, "insert or replace into tbl VALUES (?, ?);");
+    ctx->scan = sqlite_prepare_stmt(ctx->conn,
+                                    "select key,value from tbl where key>=? order by key limit ?;");
+    return ctx;
+}
+
+static void sqlite_kv_close(void *arg)
+{
+    struct sqlite_ctx *ctx = arg;
+
+    sqlite3_finalize(ctx->read);
+    sqlite3_finalize(ctx->update);
+    sqlite3_finalize(ctx->insert);
+    sqlite3_finalize(ctx->scan);
+    sqlite_disconnect(ctx->conn);
+    free(ctx);
+}
+
+static int sqlite_kv_read(void *arg, unsigned long key)
+{
+    struct sqlite_ctx *ctx = arg;
+    int rc;
+
+    sqlite_bind_key(ctx->read, 1, key);
+    /* Gave up waiting for a writer's exclusive lock, in rollback journal mode */
+    while ((rc = sqlite3_step(ctx->read)) == SQLITE_BUSY) {
+        sqlite3_reset(ctx->read);
+        ctx->w->retries++;
+    }
+    if (rc == SQLITE_ROW && ctx->w->out)
+        sqlite_record(ctx->w->out, ctx->read);
+    sqlite3_reset(ctx->read);
+
+    return rc != SQLITE_ROW;
+}
+
+static int sqlite_kv_write(struct sqlite_ctx *ctx, sqlite3_stmt *sql_stmt, unsigned long key)
+{
+    while (sqlite_insert(ctx->conn, sql_stmt, key, &ctx->w->rng) == SQLITE_BUSY)
+        ctx->w->retries++;
+    return 0;
+}
+
+static int sqlite_kv_update(void *arg, unsigned long key)
+{
+    struct sqlite_ctx *ctx = arg;
+
+    return sqlite_kv_write(ctx, ctx->update, key);
+}
+
+static int sqlite_kv_insert(void *arg, unsigned long key)
+{
+    struct sqlite_ctx *ctx = arg;
+
+    return sqlite_kv_write(ctx, ctx->insert, key);
+}
+
+/* Range read through the prepared key>=? order by key limit ? */
+static unsigned long sqlite_kv_scan(void *arg, unsigned long key, unsigned long len)
+{
+    struct sqlite_ctx *ctx = arg;
+    unsigned long rows = 0;
+    int rc;
+
+    sqlite_bind_key(ctx->scan, 1, key);
+    sqlite3_bind_int64(ctx->scan, 2, len);
+    for (;;) {
+        while ((rc = sqlite3_step(ctx->scan)) == SQLITE_ROW) {
+            rows++;
+            if (ctx->w->out)
+                sqlite_record(ctx->w->out, ctx->scan);
         }
+        sqlite3_reset(ctx->scan);
+        /* Busy before the first row, as reads are */
+        if (rc != SQLITE_BUSY || rows)
+            break;
+        ctx->w->retries++;
     }
 
-    sqlite3_finalize(sql_stmt);
+    return rows;
+}
 
-    rc = sqlite3_close(sqldb);
-    if (rc != SQLITE_OK)
-        printf("sqlite3_close: %s", sqlite3_errmsg(sqldb));
+static const struct kv_ops sqlite_kv_ops = {
+    sqlite_kv_open,
+    sqlite_kv_close,
+    sqlite_kv_read,
+    sqlite_kv_update,
+    sqlite_kv_insert,
+    sqlite_kv_scan
+};
+
+void sqlite_workload(struct workload *wl, unsigned long n)
+{
+    sqlite_setup();
+    workload_run(wl, n, &sqlite_kv_ops);
 }
@@ -1,10 +1,24 @@
 #ifndef SQLITE_H
 #define SQLITE_H
 
+#include "workload.h"
+
 #define SQLITE_FILENAME "sqlite.db"
+#define SQLITE_BUSY_WAIT 60000          /* ms */
 
+extern int sqlite_parse_profile(char *spec);
+extern void sqlite_cache_files(void);
+extern void sqlite_create(void);
 extern void sqlite_dump(void);
 extern void sqlite_get(unsigned long n);
-extern void sqlite_populate(unsigned int n, int random, unsigned long txnsize);
+extern void sqlite_populate(unsigned int n, unsigned long txnsize);
+extern void sqlite_workload(struct workload *wl, unsigned long n);
+extern void sqlite_delete(unsigned long txnsize);
+extern void sqlite_compact(void);
+extern void sqlite_print_space(void);
+extern void sqlite_recover(void);
+extern int sqlite_fetch(unsigned long n, const void **data, size_t *len);
+extern void sqlite_recover_close(void);
+extern void sqlite_checkpoint(void);
 
 #endif
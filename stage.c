@@ -0,0 +1,112 @@
+#ifdef DBRACE_STAGES
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "results.h"
+#include "stage.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "generate", "bind", "put", "reset", "commit"
+};
+
+__thread struct stages *stages_self;
+
+/* The workers' stages, merged as they end */
+static struct stages merged;
+static pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Ticks against ns over the phase */
+static uint64_t cal_ticks, cal_ns;
+
+/* Before workers_run() starts the threads */
+void stages_reset(void)
+{
+    int s;
+
+    for (s = 0; s < STAGE_COUNT; s++)
+        hist_reset(&merged.h[s]);
+    cal_ns = bench_now();
+    cal_ticks = stage_ticks();
+}
+
+/* From the worker thread as its clock starts */
+void stages_begin(void)
+{
+    int s;
+
+    if (stages_self == NULL && (stages_self = malloc(sizeof(*stages_self))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+    for (s = 0; s < STAGE_COUNT; s++)
+        hist_reset(&stages_self->h[s]);
+    stages_self->mark = stage_ticks();
+}
+
+void stages_end(void)
+{
+    int s;
+
+    if (stages_self == NULL)
+        return;
+    pthread_mutex_lock(&merged_lock);
+    for (s = 0; s < STAGE_COUNT; s++)
+        hist_merge(&merged.h[s], &stages_self->h[s]);
+    pthread_mutex_unlock(&merged_lock);
+    free(stages_self);
+    stages_self = NULL;
+}
+
+/*
+ * The table of the stages the phase went through, against ops, the
+ * latencies of its operations: their total less the stages is the loop
+ * and the engine work no stage covers.
+ */
+void stages_report(const char *name, const struct hist *ops)
+{
+    const struct hist *h;
+    double scale, secs, staged = 0, total = ops->sum / 1e9;
+    uint64_t ticks;
+    char key[32];
+    int s, any = 0;
+
+    ticks = stage_ticks() - cal_ticks;
+    scale = ticks ? (double)(bench_now() - cal_ns) / ticks : 1.0;
+
+    for (s = 0; s < STAGE_COUNT; s++)
+        if (merged.h[s].count)
+            any = 1;
+    if (!any)
+        return;
+
+    printf("%s stages:%12s %10s %7s %9s %9s %9s %9s  (usec)\n",
+           name, "count", "total s", "share", "avg", "p50", "p99", "max");
+    for (s = 0; s < STAGE_COUNT; s++) {
+        h = &merged.h[s];
+        if (h->count == 0)
+            continue;
+        secs = h->sum * scale / 1e9;
+        staged += secs;
+        printf("  %-14s%12llu %10.4f %6.1f%% %9.3f %9.3f %9.3f %9.3f\n",
+               stage_names[s], (unsigned long long)h->count, secs,
+               total > 0 ? 100.0 * secs / total : 0.0,
+               hist_mean(h) * scale / 1e3,
+               hist_percentile(h, 50.0) * scale / 1e3,
+               hist_percentile(h, 99.0) * scale / 1e3,
+               h->max * scale / 1e3);
+        snprintf(key, sizeof(key), "%s_%s_secs", name, stage_names[s]);
+        results_metric(key, "%.6f", secs);
+        snprintf(key, sizeof(key), "%s_%s_p99_usec", name, stage_names[s]);
+        results_metric(key, "%.3f", hist_percentile(h, 99.0) * scale / 1e3);
+    }
+    if (total > staged)
+        printf("  %-14s%12s %10.4f %6.1f%%\n", "other", "", total - staged,
+               100.0 * (total - staged) / total);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+/*
+ * Stage breakdown of writes, built in with make STAGES=-DDBRACE_STAGES.
+ * The write paths mark where generating the key and value, binding the
+ * statement, the engine put, resetting the statement and the commit end;
+ * every stage goes into a histogram of the worker thread and
+ * workers_run() prints the merged ones as a table after the phase, next
+ * to what is left of the operations' time. On x86 the marks read the TSC,
+ * scaled to ns over the phase, elsewhere the clock bench_now() reads.
+ * Without -t every put commits itself, inside the put stage. Without
+ * DBRACE_STAGES the marks compile to nothing.
+ */
+enum stage {
+    STAGE_GENERATE,             /* key and value */
+    STAGE_BIND,                 /* sqlite3_bind_* */
+    STAGE_PUT,                  /* db->put, sqlite3_step, mdb_put, leveldb_put */
+    STAGE_RESET,                /* sqlite3_reset */
+    STAGE_COMMIT,               /* commit, and begin the next transaction */
+    STAGE_COUNT
+};
+
+#ifdef DBRACE_STAGES
+
+#include <stdint.h>
+
+#include "bench.h"
+#include "hist.h"
+
+struct stages {
+    uint64_t mark;              /* ticks, end of the last stage */
+    struct hist h[STAGE_COUNT]; /* ticks */
+};
+
+/* The worker's, NULL on threads outside of workers_run() */
+extern __thread struct stages *stages_self;
+
+static inline uint64_t stage_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return bench_now();
+#endif
+}
+
+static inline void stage_start(void)
+{
+    if (stages_self)
+        stages_self->mark = stage_ticks();
+}
+
+/* Account the time since the last mark to stage s */
+static inline void stage_end(enum stage s)
+{
+    uint64_t now;
+
+    if (stages_self == NULL)
+        return;
+    now = stage_ticks();
+    hist_add(&stages_self->h[s], now - stages_self->mark);
+    stages_self->mark = now;
+}
+
+extern void stages_reset(void);
+extern void stages_begin(void);
+extern void stages_end(void);
+extern void stages_report(const char *name, const struct hist *ops);
+
+#define STAGE_START()           stage_start()
+#define STAGE_END(s)            stage_end(s)
+
+#else
+
+#define STAGE_START()           ((void)0)
+#define STAGE_END(s)            ((void)0)
+#define stages_reset()          ((void)0)
+#define stages_begin()          ((void)0)
+#define stages_end()            ((void)0)
+#define stages_report(name, ops) ((void)0)
+
+#endif
+
+#endif
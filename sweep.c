@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "sweep.h"
+
+#define SWEEP_MAX_VALUES 64
+
+static const char *sweep_names[SWEEP_NPARAMS] = {
+    "cache", "page", "txn", "records", "threads", "index"
+};
+
+static unsigned long sweep_values[SWEEP_NPARAMS][SWEEP_MAX_VALUES];
+static int sweep_count[SWEEP_NPARAMS];
+
+static int sweep_add(enum sweep_param p, unsigned long v)
+{
+    if (sweep_count[p] == SWEEP_MAX_VALUES) {
+        fprintf(stderr, "%s: more than %d values for %s\n", progname, SWEEP_MAX_VALUES, sweep_names[p]);
+        return -1;
+    }
+    sweep_values[p][sweep_count[p]++] = v;
+    return 0;
+}
+
+/*
+ * <param>=<item>[,<item>...], where an item is a single value or a range
+ * <lo>:<hi>[:<step>]. The step is added, or multiplied with a leading
+ * '*' (default: +1), e.g. page=512:65536:*2 or txn=1,10:100:+10.
+ */
+int sweep_parse(char *spec)
+{
+    char *value, *item, *next, *end;
+    unsigned long lo, hi, step, v;
+    int p, mult;
+
+    value = strchr(spec, '=');
+    if (value == NULL)
+        return -1;
+    *value++ = '\0';
+    for (p = 0; p < SWEEP_NPARAMS; p++)
+        if (strcmp(spec, sweep_names[p]) == 0)
+            break;
+    if (p == SWEEP_NPARAMS) {
+        fprintf(stderr, "%s: can't sweep '%s'\n", progname, spec);
+        return -1;
+    }
+
+    for (item = value; item; item = next) {
+        if ((next = strchr(item, ',')) != NULL)
+            *next++ = '\0';
+
+        lo = strtoul(item, &end, 0);
+        if (end == item)
+            return -1;
+        if (*end != ':') {
+            if (*end != '\0' || sweep_add(p, lo) != 0)
+                return -1;
+            continue;
+        }
+
+        item = end + 1;
+        hi = strtoul(item, &end, 0);
+        if (end == item || hi < lo)
+            return -1;
+        step = 1;
+        mult = 0;
+        if (*end == ':') {
+            item = end + 1;
+            if (*item == '*') {
+                mult = 1;
+                item++;
+            } else if (*item == '+') {
+                item++;
+            }
+            step = strtoul(item, &end, 0);
+            if (end == item || (mult && step < 2) || step < 1)
+                return -1;
+        }
+        if (*end != '\0')
+            return -1;
+
+        for (v = lo; v <= hi; v = mult ? v * step : v + step) {
+            if (sweep_add(p, v) != 0)
+                return -1;
+            if (mult && v == 0)
+                break;
+        }
+    }
+
+    return 0;
+}
+
+int sweep_active(void)
+{
+    int p;
+
+    for (p = 0; p < SWEEP_NPARAMS; p++)
+        if (sweep_count[p])
+            return 1;
+    return 0;
+}
+
+/*
+ * Run bench in a child process, stdout silenced, and collect the phase
+ * results it sends back through a pipe. Returns the number of results or
+ * -1 if the child failed.
+ */
+static int sweep_child(void (*bench)(void), struct phase_result *res, int max)
+{
+    const struct phase_result *mine;
+    int fd[2], count, status;
+    ssize_t got, len = 0;
+    pid_t pid;
+
+    if (pipe(fd) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL)
+            _exit(1);
+        bench();
+        mine = bench_results(&count);
+        if (count > max)
+            count = max;
+        if (write(fd[1], mine, count * sizeof(*mine)) != (ssize_t)(count * sizeof(*mine)))
+            _exit(1);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    close(fd[1]);
+    while ((got = read(fd[0], (char *)res + len, max * sizeof(*res) - len)) > 0 ||
+           (got < 0 && errno == EINTR))
+        if (got > 0)
+            len += got;
+    close(fd[0]);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+
+    return len / sizeof(*res);
+}
+
+/* The measured loop is the phase that did the most operations */
+static const struct phase_result *sweep_main_phase(const struct phase_result *res, int count)
+{
+    const struct phase_result *best = NULL;
+    int i;
+
+    for (i = 0; i < count; i++)
+        if (best == NULL || res[i].ops >= best->ops)
+            best = &res[i];
+    return best && best->ops ? best : NULL;
+}
+
+static void sweep_stats(const double *v, int n, double *mean, double *sd)
+{
+    double sum = 0, sq = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += v[i];
+    *mean = n ? sum / n : 0;
+    for (i = 0; i < n; i++)
+        sq += (v[i] - *mean) * (v[i] - *mean);
+    *sd = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+void sweep_run(int reps, void (*set)(enum sweep_param, unsigned long), void (*bench)(void))
+{
+    struct phase_result res[BENCH_MAX_RESULTS];
+    const struct phase_result *main_phase;
+    int idx[SWEEP_NPARAMS] = { 0 };
+    double *rate, *p99, *p999, max, mean, sd, p99_mean, p99_sd, p999_mean, p999_sd;
+    const char *name = NULL;
+    int combos = 1, p, r, count, ok;
+
+    if (reps < 1)
+        reps = 1;
+    for (p = 0; p < SWEEP_NPARAMS; p++)
+        if (sweep_count[p])
+            combos *= sweep_count[p];
+
+    rate = calloc(reps, sizeof(*rate));
+    p99 = calloc(reps, sizeof(*p99));
+    p999 = calloc(reps, sizeof(*p999));
+    if (rate == NULL || p99 == NULL || p999 == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+
+    printf("Sweep: %d combination%s x %d repetition%s\n\n",
+           combos, combos > 1 ? "s" : "", reps, reps > 1 ? "s" : "");
+    for (p = 0; p < SWEEP_NPARAMS; p++)
+        if (sweep_count[p])
+            printf("%10s ", sweep_names[p]);
+    printf("%12s %10s %10s %10s %10s %10s  %s\n",
+           "ops/sec", "stddev", "p99 usec", "stddev", "p99.9 usec", "max usec", "phase");
+
+    for (;;) {
+        for (p = 0; p < SWEEP_NPARAMS; p++)
+            if (sweep_count[p])
+                set(p, sweep_values[p][idx[p]]);
+
+        ok = 0;
+        max = 0;
+        for (r = 0; r < reps; r++) {
+            count = sweep_child(bench, res, BENCH_MAX_RESULTS);
+            if (count < 0 || (main_phase = sweep_main_phase(res, count)) == NULL)
+                continue;
+            name = main_phase->name;
+            rate[ok] = main_phase->secs > 0 ? main_phase->ops / main_phase->secs : 0;
+            p99[ok] = main_phase->p99;
+            p999[ok] = main_phase->p999;
+            if (main_phase->max > max)
+                max = main_phase->max;
+            ok++;
+        }
+
+        for (p = 0; p < SWEEP_NPARAMS; p++)
+            if (sweep_count[p])
+                printf("%10lu ", sweep_values[p][idx[p]]);
+        if (ok == 0) {
+            printf("%12s\n", "failed");
+        } else {
+            sweep_stats(rate, ok, &mean, &sd);
+            sweep_stats(p99, ok, &p99_mean, &p99_sd);
+            sweep_stats(p999, ok, &p999_mean, &p999_sd);
+            printf("%12.1f %10.1f %10.2f %10.2f %10.2f %10.2f  %s",
+                   mean, sd, p99_mean, p99_sd, p999_mean, max, name);
+            if (ok < reps)
+                printf(" (%d of %d runs failed)", reps - ok, reps);
+            printf("\n");
+        }
+        fflush(stdout);
+
+        /* Next combination, the last parameter varies fastest */
+        for (p = SWEEP_NPARAMS - 1; p >= 0; p--) {
+            if (sweep_count[p] == 0)
+                continue;
+            if (++idx[p] < sweep_count[p])
+                break;
+            idx[p] = 0;
+        }
+        if (p < 0)
+            break;
+    }
+
+    free(rate);
+    free(p99);
+    free(p999);
+}
@@ -0,0 +1,25 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/*
+ * Parameter sweep: -X <param>=<values> gives a list or range of values
+ * for one parameter; the benchmark then runs once per combination of all
+ * swept parameters, every run in a freshly forked process on a freshly
+ * populated database, and the results are summarised in one table.
+ */
+enum sweep_param {
+    SWEEP_CACHE,
+    SWEEP_PAGE,
+    SWEEP_TXN,
+    SWEEP_RECORDS,
+    SWEEP_THREADS,
+    SWEEP_INDEX,
+    SWEEP_NPARAMS
+};
+
+extern int sweep_parse(char *spec);
+extern int sweep_active(void);
+extern void sweep_run(int reps, void (*set)(enum sweep_param, unsigned long),
+                      void (*bench)(void));
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "rng.h"
+#include "results.h"
+#include "value.h"
+
+#define VALUE_ARENA_MIN (16UL * 1024 * 1024)
+
+static const char *value_dist_names[] = {
+    "fixed", "uniform", "normal", "lognormal", "bimodal"
+};
+
+static enum value_dist value_dist = VALUE_FIXED;
+static size_t value_size = 14;          /* fixed, mean, median or small size */
+static size_t value_min = 1;
+static size_t value_maxsize = 0;        /* 0: derived from the distribution */
+static size_t value_large = 0;          /* bimodal */
+static double value_stddev = 0;         /* normal, 0: size / 4 */
+static double value_sigma = 1.0;        /* lognormal */
+static double value_frac = 0.1;         /* bimodal: fraction of large values */
+static size_t value_arena_size = 0;     /* 0: VALUE_ARENA_MIN or 4 x max */
+
+static char *arena;
+static size_t arena_len;
+
+/* <n>[k|m|g] */
+static int value_bytes(const char *s, size_t *bytes)
+{
+    char *end;
+    unsigned long v;
+
+    if (s == NULL)
+        return -1;
+    v = strtoul(s, &end, 0);
+    if (end == s)
+        return -1;
+    switch (*end) {
+    case 'k': case 'K':
+        v *= 1024;
+        end++;
+        break;
+    case 'm': case 'M':
+        v *= 1024 * 1024;
+        end++;
+        break;
+    case 'g': case 'G':
+        v *= 1024UL * 1024 * 1024;
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return -1;
+    *bytes = v;
+    return 0;
+}
+
+int value_parse(char *spec)
+{
+    char *const tokens[] = {
+        "fixed", "uniform", "normal", "lognormal", "bimodal",
+        "size", "min", "max", "large", "stddev", "sigma", "frac", "arena", NULL
+    };
+    char *value;
+    int tok;
+
+    while (*spec) {
+        tok = getsubopt(&spec, tokens, &value);
+        if (tok >= VALUE_FIXED && tok <= VALUE_BIMODAL) {
+            value_dist = tok;
+            continue;
+        }
+        switch (tok) {
+        case 5:
+            if (value_bytes(value, &value_size) != 0 || value_size == 0)
+                return -1;
+            break;
+        case 6:
+            if (value_bytes(value, &value_min) != 0 || value_min == 0)
+                return -1;
+            break;
+        case 7:
+            if (value_bytes(value, &value_maxsize) != 0)
+                return -1;
+            break;
+        case 8:
+            if (value_bytes(value, &value_large) != 0)
+                return -1;
+            break;
+        case 9:
+            if (value == NULL || (value_stddev = atof(value)) <= 0)
+                return -1;
+            break;
+        case 10:
+            if (value == NULL || (value_sigma = atof(value)) <= 0)
+                return -1;
+            break;
+        case 11:
+            if (value == NULL || (value_frac = atof(value)) < 0 || value_frac > 1)
+                return -1;
+            break;
+        case 12:
+            if (value_bytes(value, &value_arena_size) != 0)
+                return -1;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown value option '%s'\n", progname, value);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Largest value the distribution can produce */
+size_t value_max(void)
+{
+    switch (value_dist) {
+    case VALUE_FIXED:
+        return value_size;
+    case VALUE_UNIFORM:
+        return value_maxsize ? value_maxsize : 255;
+    case VALUE_BIMODAL:
+        return value_large > value_size ? value_large : value_size;
+    default:
+        return value_maxsize ? value_maxsize : 8 * value_size;
+    }
+}
+
+static size_t value_clamp(double v)
+{
+    size_t max = value_max();
+
+    if (v < value_min)
+        return value_min;
+    if (v > max)
+        return max;
+    return (size_t)v;
+}
+
+/* Box-Muller, one of the pair is thrown away */
+static double value_gauss(uint64_t *rng)
+{
+    double u = rng_double(rng), v = rng_double(rng);
+
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2 * M_PI * v);
+}
+
+static size_t value_draw(uint64_t *rng)
+{
+    size_t max = value_max();
+
+    switch (value_dist) {
+    case VALUE_UNIFORM:
+        return value_min + rng_below(rng, max - value_min + 1);
+    case VALUE_NORMAL:
+        return value_clamp(value_size + value_gauss(rng) *
+                           (value_stddev ? value_stddev : value_size / 4.0));
+    case VALUE_LOGNORMAL:
+        return value_clamp(value_size * exp(value_sigma * value_gauss(rng)));
+    case VALUE_BIMODAL:
+        return rng_double(rng) < value_frac ? value_large : value_size;
+    default:
+        return value_size;
+    }
+}
+
+/*
+ * A slice of the arena that is len bytes long. The slices of different
+ * records overlap, which is fine for engines that don't compress.
+ */
+const char *value_next(uint64_t *rng, size_t *len)
+{
+    *len = value_draw(rng);
+    return arena + rng_below(rng, arena_len - *len + 1);
+}
+
+/* Fill the arena once, further calls (sweep runs) keep it */
+void value_init(void)
+{
+    struct phase ph;
+    uint64_t rng, r = 0;
+    size_t i;
+
+    if (arena)
+        return;
+
+    if (value_dist != VALUE_FIXED && value_dist != VALUE_BIMODAL && value_min > value_max()) {
+        fprintf(stderr, "%s: the minimum value size is above the maximum\n", progname);
+        exit(1);
+    }
+    if (value_dist == VALUE_BIMODAL && value_large == 0) {
+        fprintf(stderr, "%s: bimodal values need large=<size>\n", progname);
+        exit(1);
+    }
+
+    arena_len = value_arena_size;
+    if (arena_len == 0)
+        arena_len = VALUE_ARENA_MIN;
+    if (arena_len < 4 * value_max())
+        arena_len = 4 * value_max();
+
+    if ((arena = malloc(arena_len)) == NULL) {
+        fprintf(stderr, "%s: couldn't allocate a %lu MB value arena\n",
+                progname, (unsigned long)(arena_len / (1024 * 1024)));
+        exit(1);
+    }
+
+    phase_begin(&ph, "values");
+    rng = rng_seed(random_seed);
+    for (i = 0; i < arena_len; i++) {
+        if (i % 8 == 0)
+            r = rng_next(&rng);
+        arena[i] = ' ' + (r & 0xff) % 95;
+        r >>= 8;
+    }
+    phase_end(&ph);
+}
+
+void value_print(void)
+{
+    printf("Values: %s", value_dist_names[value_dist]);
+    switch (value_dist) {
+    case VALUE_FIXED:
+        printf(" %lu bytes", (unsigned long)value_size);
+        break;
+    case VALUE_UNIFORM:
+        printf(" %lu-%lu bytes", (unsigned long)value_min, (unsigned long)value_max());
+        break;
+    case VALUE_NORMAL:
+        printf(" mean %lu stddev %.0f bytes", (unsigned long)value_size,
+               value_stddev ? value_stddev : value_size / 4.0);
+        break;
+    case VALUE_LOGNORMAL:
+        printf(" median %lu bytes sigma %.2f", (unsigned long)value_size, value_sigma);
+        break;
+    case VALUE_BIMODAL:
+        printf(" %lu bytes, %.0f%% %lu bytes", (unsigned long)value_size,
+               100 * value_frac, (unsigned long)value_large);
+        break;
+    }
+    if (value_dist == VALUE_NORMAL || value_dist == VALUE_LOGNORMAL)
+        printf(", %lu-%lu", (unsigned long)value_min, (unsigned long)value_max());
+    printf("\n");
+
+    results_option("value_dist", "%s", value_dist_names[value_dist]);
+    results_option("value_size", "%lu", (unsigned long)value_size);
+    results_option("value_max", "%lu", (unsigned long)value_max());
+    results_option("seed", "%lu", random_seed);
+}
@@ -0,0 +1,28 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Record values. Before the run an arena of printable bytes is filled
+ * once; every write then takes a size from the configured distribution
+ * and a random slice of the arena of that size, which backends hand to
+ * the engine without copying. Neither generating the bytes nor the
+ * distribution's math is part of a timed operation beyond the size draw.
+ */
+enum value_dist {
+    VALUE_FIXED,
+    VALUE_UNIFORM,              /* min..max */
+    VALUE_NORMAL,               /* mean size, stddev */
+    VALUE_LOGNORMAL,            /* median size, shape sigma */
+    VALUE_BIMODAL               /* size, frac of them large */
+};
+
+extern int value_parse(char *spec);
+extern void value_init(void);
+extern void value_print(void);
+extern size_t value_max(void);
+extern const char *value_next(uint64_t *rng, size_t *len);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __sun
+#include <sys/types.h>
+#include <sys/processor.h>
+#include <sys/procset.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "dbrace.h"
+#include "rng.h"
+#include "worker.h"
+#include "procs.h"
+#include "stage.h"
+
+static pthread_barrier_t start_barrier;
+static void (*worker_fn)(struct worker *);
+
+static void worker_pin(struct worker *w)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = w->id % (ncpus > 0 ? ncpus : 1);
+
+#if defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "%s: couldn't pin thread %d to cpu %d\n", progname, w->id, cpu);
+#elif defined(__sun)
+    if (processor_bind(P_LWPID, P_MYID, cpu, NULL) != 0)
+        fprintf(stderr, "%s: couldn't pin thread %d to cpu %d\n", progname, w->id, cpu);
+#else
+    fprintf(stderr, "%s: cpu pinning not supported on this platform\n", progname);
+#endif
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+
+    if (pin_cpus)
+        worker_pin(w);
+    worker_fn(w);
+    return NULL;
+}
+
+void worker_begin(struct worker *w)
+{
+    pthread_barrier_wait(&start_barrier);
+    stages_begin();
+    phase_start(&w->ph, w->ph.name);
+}
+
+void worker_end(struct worker *w)
+{
+    /* What is left of the output is part of the run */
+    sink_flush(w->out);
+    phase_stop(&w->ph);
+    stages_end();
+}
+
+/*
+ * Run fn on nthreads threads, each with its own slice of [first, last),
+ * and report per-thread and aggregate throughput. The aggregate phase
+ * spans from the first worker starting its clock to the last one
+ * stopping it; per-thread setup and teardown are reported separately.
+ */
+void workers_run(const char *name, unsigned long first, unsigned long last,
+                 void (*fn)(struct worker *), void *arg)
+{
+    struct worker *workers;
+    struct phase total, setup, teardown;
+    unsigned long chunk, range;
+    uint64_t launched, started = UINT64_MAX, stopped = 0;
+    unsigned long retries = 0;
+    uint64_t retry_wait = 0;
+    int i, rc, owner;
+
+    workers = calloc(nthreads, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+
+    /* -N: the slice of this process */
+    procs_slice(&first, &last);
+    range = last > first ? last - first : 0;
+
+    worker_fn = fn;
+    pthread_barrier_init(&start_barrier, NULL, nthreads);
+    chunk = (range + nthreads - 1) / nthreads;
+
+    stages_reset();
+
+    /* With -I all workers add to one time series */
+    owner = interval_open(name);
+
+    /*
+     * Resource and engine counter baselines before any worker runs; the
+     * clock of the total is set from the workers' below.
+     */
+    phase_begin(&total, name);
+    launched = bench_now();
+    for (i = 0; i < nthreads; i++) {
+        struct worker *w = &workers[i];
+
+        w->id = i;
+        w->first = first + i * chunk;
+        w->last = w->first + chunk;
+        if (w->first > last)
+            w->first = last;
+        if (w->last > last)
+            w->last = last;
+        w->rng = rng_seed(random_seed + procs_id() * nthreads + i);
+        w->arg = arg;
+        w->out = print ? sink_new() : NULL;
+        w->ph.name = name;
+
+        rc = pthread_create(&w->thread, NULL, worker_main, w);
+        if (rc != 0) {
+            fprintf(stderr, "%s: pthread_create: %s\n", progname, strerror(rc));
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        struct worker *w = &workers[i];
+
+        pthread_join(w->thread, NULL);
+        if (w->ph.start < started)
+            started = w->ph.start;
+        if (w->ph.start + w->ph.elapsed > stopped)
+            stopped = w->ph.start + w->ph.elapsed;
+        total.ops += w->ph.ops;
+        retries += w->retries;
+        retry_wait += w->retry_wait;
+        hist_merge(&total.lat, &w->ph.lat);
+        sink_free(w->out);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    phase_stop(&total);
+    if (owner)
+        interval_close();
+
+    setup.name = "setup";
+    setup.start = launched;
+    setup.ops = 0;
+    setup.sampled = 0;
+    hist_reset(&setup.lat);
+    setup.elapsed = started - launched;
+    teardown.name = "teardown";
+    teardown.start = stopped;
+    teardown.ops = 0;
+    teardown.sampled = 0;
+    hist_reset(&teardown.lat);
+    teardown.elapsed = bench_now() - stopped;
+    total.start = started;
+    total.elapsed = stopped - started;
+
+    phase_report(&setup);
+    if (nthreads > 1) {
+        for (i = 0; i < nthreads; i++) {
+            struct worker *w = &workers[i];
+            double secs = w->ph.elapsed / 1e9;
+
+            printf("%s[%d]: %lu ops in %.6f s, %.1f ops/sec, p99 %.2f usec\n",
+                   name, i, w->ph.ops, secs, secs > 0 ? w->ph.ops / secs : 0.0,
+                   hist_percentile(&w->ph.lat, 99.0) / 1e3);
+        }
+    }
+    phase_report(&total);
+    stages_report(name, &total.lat);
+    if (retries)
+        printf("%s: %lu retries after deadlock or busy errors\n", name, retries);
+    if (retry_wait)
+        printf("%s: %.3f s lost to busy waits and deadlock retries\n", name, retry_wait / 1e9);
+    phase_report(&teardown);
+
+    free(workers);
+}
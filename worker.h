@@ -0,0 +1,34 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+
+#include "bench.h"
+#include "sink.h"
+
+/*
+ * Worker pool: the key range [first, last) of an action is split into
+ * nthreads contiguous slices and every slice is run by its own thread.
+ * A worker does its private setup (connection, cursor, buffers), then
+ * calls worker_begin() which waits until all threads are ready and starts
+ * the clock, runs its loop recording into w->ph and calls worker_end().
+ */
+struct worker {
+    int id;
+    unsigned long first;        /* first key of this slice */
+    unsigned long last;         /* one past the last key */
+    uint64_t rng;               /* private rng.h state */
+    void *arg;                  /* passed through from workers_run() */
+    unsigned long retries;      /* operations redone after deadlock/busy */
+    uint64_t retry_wait;        /* ns lost to conflicts: busy waits, attempts redone */
+    struct sink *out;           /* -o, NULL otherwise */
+    struct phase ph;
+    pthread_t thread;
+};
+
+extern void workers_run(const char *name, unsigned long first, unsigned long last,
+                        void (*fn)(struct worker *), void *arg);
+extern void worker_begin(struct worker *w);
+extern void worker_end(struct worker *w);
+
+#endif
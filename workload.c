@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "dbrace.h"
+#include "bench.h"
+#include "rng.h"
+#include "worker.h"
+#include "results.h"
+#include "cache.h"
+#include "workload.h"
+#include "procs.h"
+
+static const char *wl_op_names[WL_NOPS] = {
+    "read", "update", "insert", "scan", "rmw"
+};
+
+static const char *wl_dist_names[] = {
+    "uniform", "zipfian", "latest", "hotspot"
+};
+
+/* Operations that write, the rest go to the readers of a contention run */
+static const int wl_op_writes[WL_NOPS] = { 0, 1, 1, 0, 1 };
+
+enum wl_role {
+    WL_READER,
+    WL_WRITER,
+    WL_MIXED
+};
+
+static const char *wl_role_names[] = {
+    "readers", "writers"
+};
+
+/* Weights of the YCSB core workloads A-F */
+static const double wl_presets[6][WL_NOPS] = {
+    /* read update insert scan rmw */
+    { 50, 50, 0, 0, 0 },        /* a: update heavy */
+    { 95,  5, 0, 0, 0 },        /* b: read mostly */
+    { 100, 0, 0, 0, 0 },        /* c: read only */
+    { 95,  0, 5, 0, 0 },        /* d: read latest */
+    { 0,   0, 5, 95, 0 },       /* e: short ranges */
+    { 50,  0, 0, 0, 50 },       /* f: read-modify-write */
+};
+
+struct wl_run {
+    struct workload *wl;
+    const struct kv_ops *kv;
+    struct hist *lat;           /* nthreads * WL_NOPS histograms */
+    unsigned long misses;
+    unsigned long scanned;      /* records read by scans */
+    uint64_t elapsed;           /* ns, longest worker */
+    uint64_t deadline;          /* ns, warm-up: stop at this time */
+
+    /* Contention: readers poll writing without the lock, it only goes down */
+    volatile int writing;       /* writers still running */
+    unsigned long per_writer;   /* operations of every writer */
+    struct wl_role_stats {
+        unsigned long ops, retries;
+        uint64_t elapsed;       /* ns, longest worker */
+        uint64_t retry_wait;    /* ns, all workers */
+    } roles[2];
+};
+
+int workload_parse(struct workload *wl, char *spec)
+{
+    char *const tokens[] = {
+        "a", "b", "c", "d", "e", "f",
+        "read", "update", "insert", "scan", "rmw",
+        "dist", "theta", "hotset", "hotops", "ops", "scanlen",
+        "readers", "writers",
+        NULL
+    };
+    char *value, *end;
+    int i, tok;
+    double sum = 0;
+
+    memset(wl, 0, sizeof(*wl));
+    wl->dist = WL_ZIPFIAN;
+    wl->theta = 0.99;
+    wl->hotset = 0.2;
+    wl->hotops = 0.8;
+    wl->scanlen = 100;
+
+    while (*spec) {
+        tok = getsubopt(&spec, tokens, &value);
+        if (tok < 0) {
+            fprintf(stderr, "%s: unknown workload option '%s'\n", progname, value);
+            return -1;
+        }
+        if (tok < 6) {
+            memcpy(wl->mix, wl_presets[tok], sizeof(wl->mix));
+            if (tok == 3)
+                wl->dist = WL_LATEST;
+            continue;
+        }
+        if (value == NULL) {
+            fprintf(stderr, "%s: workload option '%s' needs a value\n", progname, tokens[tok]);
+            return -1;
+        }
+        if (tok < 6 + WL_NOPS) {
+            wl->mix[tok - 6] = strtod(value, NULL);
+            continue;
+        }
+        if (strcmp(tokens[tok], "dist") == 0) {
+            for (i = 0; i <= WL_HOTSPOT; i++)
+                if (strcmp(value, wl_dist_names[i]) == 0)
+                    break;
+            if (i > WL_HOTSPOT) {
+                fprintf(stderr, "%s: unknown key distribution '%s'\n", progname, value);
+                return -1;
+            }
+            wl->dist = i;
+        } else if (strcmp(tokens[tok], "theta") == 0) {
+            wl->theta = strtod(value, NULL);
+        } else if (strcmp(tokens[tok], "hotset") == 0) {
+            wl->hotset = strtod(value, NULL);
+        } else if (strcmp(tokens[tok], "hotops") == 0) {
+            wl->hotops = strtod(value, NULL);
+        } else if (strcmp(tokens[tok], "ops") == 0) {
+            wl->ops = strtoul(value, NULL, 0);
+        } else if (strcmp(tokens[tok], "scanlen") == 0) {
+            wl->scanlen = strtoul(value, &end, 0);
+            wl->scanmax = *end == ':' ? strtoul(end + 1, NULL, 0) : 0;
+        } else if (strcmp(tokens[tok], "readers") == 0) {
+            wl->readers = atoi(value);
+        } else if (strcmp(tokens[tok], "writers") == 0) {
+            wl->writers = atoi(value);
+        }
+    }
+
+    for (i = 0; i < WL_NOPS; i++) {
+        if (wl->mix[i] < 0)
+            return -1;
+        sum += wl->mix[i];
+    }
+    if (sum == 0)
+        memcpy(wl->mix, wl_presets[0], sizeof(wl->mix));
+
+    if (wl->theta <= 0 || wl->theta >= 1) {
+        fprintf(stderr, "%s: zipfian theta must be between 0 and 1\n", progname);
+        return -1;
+    }
+    if (wl->hotset <= 0 || wl->hotset > 1 || wl->hotops < 0 || wl->hotops > 1) {
+        fprintf(stderr, "%s: hotset and hotops are fractions\n", progname);
+        return -1;
+    }
+    if (wl->readers < 0 || wl->writers < 0) {
+        fprintf(stderr, "%s: readers and writers are thread counts\n", progname);
+        return -1;
+    }
+    if (wl->scanlen == 0)
+        wl->scanlen = 1;
+    if (wl->scanmax && wl->scanmax < wl->scanlen) {
+        fprintf(stderr, "%s: the maximum scan length is below the minimum\n", progname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* -L: the workload options, but every operation is a range scan */
+int workload_parse_scan(struct workload *wl, char *spec)
+{
+    if (workload_parse(wl, spec) != 0)
+        return -1;
+    memset(wl->mix, 0, sizeof(wl->mix));
+    wl->mix[WL_SCAN] = 1;
+    return 0;
+}
+
+void workload_print(const struct workload *wl)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < WL_NOPS; i++)
+        sum += wl->mix[i];
+
+    printf("Workload:");
+    for (i = 0; i < WL_NOPS; i++)
+        if (wl->mix[i] > 0)
+            printf(" %s %.1f%%", wl_op_names[i], 100.0 * wl->mix[i] / sum);
+    printf("\n");
+    if (wl->readers || wl->writers)
+        printf("Contention: %d readers, %d writers\n", wl->readers, wl->writers);
+
+    printf("Key distribution: %s", wl_dist_names[wl->dist]);
+    if (wl->dist == WL_ZIPFIAN || wl->dist == WL_LATEST)
+        printf(" (theta %.2f)", wl->theta);
+    else if (wl->dist == WL_HOTSPOT)
+        printf(" (%.0f%% of ops on %.0f%% of keys)", 100 * wl->hotops, 100 * wl->hotset);
+    printf("\n");
+    if (wl->mix[WL_SCAN] > 0 && wl->scanmax > wl->scanlen)
+        printf("Scan length: %lu-%lu\n", wl->scanlen, wl->scanmax);
+    else if (wl->mix[WL_SCAN] > 0)
+        printf("Scan length: %lu\n", wl->scanlen);
+}
+
+/*
+ * Zipfian generator after Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases", as used by YCSB. zeta(n) is computed once over
+ * the populated records, which is O(n) but happens before the clock runs.
+ */
+static void zipf_init(struct workload *wl, unsigned long items)
+{
+    unsigned long i;
+    double theta = wl->theta;
+
+    wl->zetan = 0;
+    for (i = 1; i <= items; i++)
+        wl->zetan += 1.0 / pow((double)i, theta);
+    wl->zeta2 = 1.0 + pow(0.5, theta);
+    wl->alpha = 1.0 / (1.0 - theta);
+    wl->eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - wl->zeta2 / wl->zetan);
+}
+
+/* Rank in [0, records), 0 being the most popular */
+static unsigned long zipf_next(const struct workload *wl, uint64_t *rng)
+{
+    double u = rng_double(rng);
+    double uz = u * wl->zetan;
+    unsigned long rank;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < wl->zeta2)
+        return 1;
+    rank = (unsigned long)(wl->records * pow(wl->eta * u - wl->eta + 1, wl->alpha));
+    return rank < wl->records ? rank : wl->records - 1;
+}
+
+static uint64_t fnv_hash64(uint64_t v)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        h ^= v & 0xff;
+        h *= 0x100000001B3ULL;
+        v >>= 8;
+    }
+    return h;
+}
+
+/* Pick a key in [1, maxkey] */
+static unsigned long workload_key(const struct workload *wl, uint64_t *rng, unsigned long maxkey)
+{
+    unsigned long rank, hot;
+
+    switch (wl->dist) {
+    case WL_ZIPFIAN:
+        return 1 + fnv_hash64(zipf_next(wl, rng)) % maxkey;
+    case WL_LATEST:
+        rank = zipf_next(wl, rng);
+        return rank < maxkey ? maxkey - rank : 1;
+    case WL_HOTSPOT:
+        hot = (unsigned long)(maxkey * wl->hotset);
+        if (hot == 0)
+            hot = 1;
+        if (rng_double(rng) < wl->hotops || hot == maxkey)
+            return 1 + rng_below(rng, hot);
+        return 1 + hot + rng_below(rng, maxkey - hot);
+    case WL_UNIFORM:
+    default:
+        return 1 + rng_below(rng, maxkey);
+    }
+}
+
+static enum wl_op workload_op(const double *cumulative, uint64_t *rng)
+{
+    double u = rng_double(rng);
+    int i;
+
+    for (i = 0; i < WL_NOPS - 1; i++)
+        if (u < cumulative[i])
+            break;
+    return i;
+}
+
+/*
+ * Take add keys from next_key and return the first, or with add 0 how
+ * far the inserts got. With GCC it's an atomic add, elsewhere under
+ * wl->lock.
+ */
+static unsigned long workload_next_key(struct workload *wl, unsigned long add)
+{
+#ifdef __GNUC__
+    return __sync_fetch_and_add(&wl->next_key, add);
+#else
+    unsigned long key;
+
+    pthread_mutex_lock(&wl->lock);
+    key = wl->next_key;
+    wl->next_key += add;
+    pthread_mutex_unlock(&wl->lock);
+    return key;
+#endif
+}
+
+static enum wl_role workload_role(const struct workload *wl, int id)
+{
+    if (wl->readers == 0 && wl->writers == 0)
+        return WL_MIXED;
+    return id < wl->writers ? WL_WRITER : WL_READER;
+}
+
+static void workload_worker(struct worker *w)
+{
+    struct wl_run *run = w->arg;
+    struct workload *wl = run->wl;
+    const struct kv_ops *kv = run->kv;
+    struct hist *lat = &run->lat[w->id * WL_NOPS];
+    enum wl_role role = workload_role(wl, w->id);
+    double mix[WL_NOPS], cumulative[WL_NOPS], sum = 0;
+    unsigned long i, todo, key, len = 0, rows, maxkey = wl->records, misses = 0, scanned = 0;
+    enum wl_op op;
+    uint64_t t0, now, ns;
+    void *ctx;
+    int j;
+
+    for (j = 0; j < WL_NOPS; j++) {
+        mix[j] = role == WL_MIXED || wl_op_writes[j] == (role == WL_WRITER) ? wl->mix[j] : 0;
+        sum += mix[j];
+        hist_reset(&lat[j]);
+    }
+    if (sum == 0) {
+        mix[role == WL_WRITER ? WL_UPDATE : WL_READ] = 1;
+        sum = 1;
+    }
+    for (j = 0; j < WL_NOPS; j++)
+        cumulative[j] = (j ? cumulative[j - 1] : 0) + mix[j] / sum;
+    todo = role == WL_WRITER ? run->per_writer : w->last - w->first;
+
+    ctx = kv->open(w);
+
+    worker_begin(w);
+
+    for (i = 0; i < todo; i++) {
+        if (run->deadline && bench_now() >= run->deadline)
+            break;
+        if (role == WL_READER && wl->writers && !run->writing)
+            break;
+        op = workload_op(cumulative, &w->rng);
+        if (op == WL_INSERT) {
+            key = workload_next_key(wl, 1);
+        } else {
+            if (wl->mix[WL_INSERT] > 0)
+                maxkey = workload_next_key(wl, 0) - 1;
+            key = workload_key(wl, &w->rng, maxkey);
+        }
+
+        if (op == WL_SCAN) {
+            len = wl->scanlen;
+            if (wl->scanmax > len)
+                len += rng_below(&w->rng, wl->scanmax - len + 1);
+        }
+
+        t0 = bench_now();
+        switch (op) {
+        case WL_READ:
+            misses += kv->read(ctx, key);
+            break;
+        case WL_UPDATE:
+            kv->update(ctx, key);
+            break;
+        case WL_INSERT:
+            kv->insert(ctx, key);
+            break;
+        case WL_SCAN:
+            rows = kv->scan(ctx, key, len);
+            misses += rows == 0;
+            scanned += rows;
+            break;
+        case WL_RMW:
+            misses += kv->read(ctx, key);
+            kv->update(ctx, key);
+            break;
+        default:
+            break;
+        }
+        now = bench_now();
+        ns = now - t0;
+
+        hist_add(&lat[op], ns);
+        phase_add(&w->ph, ns, now);
+    }
+
+    worker_end(w);
+
+    if (role == WL_WRITER) {
+        pthread_mutex_lock(&wl->lock);
+        run->writing--;
+        pthread_mutex_unlock(&wl->lock);
+    }
+
+    kv->close(ctx);
+
+    pthread_mutex_lock(&wl->lock);
+    run->misses += misses;
+    run->scanned += scanned;
+    if (w->ph.elapsed > run->elapsed)
+        run->elapsed = w->ph.elapsed;
+    if (role != WL_MIXED) {
+        struct wl_role_stats *rs = &run->roles[role];
+
+        rs->ops += w->ph.ops;
+        rs->retries += w->retries;
+        rs->retry_wait += w->retry_wait;
+        if (w->ph.elapsed > rs->elapsed)
+            rs->elapsed = w->ph.elapsed;
+    }
+    pthread_mutex_unlock(&wl->lock);
+}
+
+static void workload_init(struct wl_run *run, struct workload *wl, unsigned long n,
+                          unsigned long next_key, const struct kv_ops *kv)
+{
+    if (n < 2) {
+        fprintf(stderr, "%s: the workload needs a populated database (-n)\n", progname);
+        exit(1);
+    }
+
+    wl->records = n - 1;
+    wl->next_key = next_key;
+    pthread_mutex_init(&wl->lock, NULL);
+    if (wl->dist == WL_ZIPFIAN || wl->dist == WL_LATEST)
+        zipf_init(wl, wl->records);
+
+    run->wl = wl;
+    run->kv = kv;
+    run->misses = 0;
+    run->scanned = 0;
+    run->elapsed = 0;
+    run->deadline = 0;
+    run->writing = wl->writers;
+    run->per_writer = ULONG_MAX / 2;
+    memset(run->roles, 0, sizeof(run->roles));
+    run->lat = calloc(nthreads * WL_NOPS, sizeof(*run->lat));
+    if (run->lat == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(1);
+    }
+}
+
+/*
+ * Run wl, or uniform reads of keys 1..n-1 when wl is NULL, for the -C
+ * warm-up period. Its phases are printed but left out of the results.
+ * Returns the next key to insert, past those the warm-up inserted.
+ */
+unsigned long workload_warmup(struct workload *wl, unsigned long n, const struct kv_ops *kv)
+{
+    struct workload reads;
+    struct wl_run run;
+    unsigned long next_key;
+    int mark, ivmark, evmark;
+
+    if (cache_warmup() <= 0)
+        return n;
+    if (wl == NULL) {
+        memset(&reads, 0, sizeof(reads));
+        reads.mix[WL_READ] = 1;
+        reads.dist = WL_UNIFORM;
+        wl = &reads;
+    }
+
+    bench_results(&mark);
+    bench_intervals(&ivmark);
+    bench_events(&evmark);
+    workload_init(&run, wl, n, n, kv);
+    run.deadline = bench_now() + (uint64_t)(cache_warmup() * 1e9);
+    workers_run("warmup", 0, ULONG_MAX / 2, workload_worker, &run);
+    next_key = workload_next_key(wl, 0);
+    bench_results_rewind(mark);
+    interval_rewind(ivmark, evmark);
+
+    free(run.lat);
+    pthread_mutex_destroy(&wl->lock);
+    return next_key;
+}
+
+/*
+ * Reader latency and writer throughput of a contention run, each with
+ * the retries and the time its threads lost to them: busy waits and
+ * attempts redone after a deadlock. Time blocked in a lock manager isn't
+ * in it, the engine counters have BerkeleyDB's lock_waits.
+ */
+static void workload_report_roles(struct wl_run *run)
+{
+    struct hist h;
+    char key[64];
+    double secs;
+    enum wl_role r;
+    int t, i;
+
+    for (r = WL_READER; r <= WL_WRITER; r++) {
+        const struct wl_role_stats *rs = &run->roles[r];
+        const char *name = wl_role_names[r];
+
+        if (rs->ops == 0)
+            continue;
+        hist_reset(&h);
+        for (t = 0; t < nthreads; t++)
+            if (workload_role(run->wl, t) == r)
+                for (i = 0; i < WL_NOPS; i++)
+                    hist_merge(&h, &run->lat[t * WL_NOPS + i]);
+        secs = rs->elapsed / 1e9;
+
+        printf("%s: %lu ops in %.6f s, %.1f ops/sec, %lu retries, %.3f s lost to retry waits\n",
+               name, rs->ops, secs, secs > 0 ? rs->ops / secs : 0.0, rs->retries,
+               rs->retry_wait / 1e9);
+        hist_report(name, &h);
+
+        snprintf(key, sizeof(key), "%s_ops_per_sec", name);
+        results_metric(key, "%.1f", secs > 0 ? rs->ops / secs : 0.0);
+        snprintf(key, sizeof(key), "%s_p50_usec", name);
+        results_metric(key, "%.2f", hist_percentile(&h, 50.0) / 1e3);
+        snprintf(key, sizeof(key), "%s_p99_usec", name);
+        results_metric(key, "%.2f", hist_percentile(&h, 99.0) / 1e3);
+        snprintf(key, sizeof(key), "%s_p999_usec", name);
+        results_metric(key, "%.2f", hist_percentile(&h, 99.9) / 1e3);
+        snprintf(key, sizeof(key), "%s_retries", name);
+        results_metric(key, "%lu", rs->retries);
+        snprintf(key, sizeof(key), "%s_retry_wait_s", name);
+        results_metric(key, "%.3f", rs->retry_wait / 1e9);
+    }
+}
+
+void workload_run(struct workload *wl, unsigned long n, const struct kv_ops *kv)
+{
+    struct wl_run run;
+    struct phase ph;
+    struct hist total;
+    unsigned long next_key, ops = wl->ops ? wl->ops : n;
+    int i, t;
+
+    /* Inserts go on past the keys the warm-up inserted */
+    next_key = workload_warmup(wl, n, kv);
+
+    phase_begin(&ph, "workload setup");
+    workload_init(&run, wl, n, next_key, kv);
+    phase_end(&ph);
+
+    /* Readers run as long as the writers, which share the operations */
+    if (wl->writers) {
+        unsigned long first = 0, last = ops;
+
+        procs_slice(&first, &last);
+        run.per_writer = (last - first + wl->writers - 1) / wl->writers;
+        ops = ULONG_MAX / 2;
+    }
+    workers_run("workload", 0, ops, workload_worker, &run);
+
+    for (i = 0; i < WL_NOPS; i++) {
+        hist_reset(&total);
+        for (t = 0; t < nthreads; t++)
+            hist_merge(&total, &run.lat[t * WL_NOPS + i]);
+        if (total.count == 0)
+            continue;
+        printf("%s: %llu ops\n", wl_op_names[i], (unsigned long long)total.count);
+        hist_report(wl_op_names[i], &total);
+    }
+    if (run.misses)
+        printf("workload: %lu keys not found\n", run.misses);
+    /* Cursor efficiency: records per second of wall time and per scan */
+    if (run.scanned) {
+        hist_reset(&total);
+        for (t = 0; t < nthreads; t++)
+            hist_merge(&total, &run.lat[t * WL_NOPS + WL_SCAN]);
+        printf("scan: %lu records, %.1f records/sec, %.1f records per scan\n", run.scanned,
+               run.elapsed ? run.scanned / (run.elapsed / 1e9) : 0.0,
+               (double)run.scanned / total.count);
+        results_metric("scan_records", "%lu", run.scanned);
+        results_metric("scan_records_per_sec", "%.1f",
+                       run.elapsed ? run.scanned / (run.elapsed / 1e9) : 0.0);
+    }
+    workload_report_roles(&run);
+
+    free(run.lat);
+    pthread_mutex_destroy(&wl->lock);
+}
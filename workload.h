@@ -0,0 +1,77 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "worker.h"
+
+/*
+ * YCSB-style mixed workload: every operation is drawn from a read/
+ * update/insert/scan/read-modify-write mix and its key from one of the
+ * distributions below, over the records written by -w (keys 1..n-1).
+ * Inserts append new keys after the populated range. The range scan
+ * action (-L) is a workload of nothing but scans.
+ *
+ * With readers and writers set the threads split into roles instead of
+ * all running the mix: writers run its updates, inserts and rmws (just
+ * updates if it has none) and share the operations among them, readers
+ * run its reads and scans (just reads) until the last writer is done.
+ */
+enum wl_op {
+    WL_READ,
+    WL_UPDATE,
+    WL_INSERT,
+    WL_SCAN,
+    WL_RMW,
+    WL_NOPS
+};
+
+enum wl_dist {
+    WL_UNIFORM,
+    WL_ZIPFIAN,                 /* scrambled zipfian, hot keys spread out */
+    WL_LATEST,                  /* zipfian over the most recent inserts */
+    WL_HOTSPOT                  /* hotops of the ops hit hotset of the keys */
+};
+
+struct workload {
+    double mix[WL_NOPS];        /* relative weights */
+    enum wl_dist dist;
+    double theta;               /* zipfian constant, 0 < theta < 1 */
+    double hotset;              /* hotspot: fraction of keys that is hot */
+    double hotops;              /* hotspot: fraction of ops on hot keys */
+    unsigned long ops;          /* total operations, 0 means n */
+    unsigned long scanlen;      /* records per scan */
+    unsigned long scanmax;      /* > scanlen: uniform in scanlen..scanmax */
+    int readers, writers;       /* contention: threads of each role, 0: mixed */
+
+    /* Run state, set up by workload_run() */
+    unsigned long records;      /* initially populated keys 1..records */
+    unsigned long next_key;     /* next key to insert, see workload_next_key() */
+    pthread_mutex_t lock;
+    double zetan, zeta2, alpha, eta;
+};
+
+/*
+ * Per-backend primitives the workload is driven through. open() builds
+ * the thread's private context (handles, statements, buffers). The
+ * operations return 0 on success or 1 when the key was not found, except
+ * scan() which returns the number of records it read from key on.
+ * insert() overwrites keys left behind by the inserts of an earlier run.
+ */
+struct kv_ops {
+    void *(*open)(struct worker *w);
+    void (*close)(void *ctx);
+    int (*read)(void *ctx, unsigned long key);
+    int (*update)(void *ctx, unsigned long key);
+    int (*insert)(void *ctx, unsigned long key);
+    unsigned long (*scan)(void *ctx, unsigned long key, unsigned long len);
+};
+
+extern int workload_parse(struct workload *wl, char *spec);
+extern int workload_parse_scan(struct workload *wl, char *spec);
+extern void workload_print(const struct workload *wl);
+extern unsigned long workload_warmup(struct workload *wl, unsigned long n, const struct kv_ops *kv);
+extern void workload_run(struct workload *wl, unsigned long n, const struct kv_ops *kv);
+
+#endif